@@ -0,0 +1,984 @@
+// benchmarks for the streamer's hot paths, built with `make bench`
+// conversion, delta encoding and compression run on synthetic frames so they
+// need neither a display nor a panel, capture is only timed if an X server
+// is reachable (`make bench` starts one with xvfb-run if it can)
+// `el_bench --json FILE` also writes every result as JSON so runs of
+// different releases can be compared
+// `el_bench --replay FILE` also delta encodes a recording made with
+// el_streamer --record, frames straight from the mapped file
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "capture.h"
+#include "compress.h"
+#include "convert.h"
+#include "el_decode.h"
+#include "pack.h"
+#include "pool.h"
+#include "protocol.h"
+#include "record.h"
+#include "source.h"
+#include "threshold.h"
+
+struct PanelSize
+{
+    const char *name;
+    uint32_t size_x;
+    uint32_t size_y;
+};
+
+static const PanelSize panelSizes[] = {
+    {"320x240", 320, 240},
+    {"640x480", 640, 480},
+    {"1024x768", 1024, 768},
+};
+
+// screens the conversion and capture benchmarks sample from
+static const PanelSize screenSizes[] = {
+    {"1280x720", 1280, 720},
+    {"1920x1080", 1920, 1080},
+    {"2560x1440", 2560, 1440},
+};
+
+// every operator new of the process, benchAllocations wants none in a warm
+// frame, new[] and the nothrow versions end up here too
+static std::atomic<unsigned long> allocations(0);
+
+void *operator new(size_t size)
+{
+    allocations++;
+    void *p = malloc(size != 0 ? size : 1);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+// not inlined, so the compiler doesn't take free() after new for a mismatch
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+static double nowUs()
+{
+    using namespace std::chrono;
+    return duration_cast<duration<double, std::micro>>(steady_clock::now().time_since_epoch()).count();
+}
+
+// per frame times of one benchmark run
+struct Timings
+{
+    std::vector<double> us;
+
+    double mean() const
+    {
+        double sum = 0;
+        for (size_t i = 0; i < us.size(); i++)
+            sum += us[i];
+        return us.empty() ? 0 : sum / us.size();
+    }
+
+    // nearest rank percentile, p in [0, 100]
+    double percentile(double p) const
+    {
+        if (us.empty())
+            return 0;
+        std::vector<double> sorted(us);
+        std::sort(sorted.begin(), sorted.end());
+        size_t rank = (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5);
+        return sorted[rank];
+    }
+};
+
+// every result as one JSON object per line of the "results" array
+static std::vector<std::string> jsonResults;
+
+static void recordTimings(const char *bench, const char *name, const Timings &t, double bytesPerFrame)
+{
+    char line[512];
+    double mean = t.mean();
+    snprintf(line, sizeof(line),
+             "{\"bench\": \"%s\", \"name\": \"%s\", \"frames\": %zu, \"mean_us\": %.2f, "
+             "\"p50_us\": %.2f, \"p95_us\": %.2f, \"p99_us\": %.2f, \"max_us\": %.2f, "
+             "\"fps\": %.1f, \"mb_per_s\": %.1f}",
+             bench, name, t.us.size(), mean, t.percentile(50), t.percentile(95), t.percentile(99),
+             t.percentile(100), mean > 0 ? 1e6 / mean : 0, mean > 0 ? bytesPerFrame / mean : 0);
+    jsonResults.push_back(line);
+}
+
+static void printTimingsHeader(const char *first)
+{
+    printf("%-28s %10s %10s %10s %10s %9s\n", first, "mean us", "p50 us", "p95 us", "p99 us", "fps");
+}
+
+static void printTimings(const char *name, const Timings &t)
+{
+    double mean = t.mean();
+    printf("%-28s %10.1f %10.1f %10.1f %10.1f %9.1f\n", name, mean, t.percentile(50), t.percentile(95),
+           t.percentile(99), mean > 0 ? 1e6 / mean : 0);
+}
+
+// a BGRA screen with the same kind of content as desktopFrame(), dark
+// background, bright windows and noisy "text" rows, scrolled by frame so
+// consecutive frames differ
+static void desktopScreen(uint32_t width, uint32_t height, unsigned frame, std::vector<uint8_t> &screen)
+{
+    screen.assign(width * height * 4, 0x10);
+    srand(1234);
+    for (int w = 0; w < 6; w++)
+    {
+        uint32_t x0 = rand() % width;
+        uint32_t y0 = rand() % height;
+        uint32_t x1 = x0 + rand() % (width - x0) + 1;
+        uint32_t y1 = y0 + rand() % (height - y0) + 1;
+        uint8_t shade = (uint8_t)(96 + rand() % 160);
+        for (uint32_t y = y0; y < y1; y++)
+        {
+            bool text = (y + frame - y0) % 16 < 10;
+            uint8_t *row = &screen[(y * width + x0) * 4];
+            for (uint32_t x = x0; x < x1; x++, row += 4)
+            {
+                uint8_t v = shade;
+                if (text && ((x * 7 + y * 13 + frame) % 5) < 2)
+                    v = (uint8_t)(shade / 4);
+                row[0] = v;
+                row[1] = v;
+                row[2] = (uint8_t)(v ^ 0x20);
+                row[3] = 0xFF;
+            }
+        }
+    }
+}
+
+// a packed frame that looks roughly like a thresholded desktop: a black
+// background, a few full brightness windows and lines of "text" in them
+static void desktopFrame(uint32_t size_x, uint32_t size_y, unsigned seed, std::vector<uint8_t> &frame)
+{
+    uint32_t stride = size_x / 4;
+    frame.assign(stride * size_y, 0x00);
+    srand(seed);
+    for (int w = 0; w < 4; w++)
+    {
+        uint32_t x0 = rand() % stride;
+        uint32_t y0 = rand() % size_y;
+        uint32_t x1 = x0 + rand() % (stride - x0) + 1;
+        uint32_t y1 = y0 + rand() % (size_y - y0) + 1;
+        for (uint32_t y = y0; y < y1; y++)
+        {
+            bool text = (y - y0) % 12 < 8 && y - y0 > 20;
+            for (uint32_t x = x0; x < x1; x++)
+            {
+                uint8_t b = 0xAA;
+                if (text && x > x0 + 2 && x + 2 < x1 && rand() % 3 == 0)
+                    b = (uint8_t)(rand() & 0xAA);
+                frame[y * stride + x] = b;
+            }
+        }
+    }
+}
+
+static void benchCompression()
+{
+    const int frames = 50;
+    printf("compression (%d synthetic desktop frames per size)\n", frames);
+    printf("%-10s %-9s %8s %12s %12s\n", "panel", "method", "ratio", "encode us", "decode us");
+    for (size_t p = 0; p < sizeof(panelSizes) / sizeof(panelSizes[0]); p++)
+    {
+        const PanelSize &size = panelSizes[p];
+        std::vector<std::vector<uint8_t>> input(frames);
+        for (int f = 0; f < frames; f++)
+            desktopFrame(size.size_x, size.size_y, f, input[f]);
+        size_t raw = input[0].size();
+
+        for (int method = EL_COMPRESS_NONE; method <= EL_COMPRESS_RLE2; method++)
+        {
+            std::vector<uint8_t> out;
+            std::vector<uint8_t> decoded(raw);
+            out.reserve(raw * 2);
+            size_t encoded = 0;
+            double encodeUs = 0;
+            double decodeUs = 0;
+            for (int f = 0; f < frames; f++)
+            {
+                out.clear();
+                double start = nowUs();
+                compress(method, &input[f][0], raw, out);
+                double mid = nowUs();
+                el_decompress(method, &out[0], out.size(), &decoded[0], raw);
+                double end = nowUs();
+                encodeUs += mid - start;
+                decodeUs += end - mid;
+                encoded += out.size();
+                if (decoded != input[f])
+                {
+                    fprintf(stderr, "%s: decoded frame does not match\n", compressionName(method));
+                    exit(1);
+                }
+            }
+            printf("%-10s %-9s %8.2f %12.1f %12.1f\n", size.name, compressionName(method),
+                   (double)raw * frames / encoded, encodeUs / frames, decodeUs / frames);
+            char line[256];
+            snprintf(line, sizeof(line),
+                     "{\"bench\": \"compress\", \"name\": \"%s, %s\", \"frames\": %d, \"ratio\": %.3f, "
+                     "\"encode_us\": %.2f, \"decode_us\": %.2f}",
+                     size.name, compressionName(method), frames, (double)raw * frames / encoded,
+                     encodeUs / frames, decodeUs / frames);
+            jsonResults.push_back(line);
+        }
+    }
+}
+
+// sampling, thresholding and packing of whole frames through convertFrame(),
+// the same call the compute thread makes
+static void benchConversion()
+{
+    const int frames = 100;
+    const int distinct = 8;
+    WorkerPool pool;
+    printf("\nconversion (%d frames per case, %s kernel, %d threads)\n", frames,
+           convertRowName(selectConvertRow()), pool.size());
+    printTimingsHeader("screen -> panel, mode");
+    for (size_t s = 0; s < sizeof(screenSizes) / sizeof(screenSizes[0]); s++)
+    {
+        const PanelSize &screen = screenSizes[s];
+        std::vector<std::vector<uint8_t>> input(distinct);
+        for (int f = 0; f < distinct; f++)
+            desktopScreen(screen.size_x, screen.size_y, f, input[f]);
+        for (size_t p = 0; p < sizeof(panelSizes) / sizeof(panelSizes[0]); p++)
+        {
+            const PanelSize &panel = panelSizes[p];
+            for (int mode = SAMPLE_POINT; mode <= SAMPLE_AREA; mode++)
+            {
+                // scale the whole screen onto the panel, the common case
+                SampleRegion region = computeSampleRegion(screen.size_x, screen.size_y, panel.size_x,
+                                                          panel.size_y, 0, 0, 1, 1, true, mode);
+                ConvertScratch scratch;
+                std::vector<uint8_t> preview(panel.size_x * panel.size_y);
+                std::vector<uint8_t> packed(panel.size_x * panel.size_y / 4);
+                int stride = screen.size_x * 4;
+                Timings t;
+                for (int f = 0; f < frames; f++)
+                {
+                    const uint8_t *image = &input[f % distinct][(region.y * screen.size_x + region.x) * 4];
+                    double start = nowUs();
+                    convertFrame(image, stride, region, 100, 50, DITHER_NONE, pool, scratch, &preview[0],
+                                 &packed[0]);
+                    t.us.push_back(nowUs() - start);
+                }
+                char name[64];
+                snprintf(name, sizeof(name), "%s -> %s, %s", screen.name, panel.name,
+                         mode == SAMPLE_POINT ? "point" : "area");
+                printTimings(name, t);
+                recordTimings("convert", name, t, (double)region.width * region.height * 4);
+            }
+        }
+    }
+}
+
+// the dithering modes on the panel sizes they are meant to keep up on, the
+// wavefront error diffusion is checked against a single threaded run
+static void benchDithering()
+{
+    const int frames = 100;
+    const PanelSize &screen = screenSizes[1];
+    WorkerPool pool;
+    WorkerPool single(1);
+    printf("\ndithering (%d frames per case, %s screen, area sampling, %d threads)\n", frames, screen.name,
+           pool.size());
+    printTimingsHeader("panel, dither");
+    std::vector<uint8_t> input;
+    desktopScreen(screen.size_x, screen.size_y, 0, input);
+    for (size_t p = 0; p < sizeof(panelSizes) / sizeof(panelSizes[0]); p++)
+    {
+        const PanelSize &panel = panelSizes[p];
+        SampleRegion region = computeSampleRegion(screen.size_x, screen.size_y, panel.size_x, panel.size_y,
+                                                  0, 0, 1, 1, true, SAMPLE_AREA);
+        const uint8_t *image = &input[(region.y * screen.size_x + region.x) * 4];
+        int stride = screen.size_x * 4;
+        for (int mode = DITHER_NONE; mode <= DITHER_ATKINSON; mode++)
+        {
+            ConvertScratch scratch;
+            ConvertScratch reference;
+            std::vector<uint8_t> preview(panel.size_x * panel.size_y);
+            std::vector<uint8_t> packed(panel.size_x * panel.size_y / 4);
+            std::vector<uint8_t> expected(packed.size());
+            convertFrame(image, stride, region, 100, 50, mode, single, reference, &preview[0], &expected[0]);
+            Timings t;
+            for (int f = 0; f < frames; f++)
+            {
+                double start = nowUs();
+                convertFrame(image, stride, region, 100, 50, mode, pool, scratch, &preview[0], &packed[0]);
+                t.us.push_back(nowUs() - start);
+                if (packed != expected)
+                {
+                    fprintf(stderr, "%s: %s differs from the single threaded result\n", panel.name,
+                            ditherName(mode));
+                    exit(1);
+                }
+            }
+            char name[64];
+            snprintf(name, sizeof(name), "%s, %s", panel.name, ditherName(mode));
+            printTimings(name, t);
+            recordTimings("dither", name, t, (double)panel.size_x * panel.size_y);
+        }
+    }
+}
+
+// what compute does per panel, convert and repack for a 4bpp panel, on
+// pools of 1 up to twice as many threads as there are cores, every result
+// is checked against the single threaded one
+static void benchScaling()
+{
+    const int frames = 50;
+    const PanelSize &screen = screenSizes[1];
+    int cores = (int)std::thread::hardware_concurrency();
+    if (cores < 1)
+        cores = 1;
+    std::vector<int> counts;
+    for (int threads = 1; threads <= 2 * cores || threads <= 4; threads *= 2)
+        counts.push_back(threads);
+    printf("\nscaling (%d frames per case, %s screen, area sampling, %d cores)\n", frames, screen.name, cores);
+    printf("%-28s %10s %10s %9s %9s %9s\n", "panel, dither, threads", "mean us", "p99 us", "fps", "speedup",
+           "stolen");
+    std::vector<uint8_t> input;
+    desktopScreen(screen.size_x, screen.size_y, 0, input);
+    PanelFormat format;
+    format.bits = 4;
+    format.bitOrder = MSB_FIRST;
+    format.scanOrder = SCAN_ROWS;
+    PackFn pack = selectPacker(format);
+    for (size_t p = 0; p < sizeof(panelSizes) / sizeof(panelSizes[0]); p++)
+    {
+        const PanelSize &panel = panelSizes[p];
+        SampleRegion region = computeSampleRegion(screen.size_x, screen.size_y, panel.size_x, panel.size_y,
+                                                  0, 0, 1, 1, true, SAMPLE_AREA);
+        const uint8_t *image = &input[(region.y * screen.size_x + region.x) * 4];
+        int stride = screen.size_x * 4;
+        for (int mode = DITHER_NONE; mode <= DITHER_FLOYD_STEINBERG; mode++)
+        {
+            std::vector<uint8_t> preview(panel.size_x * panel.size_y);
+            std::vector<uint8_t> native(panel.size_x * panel.size_y / 4);
+            std::vector<uint8_t> packed(packedSize(format, panel.size_x, panel.size_y));
+            std::vector<uint8_t> expected;
+            double baseline = 0;
+            for (size_t c = 0; c < counts.size(); c++)
+            {
+                WorkerPool pool(counts[c]);
+                ConvertScratch scratch;
+                std::vector<std::vector<uint8_t>> packScratch;
+                Timings t;
+                for (int f = 0; f < frames; f++)
+                {
+                    double start = nowUs();
+                    convertFrame(image, stride, region, 100, 50, mode, pool, scratch, &preview[0], &native[0]);
+                    packTiles(format, pack, &preview[0], panel.size_x, panel.size_y, &packed[0], pool,
+                              packScratch);
+                    t.us.push_back(nowUs() - start);
+                }
+                if (c == 0)
+                {
+                    expected = packed;
+                    baseline = t.mean();
+                }
+                else if (packed != expected)
+                {
+                    fprintf(stderr, "%s, %s: %d threads differ from 1\n", panel.name, ditherName(mode), counts[c]);
+                    exit(1);
+                }
+                char name[64];
+                snprintf(name, sizeof(name), "%s, %s, %d", panel.name, ditherName(mode), counts[c]);
+                double mean = t.mean();
+                printf("%-28s %10.1f %10.1f %9.1f %8.2fx %9lu\n", name, mean, t.percentile(99),
+                       mean > 0 ? 1e6 / mean : 0, mean > 0 ? baseline / mean : 0, pool.stolen());
+                recordTimings("scaling", name, t, (double)panel.size_x * panel.size_y);
+            }
+        }
+    }
+}
+
+// what the serial thread does per frame: diff against the last frame, then
+// compress the spans
+static void benchDeltaEncoding()
+{
+    const int frames = 200;
+    printf("\ndelta encoding (%d frames per case, one window changing per frame)\n", frames);
+    printTimingsHeader("panel, compression");
+    for (size_t p = 0; p < sizeof(panelSizes) / sizeof(panelSizes[0]); p++)
+    {
+        const PanelSize &size = panelSizes[p];
+        std::vector<uint8_t> frame;
+        desktopFrame(size.size_x, size.size_y, 1, frame);
+        for (int method = EL_COMPRESS_NONE; method <= EL_COMPRESS_RLE2; method++)
+        {
+            DeltaEncoder encoder;
+            encoder.compression = method;
+            std::vector<uint8_t> current(frame);
+            std::vector<uint8_t> packet;
+            // what the panel shows, every packet has to bring it up to date
+            std::vector<uint8_t> panel(frame);
+            size_t sent = 0;
+            Timings t;
+            srand(99);
+            for (int f = 0; f < frames; f++)
+            {
+                // a blinking cursor sized change somewhere on the panel
+                size_t at = rand() % (current.size() - 64);
+                for (size_t i = 0; i < 64; i++)
+                    current[at + i] ^= 0xAA;
+                double start = nowUs();
+                encoder.encode(&current[0], current.size(), size.size_x, size.size_y, false,
+                               PROTOCOL_VERSION, packet);
+                t.us.push_back(nowUs() - start);
+                sent += packet.size();
+                if (el_apply_packet(&packet[0], packet.size(), &panel[0], size.size_x, size.size_y) != EL_OK ||
+                    panel != current)
+                {
+                    fprintf(stderr, "Delta packet %d of %s does not decode to the frame\n", f, size.name);
+                    exit(1);
+                }
+            }
+            char name[64];
+            snprintf(name, sizeof(name), "%s, %s", size.name, compressionName(method));
+            printTimings(name, t);
+            recordTimings("delta", name, t, (double)current.size());
+            printf("%-28s %10.1f bytes/frame on the wire\n", "", (double)sent / frames);
+        }
+    }
+}
+
+// grabs of the panel sized rectangle through the same X11Capture the
+// screenshot thread uses, skipped without an X server
+// a real session rather than synthetic frames, every panel's frames go
+// through their own encoder as they did when they were recorded
+static bool benchReplay(const char *path)
+{
+    FrameReplay replay;
+    if (!replay.open(path))
+        return false;
+    printf("\nreplay of %s\n", path);
+    printTimingsHeader("compression");
+    for (int method = EL_COMPRESS_NONE; method <= EL_COMPRESS_RLE2; method++)
+    {
+        std::vector<DeltaEncoder> encoders;
+        std::vector<uint8_t> packet;
+        size_t raw = 0;
+        size_t sent = 0;
+        Timings t;
+        RecordHeader header;
+        const uint8_t *data = nullptr;
+        replay.rewind();
+        while (replay.next(header, data))
+        {
+            // only the EL format goes out as delta packets
+            if (!nativeFormat(header.format()))
+                continue;
+            if (header.panel >= encoders.size())
+                encoders.resize(header.panel + 1);
+            DeltaEncoder &encoder = encoders[header.panel];
+            encoder.compression = method;
+            double start = nowUs();
+            encoder.encode(data, header.bytes, header.size_x, header.size_y, false, PROTOCOL_VERSION, packet);
+            t.us.push_back(nowUs() - start);
+            raw += header.bytes;
+            sent += packet.size();
+        }
+        if (t.us.empty())
+        {
+            printf("no frames\n");
+            return true;
+        }
+        printTimings(compressionName(method), t);
+        recordTimings("replay", compressionName(method), t, (double)raw / t.us.size());
+        printf("%-28s %10.1f bytes/frame on the wire, %.1f raw\n", "", (double)sent / t.us.size(),
+               (double)raw / t.us.size());
+    }
+    return true;
+}
+
+// repacking the preview for panels that don't take the EL format, checked
+// against the reference packer
+static void benchPacking()
+{
+    const int frames = 200;
+    const PanelSize &size = panelSizes[1];
+    printf("\npacking %s (%d frames per format)\n", size.name, frames);
+    printTimingsHeader("format");
+    std::vector<uint8_t> preview(size.size_x * size.size_y);
+    srand(5);
+    for (size_t i = 0; i < preview.size(); i++)
+        preview[i] = (rand() % 3) * 127;
+    for (int bits = 1; bits <= 4; bits *= 2)
+    {
+        for (int scan = SCAN_ROWS; scan <= SCAN_COLUMNS; scan++)
+        {
+            for (int order = MSB_FIRST; order <= LSB_FIRST; order++)
+            {
+                PanelFormat format = {bits, order, scan};
+                PackFn pack = selectPacker(format);
+                size_t bytes = packedSize(format, size.size_x, size.size_y);
+                std::vector<uint8_t> packed(bytes);
+                std::vector<uint8_t> reference(bytes);
+                std::vector<uint8_t> scratch;
+                Timings t;
+                for (int f = 0; f < frames; f++)
+                {
+                    double start = nowUs();
+                    pack(&preview[0], size.size_x, size.size_y, &packed[0], scratch);
+                    t.us.push_back(nowUs() - start);
+                }
+                packFrameReference(format, &preview[0], size.size_x, size.size_y, &reference[0]);
+                if (packed != reference)
+                {
+                    fprintf(stderr, "%s: packed frame does not match the reference\n", formatName(format));
+                    exit(1);
+                }
+                printTimings(formatName(format), t);
+                recordTimings("pack", formatName(format), t, (double)preview.size());
+            }
+        }
+    }
+}
+
+// what compute and serial do to a frame once their buffers have grown to
+// it, conversion in every dither mode, the 16 grays, packing into every
+// other format on the pool's threads and delta encoding, must not allocate,
+// exits with 1 if any of it does
+static void benchAllocations()
+{
+    const int warmup = 3;
+    const int frames = 20;
+    const PanelSize &screen = screenSizes[0];
+    const PanelSize &panel = panelSizes[0];
+    WorkerPool pool(3);
+    printf("\nallocations (%d warm frames, %s -> %s, %d threads)\n", frames, screen.name, panel.name, pool.size());
+    std::vector<std::vector<uint8_t>> input(2);
+    for (int f = 0; f < 2; f++)
+        desktopScreen(screen.size_x, screen.size_y, f, input[f]);
+    std::vector<uint8_t> preview(panel.size_x * panel.size_y);
+    std::vector<uint8_t> native(panel.size_x * panel.size_y / 4);
+    std::vector<uint8_t> packed(panel.size_x * panel.size_y);
+    std::vector<std::vector<uint8_t>> packScratch(pool.size());
+    std::vector<uint8_t> packet;
+    uint32_t histogram[256];
+    ConvertScratch scratch[2];
+    DeltaEncoder encoder;
+    encoder.compression = EL_COMPRESS_RLE2;
+    unsigned long before = 0;
+    for (int f = 0; f < warmup + frames; f++)
+    {
+        if (f == warmup)
+            before = allocations.load();
+        for (int mode = SAMPLE_POINT; mode <= SAMPLE_AREA; mode++)
+        {
+            SampleRegion region = computeSampleRegion(screen.size_x, screen.size_y, panel.size_x, panel.size_y,
+                                                      0, 0, 1, 1, true, mode);
+            const uint8_t *image = &input[f % 2][(region.y * screen.size_x + region.x) * 4];
+            int stride = screen.size_x * 4;
+            for (int dither = DITHER_NONE; dither <= DITHER_ATKINSON; dither++)
+            {
+                convertFrame(image, stride, region, 100, 50, dither, pool, scratch[mode], &preview[0], &native[0],
+                             histogram);
+                encoder.encode(&native[0], native.size(), panel.size_x, panel.size_y, false, PROTOCOL_VERSION,
+                               packet);
+            }
+            grayFrame(image, stride, region, pool, scratch[mode], &preview[0], histogram);
+            for (int bits = 1; bits <= 4; bits *= 2)
+            {
+                for (int scan = SCAN_ROWS; scan <= SCAN_COLUMNS; scan++)
+                {
+                    for (int order = MSB_FIRST; order <= LSB_FIRST; order++)
+                    {
+                        PanelFormat format = {bits, order, scan};
+                        if (!nativeFormat(format))
+                            packTiles(format, selectPacker(format), &preview[0], panel.size_x, panel.size_y,
+                                      &packed[0], pool, packScratch);
+                    }
+                }
+            }
+        }
+    }
+    unsigned long counted = allocations.load() - before;
+    printf("%-28s %10lu allocations\n", "warm frames", counted);
+    if (counted > 0)
+    {
+        fprintf(stderr, "%lu allocations in %d warm frames, the hot path has to reuse its buffers\n", counted,
+                frames);
+        exit(1);
+    }
+}
+
+// what compute spends per panel to find out a frame didn't change
+static void benchFrameHash()
+{
+    const int frames = 1000;
+    printf("\nframe hash (%d frames per panel)\n", frames);
+    printTimingsHeader("panel");
+    for (size_t p = 0; p < sizeof(panelSizes) / sizeof(panelSizes[0]); p++)
+    {
+        const PanelSize &size = panelSizes[p];
+        std::vector<uint8_t> frame;
+        desktopFrame(size.size_x, size.size_y, 1, frame);
+        Timings t;
+        uint64_t seen = 0;
+        for (int f = 0; f < frames; f++)
+        {
+            double start = nowUs();
+            seen ^= frameHash(&frame[0], frame.size());
+            t.us.push_back(nowUs() - start);
+        }
+        printTimings(size.name, t);
+        recordTimings("hash", size.name, t, (double)frame.size());
+        // keeps the loop from being optimised away
+        if (seen == 1)
+            printf("\n");
+    }
+}
+
+// conversion with the luma histogram for --auto-threshold next to the plain
+// conversion, and picking the thresholds from it, the histogram has to
+// count every pixel once whatever the dither mode
+static void benchAutoThreshold()
+{
+    const int frames = 100;
+    const PanelSize &screen = screenSizes[1];
+    WorkerPool pool;
+    printf("\nauto threshold (%d frames per case, %s screen, area sampling, %d threads)\n", frames, screen.name,
+           pool.size());
+    printTimingsHeader("panel, stage");
+    std::vector<uint8_t> input;
+    desktopScreen(screen.size_x, screen.size_y, 0, input);
+    for (size_t p = 0; p < sizeof(panelSizes) / sizeof(panelSizes[0]); p++)
+    {
+        const PanelSize &panel = panelSizes[p];
+        SampleRegion region = computeSampleRegion(screen.size_x, screen.size_y, panel.size_x, panel.size_y,
+                                                  0, 0, 1, 1, true, SAMPLE_AREA);
+        const uint8_t *image = &input[(region.y * screen.size_x + region.x) * 4];
+        int stride = screen.size_x * 4;
+        ConvertScratch scratch;
+        std::vector<uint8_t> preview(panel.size_x * panel.size_y);
+        std::vector<uint8_t> packed(panel.size_x * panel.size_y / 4);
+        uint32_t histogram[256];
+        for (int mode = DITHER_NONE; mode <= DITHER_ATKINSON; mode++)
+        {
+            convertFrame(image, stride, region, 100, 50, mode, pool, scratch, &preview[0], &packed[0], histogram);
+            uint64_t counted = 0;
+            for (int v = 0; v < 256; v++)
+                counted += histogram[v];
+            if (counted != (uint64_t)panel.size_x * panel.size_y)
+            {
+                fprintf(stderr, "%s: the %s histogram counts %llu of %u pixels\n", panel.name, ditherName(mode),
+                        (unsigned long long)counted, panel.size_x * panel.size_y);
+                exit(1);
+            }
+        }
+        Timings plain;
+        Timings counted;
+        for (int f = 0; f < frames; f++)
+        {
+            double start = nowUs();
+            convertFrame(image, stride, region, 100, 50, DITHER_NONE, pool, scratch, &preview[0], &packed[0]);
+            plain.us.push_back(nowUs() - start);
+            start = nowUs();
+            convertFrame(image, stride, region, 100, 50, DITHER_NONE, pool, scratch, &preview[0], &packed[0],
+                         histogram);
+            counted.us.push_back(nowUs() - start);
+        }
+        char name[64];
+        snprintf(name, sizeof(name), "%s, convert", panel.name);
+        printTimings(name, plain);
+        recordTimings("threshold", name, plain, (double)panel.size_x * panel.size_y);
+        snprintf(name, sizeof(name), "%s, + histogram", panel.name);
+        printTimings(name, counted);
+        recordTimings("threshold", name, counted, (double)panel.size_x * panel.size_y);
+        for (int mode = AUTO_THRESHOLD_OTSU; mode <= AUTO_THRESHOLD_PERCENTILE; mode++)
+        {
+            Timings t;
+            for (int f = 0; f < frames; f++)
+            {
+                // start far off so every run picks
+                int high = -100;
+                int mid = -100;
+                double start = nowUs();
+                autoThreshold(mode, histogram, high, mid);
+                t.us.push_back(nowUs() - start);
+            }
+            snprintf(name, sizeof(name), "%s, %s", panel.name, autoThresholdName(mode));
+            printTimings(name, t);
+            recordTimings("threshold", name, t, 256);
+        }
+    }
+}
+
+// the sources that stand in for the screen, they need no X server: the
+// test pattern drawing a frame, and raw frames coming through a pipe the
+// way an encoder would send them, checked to arrive whole and in order
+static void benchSources()
+{
+    const int frames = 100;
+    const PanelSize &screen = screenSizes[0];
+    printf("\nsources (%d frames per case, %s frames)\n", frames, screen.name);
+    printTimingsHeader("source");
+    PatternSource pattern(screen.size_x, screen.size_y);
+    pattern.open();
+    Timings t;
+    int Bpp = 0;
+    int Stride = 0;
+    for (int f = 0; f < frames; f++)
+    {
+        double start = nowUs();
+        pattern.grab(0, 0, screen.size_x, screen.size_y, Bpp, Stride);
+        t.us.push_back(nowUs() - start);
+    }
+    printTimings("pattern", t);
+    recordTimings("source", "pattern", t, (double)screen.size_x * screen.size_y * 4);
+
+    for (int format = RAW_BGRA; format <= RAW_GRAY; format++)
+    {
+        const char *name = format == RAW_BGRA ? "raw bgra pipe" : "raw gray pipe";
+        int fds[2];
+        if (pipe(fds) != 0)
+        {
+            perror("pipe");
+            return;
+        }
+        size_t bytes = (size_t)screen.size_x * screen.size_y * (format == RAW_GRAY ? 1 : 4);
+        std::thread writer([&]() {
+            std::vector<uint8_t> frame(bytes);
+            for (int f = 0; f < frames; f++)
+            {
+                // every byte says which frame it belongs to
+                memset(&frame[0], f, bytes);
+                for (size_t done = 0; done < bytes;)
+                {
+                    ssize_t n = write(fds[1], &frame[done], bytes - done);
+                    if (n <= 0)
+                        return;
+                    done += n;
+                }
+            }
+        });
+        RawVideoSource raw("/dev/fd/" + std::to_string(fds[0]), screen.size_x, screen.size_y, format);
+        Timings r;
+        bool ok = raw.open();
+        // three frames kept at a time like the capture thread does, they
+        // must stay as they were and once the pool has them all nothing
+        // more is allocated
+        FrameRef held[3];
+        uint64_t allocations = 0;
+        for (int f = 0; ok && f < frames; f++)
+        {
+            FrameRef &kept = held[f % 3];
+            if (kept && kept.data()[0] != (uint8_t)(f - 3))
+            {
+                fprintf(stderr, "%s: kept frame %d was overwritten\n", name, f - 3);
+                exit(1);
+            }
+            kept.reset();
+            if (f == 10)
+                allocations = FramePool::allocations();
+            double start = nowUs();
+            while (!raw.takeDamage(0, 0, screen.size_x, screen.size_y))
+                std::this_thread::yield();
+            const uint8_t *image = raw.grab(0, 0, screen.size_x, screen.size_y, Bpp, Stride);
+            r.us.push_back(nowUs() - start);
+            size_t last = (size_t)(screen.size_y - 1) * Stride + (screen.size_x - 1) * 4;
+            if (image[0] != (uint8_t)f || image[last] != (uint8_t)f || image[last + 1] != (uint8_t)f)
+            {
+                fprintf(stderr, "%s: frame %d came out torn\n", name, f);
+                exit(1);
+            }
+            if (!raw.keep(kept))
+            {
+                fprintf(stderr, "%s: frame %d could not be kept\n", name, f);
+                exit(1);
+            }
+        }
+        if (ok && FramePool::allocations() != allocations)
+        {
+            fprintf(stderr, "%s: %llu buffers allocated after warming up\n", name,
+                    (unsigned long long)(FramePool::allocations() - allocations));
+            exit(1);
+        }
+        writer.join();
+        raw.close();
+        close(fds[0]);
+        close(fds[1]);
+        printTimings(name, r);
+        recordTimings("source", name, r, (double)bytes);
+    }
+
+    // a producer thread filling an el_ring as fast as it gets slots, the
+    // consumer holds three frames at a time like the capture thread does
+    // and checks each is still whole when it gives it back
+    std::string ringName = "/el_bench_" + std::to_string(getpid());
+    el_ring ring;
+    if (el_ring_create(&ring, ringName.c_str(), screen.size_x, screen.size_y, 6) != EL_RING_OK)
+    {
+        perror("el_ring_create");
+        return;
+    }
+    std::atomic<bool> producing(true);
+    std::thread producer([&]() {
+        uint8_t value = 0;
+        while (producing)
+        {
+            uint8_t *pixels = el_ring_begin(&ring);
+            if (pixels == nullptr)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            memset(pixels, ++value, (size_t)ring.header->stride * screen.size_y);
+            el_ring_publish(&ring, 0);
+        }
+    });
+    ShmSource shm(ringName);
+    Timings s;
+    bool ok = shm.open();
+    FrameRef held[3];
+    uint8_t values[3] = {0, 0, 0};
+    size_t last = (size_t)(screen.size_y - 1) * ring.header->stride + (screen.size_x - 1) * 4;
+    for (int f = 0; ok && f < frames + 3; f++)
+    {
+        int k = f % 3;
+        if (held[k])
+        {
+            if (held[k].data()[0] != values[k] || held[k].data()[last] != values[k])
+            {
+                fprintf(stderr, "shm ring: a held frame was overwritten\n");
+                exit(1);
+            }
+            held[k].reset();
+        }
+        if (f >= frames)
+            continue;
+        double start = nowUs();
+        while (!shm.takeDamage(0, 0, screen.size_x, screen.size_y))
+            shm.waitForChange(100);
+        const uint8_t *image = shm.grab(0, 0, screen.size_x, screen.size_y, Bpp, Stride);
+        if (image == nullptr || !shm.keep(held[k]))
+        {
+            fprintf(stderr, "shm ring: frame %d could not be held\n", f);
+            exit(1);
+        }
+        values[k] = image[0];
+        s.us.push_back(nowUs() - start);
+    }
+    producing = false;
+    producer.join();
+    shm.close();
+    el_ring_destroy(&ring, ringName.c_str());
+    printTimings("shm ring, in place", s);
+    recordTimings("source", "shm ring, in place", s, (double)screen.size_x * screen.size_y * 4);
+}
+
+static void benchCapture()
+{
+    const int frames = 100;
+    X11Capture capture;
+    if (!capture.open())
+    {
+        printf("\ncapture skipped, no X server (run under xvfb-run to include it)\n");
+        return;
+    }
+    int Width = 0;
+    int Height = 0;
+    capture.getSize(Width, Height);
+    printf("\ncapture (%d frames per case, %dx%d root window, %s)\n", frames, Width, Height,
+           capture.usingShm() ? "XShm" : "XGetImage");
+    printTimingsHeader("rectangle");
+    for (size_t p = 0; p < sizeof(panelSizes) / sizeof(panelSizes[0]); p++)
+    {
+        const PanelSize &size = panelSizes[p];
+        if ((int)size.size_x > Width || (int)size.size_y > Height)
+            continue;
+        Timings t;
+        int Bpp = 0;
+        int Stride = 0;
+        for (int f = 0; f < frames; f++)
+        {
+            double start = nowUs();
+            if (capture.grab(0, 0, size.size_x, size.size_y, Bpp, Stride) == nullptr)
+                break;
+            t.us.push_back(nowUs() - start);
+        }
+        printTimings(size.name, t);
+        recordTimings("capture", size.name, t, (double)size.size_x * size.size_y * 4);
+    }
+    // the whole screen, what the streamer used to grab before it cropped
+    Timings t;
+    int Bpp = 0;
+    int Stride = 0;
+    for (int f = 0; f < frames; f++)
+    {
+        double start = nowUs();
+        if (capture.grab(0, 0, Width, Height, Bpp, Stride) == nullptr)
+            break;
+        t.us.push_back(nowUs() - start);
+    }
+    printTimings("full screen", t);
+    recordTimings("capture", "full screen", t, (double)Width * Height * 4);
+}
+
+static bool writeJson(const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "Unable to write %s\n", path);
+        return false;
+    }
+    fprintf(file, "{\n  \"kernel\": \"%s\",\n  \"results\": [\n", convertRowName(selectConvertRow()));
+    for (size_t i = 0; i < jsonResults.size(); i++)
+        fprintf(file, "    %s%s\n", jsonResults[i].c_str(), i + 1 < jsonResults.size() ? "," : "");
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    const char *jsonPath = nullptr;
+    const char *replayPath = nullptr;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+        {
+            jsonPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+        {
+            replayPath = argv[++i];
+        }
+        else
+        {
+            fprintf(stderr, "Usage: %s [--json FILE] [--replay FILE]\n", argv[0]);
+            return 1;
+        }
+    }
+    benchCompression();
+    benchConversion();
+    benchDithering();
+    benchScaling();
+    benchDeltaEncoding();
+    if (replayPath != nullptr && !benchReplay(replayPath))
+        return 1;
+    benchPacking();
+    benchAllocations();
+    benchFrameHash();
+    benchAutoThreshold();
+    benchSources();
+    benchCapture();
+    if (jsonPath != nullptr && !writeJson(jsonPath))
+        return 1;
+    return 0;
+}
@@ -0,0 +1,293 @@
+#include "capture.h"
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <stdio.h>
+
+// XShmAttach reports failure asynchronously through the error handler, so we
+// swap in our own handler while attaching and check this flag after XSync
+static bool shmError = false;
+static int shmErrorHandler(Display *, XErrorEvent *)
+{
+    shmError = true;
+    return 0;
+}
+
+X11Capture::X11Capture()
+    : display(nullptr), root(0), image(nullptr), current(-1), shmSupported(false),
+      shmAttached(false), imageWidth(0), imageHeight(0), damageTracked(false),
+      dirtyX0(0), dirtyY0(0), dirtyX1(0), dirtyY1(0)
+{
+}
+
+X11Capture::~X11Capture()
+{
+    close();
+}
+
+bool X11Capture::open(const char *displayName)
+{
+    close();
+    display = XOpenDisplay(displayName);
+    if (display == nullptr)
+    {
+        fprintf(stderr, "Capture: unable to open display\n");
+        return false;
+    }
+    root = DefaultRootWindow(display);
+    shmSupported = XShmQueryExtension(display);
+    if (!shmSupported)
+    {
+        fprintf(stderr, "Capture: MIT-SHM not available, falling back to XGetImage\n");
+    }
+    return true;
+}
+
+void X11Capture::close()
+{
+    if (display == nullptr)
+        return;
+    destroyShmImages();
+    if (image != nullptr)
+    {
+        XDestroyImage(image);
+        image = nullptr;
+    }
+#ifdef HAVE_XDAMAGE
+    if (damageTracked)
+        XDamageDestroy(display, damage);
+#endif
+    damageTracked = false;
+    XCloseDisplay(display);
+    display = nullptr;
+}
+
+void X11Capture::getSize(int &Width, int &Height)
+{
+    XWindowAttributes attributes = {0};
+    XGetWindowAttributes(display, root, &attributes);
+    Width = attributes.width;
+    Height = attributes.height;
+}
+
+// no X calls, the last ref may go on any thread and after the display
+void X11Capture::ShmImage::recycle()
+{
+    shmdt(info.shmaddr);
+    // the data belongs to the segment, don't let Xlib free it
+    image->data = nullptr;
+    XDestroyImage(image);
+    delete this;
+}
+
+X11Capture::ShmImage *X11Capture::createShmImage(int Width, int Height)
+{
+    int screen = DefaultScreen(display);
+    ShmImage *shmImage = new ShmImage;
+    XShmSegmentInfo &info = shmImage->info;
+    XImage *created = XShmCreateImage(display, DefaultVisual(display, screen), DefaultDepth(display, screen),
+                                      ZPixmap, nullptr, &info, Width, Height);
+    if (created == nullptr)
+    {
+        delete shmImage;
+        return nullptr;
+    }
+
+    info.shmid = shmget(IPC_PRIVATE, created->bytes_per_line * created->height, IPC_CREAT | 0600);
+    if (info.shmid < 0)
+    {
+        XDestroyImage(created);
+        delete shmImage;
+        return nullptr;
+    }
+    info.shmaddr = (char *)shmat(info.shmid, nullptr, 0);
+    if (info.shmaddr == (char *)-1)
+    {
+        shmctl(info.shmid, IPC_RMID, nullptr);
+        XDestroyImage(created);
+        delete shmImage;
+        return nullptr;
+    }
+    created->data = info.shmaddr;
+    info.readOnly = False;
+
+    shmError = false;
+    XErrorHandler oldHandler = XSetErrorHandler(shmErrorHandler);
+    XShmAttach(display, &info);
+    XSync(display, False);
+    XSetErrorHandler(oldHandler);
+    // mark the segment for removal now, it lives on until the last detach
+    shmctl(info.shmid, IPC_RMID, nullptr);
+
+    if (shmError)
+    {
+        shmdt(info.shmaddr);
+        created->data = nullptr;
+        XDestroyImage(created);
+        delete shmImage;
+        return nullptr;
+    }
+    shmImage->image = created;
+    shmImage->data = (uint8_t *)created->data;
+    shmImage->capacity = (size_t)created->bytes_per_line * created->height;
+    shmAttached = true;
+    imageWidth = Width;
+    imageHeight = Height;
+    return shmImage;
+}
+
+void X11Capture::destroyShmImages()
+{
+    if (!shmAttached)
+        return;
+    for (int i = 0; i < SHM_IMAGES; i++)
+    {
+        if (shm[i])
+            XShmDetach(display, &((ShmImage *)shm[i].get())->info);
+    }
+    XSync(display, False);
+    // the server is done with them, segments compute still reads go later
+    for (int i = 0; i < SHM_IMAGES; i++)
+        shm[i].reset();
+    current = -1;
+    shmAttached = false;
+}
+
+const uint8_t *X11Capture::grab(int x, int y, int Width, int Height, int &BitsPerPixel, int &Stride)
+{
+    if (display == nullptr && !open())
+        return nullptr;
+    if (Width <= 0 || Height <= 0)
+        return nullptr;
+
+    if (shmSupported)
+    {
+        // the requested rectangle changed size, start over with new segments
+        if (shmAttached && (Width != imageWidth || Height != imageHeight))
+            destroyShmImages();
+        // the segment of the last grab unless it was kept, then any other
+        // nobody holds, then a new one
+        int pick = -1;
+        for (int k = 0; k < SHM_IMAGES && pick < 0; k++)
+        {
+            int i = (current + SHM_IMAGES + k) % SHM_IMAGES;
+            if (current >= 0 && shm[i].unique())
+                pick = i;
+        }
+        for (int i = 0; i < SHM_IMAGES && pick < 0; i++)
+        {
+            if (shm[i])
+                continue;
+            ShmImage *created = createShmImage(Width, Height);
+            if (created == nullptr && !shmAttached)
+            {
+                fprintf(stderr, "Capture: unable to attach SHM segment, falling back to XGetImage\n");
+                shmSupported = false;
+            }
+            if (created != nullptr)
+            {
+                shm[i] = FrameRef(created);
+                pick = i;
+            }
+            break;
+        }
+        if (shmSupported && pick < 0)
+            return nullptr;
+        current = pick;
+    }
+
+    if (shmAttached)
+    {
+        XImage *shmImage = ((ShmImage *)shm[current].get())->image;
+        if (!XShmGetImage(display, root, shmImage, x, y, AllPlanes))
+            return nullptr;
+        BitsPerPixel = shmImage->bits_per_pixel;
+        Stride = shmImage->bytes_per_line;
+        return (const uint8_t *)shmImage->data;
+    }
+    else
+    {
+        if (image != nullptr)
+            XDestroyImage(image);
+        image = XGetImage(display, root, x, y, Width, Height, AllPlanes, ZPixmap);
+        if (image == nullptr)
+            return nullptr;
+    }
+
+    BitsPerPixel = image->bits_per_pixel;
+    Stride = image->bytes_per_line;
+    return (const uint8_t *)image->data;
+}
+
+bool X11Capture::keep(FrameRef &frame)
+{
+    if (!shmAttached || current < 0)
+        return false;
+    int lent = 1;
+    for (int i = 0; i < SHM_IMAGES; i++)
+    {
+        if (i != current && shm[i] && !shm[i].unique())
+            lent++;
+    }
+    if (lent >= SHM_IMAGES)
+        return false;
+    frame = shm[current];
+    return true;
+}
+
+bool X11Capture::trackDamage()
+{
+    if (display == nullptr)
+        return false;
+    if (damageTracked)
+        return true;
+#ifdef HAVE_XDAMAGE
+    int errorBase;
+    if (!XDamageQueryExtension(display, &damageEvent, &errorBase))
+        return false;
+    // raw rectangles need no XDamageSubtract, every change is its own event
+    damage = XDamageCreate(display, root, XDamageReportRawRectangles);
+    damageTracked = true;
+    // anything that happened before we started listening
+    dirtyX0 = dirtyY0 = 0;
+    dirtyX1 = dirtyY1 = 1 << 30;
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool X11Capture::takeDamage(int x, int y, int Width, int Height)
+{
+    if (!damageTracked)
+        return true;
+#ifdef HAVE_XDAMAGE
+    // the connection only ever receives damage events, drain them all
+    while (XPending(display) > 0)
+    {
+        XEvent event;
+        XNextEvent(display, &event);
+        if (event.type != damageEvent + XDamageNotify)
+            continue;
+        const XRectangle &area = ((XDamageNotifyEvent *)&event)->area;
+        if (dirtyX1 <= dirtyX0 || dirtyY1 <= dirtyY0)
+        {
+            dirtyX0 = area.x;
+            dirtyY0 = area.y;
+            dirtyX1 = area.x + area.width;
+            dirtyY1 = area.y + area.height;
+            continue;
+        }
+        if (area.x < dirtyX0)
+            dirtyX0 = area.x;
+        if (area.y < dirtyY0)
+            dirtyY0 = area.y;
+        if (area.x + area.width > dirtyX1)
+            dirtyX1 = area.x + area.width;
+        if (area.y + area.height > dirtyY1)
+            dirtyY1 = area.y + area.height;
+    }
+#endif
+    bool dirty = dirtyX0 < x + Width && x < dirtyX1 && dirtyY0 < y + Height && y < dirtyY1;
+    dirtyX0 = dirtyY0 = dirtyX1 = dirtyY1 = 0;
+    return dirty;
+}
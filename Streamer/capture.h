@@ -0,0 +1,88 @@
+#pragma once
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#ifdef HAVE_XDAMAGE
+#include <X11/extensions/Xdamage.h>
+#endif
+#include <cstdint>
+#include "source.h"
+
+// keeps a single connection to the X server open and grabs the root window
+// into MIT-SHM segments that are reused between frames, if the server does
+// not support SHM (remote display, Xvfb without the extension, ...) it falls
+// back to a plain XGetImage on the same connection
+// a grab into a segment can be kept, compute then reads the segment in place
+// and the next grabs go to another one
+class X11Capture : public FrameSource
+{
+public:
+    // the streamer keeps up to 3 grabs (one per CaptureFrame) and grabs
+    // into one more
+    static const int SHM_IMAGES = 4;
+
+    X11Capture();
+    ~X11Capture();
+
+    // connect to $DISPLAY
+    bool open() override { return open(nullptr); }
+    // nullptr means $DISPLAY
+    bool open(const char *displayName);
+    void close() override;
+    bool isOpen() const override { return display != nullptr; }
+    bool usingShm() const { return shmAttached; }
+
+    // size of the root window
+    void getSize(int &Width, int &Height) override;
+
+    // grab a Width by Height rectangle of the root window at (x, y), the
+    // returned pointer stays valid until the next call to grab() or close(),
+    // Stride is the length of one row in bytes
+    const uint8_t *grab(int x, int y, int Width, int Height, int &BitsPerPixel, int &Stride) override;
+
+    // ask the server to report every change to the root window, false if
+    // it (or this build) has no XDamage, then everything counts as dirty
+    bool trackDamage() override;
+    bool trackingDamage() const { return damageTracked; }
+    // true if anything inside the rectangle changed since the last call,
+    // forgets the damage seen so far either way
+    bool takeDamage(int x, int y, int Width, int Height) override;
+
+    // the segment of the last grab, unless that would leave none for the next
+    bool keep(FrameRef &frame) override;
+
+    const char *name() const override { return "X11"; }
+
+private:
+    // an XImage in a segment of its own, we hold a ref to each one that is
+    // attached, one still kept when it is detached goes with its last ref
+    class ShmImage : public FrameBuffer
+    {
+    public:
+        XImage *image;
+        XShmSegmentInfo info;
+
+    protected:
+        void recycle() override;
+    };
+
+    ShmImage *createShmImage(int Width, int Height);
+    void destroyShmImages();
+
+    Display *display;
+    Window root;
+    XImage *image;              // the last XGetImage result
+    FrameRef shm[SHM_IMAGES];   // the attached segments, empty ones not made yet
+    int current;                // the segment of the last grab, -1 for none
+    bool shmSupported;          // the extension is present on the server
+    bool shmAttached;           // we have live segments attached
+    int imageWidth;
+    int imageHeight;
+    bool damageTracked;
+#ifdef HAVE_XDAMAGE
+    Damage damage;
+    int damageEvent;            // XDamageNotify is damageEvent + XDamageNotify
+#endif
+    // bounding box of the damage reported since the last takeDamage()
+    int dirtyX0, dirtyY0, dirtyX1, dirtyY1;
+};
@@ -0,0 +1,117 @@
+#include "compress.h"
+
+// how many times in[i] repeats, up to max
+static size_t runLength(const uint8_t *in, size_t size, size_t i, size_t max)
+{
+    size_t run = 1;
+    while (i + run < size && run < max && in[i + run] == in[i])
+        run++;
+    return run;
+}
+
+size_t packBits(const uint8_t *in, size_t size, std::vector<uint8_t> &out)
+{
+    size_t before = out.size();
+    size_t i = 0;
+    while (i < size)
+    {
+        size_t run = runLength(in, size, i, 128);
+        if (run >= 2)
+        {
+            out.push_back((uint8_t)(257 - run));
+            out.push_back(in[i]);
+            i += run;
+            continue;
+        }
+        // literals until the next run of 3, a run of 2 isn't worth
+        // breaking a literal for
+        size_t start = i;
+        while (i < size && i - start < 128)
+        {
+            if (i + 2 < size && in[i] == in[i + 1] && in[i] == in[i + 2])
+                break;
+            i++;
+        }
+        out.push_back((uint8_t)(i - start - 1));
+        out.insert(out.end(), in + start, in + i);
+    }
+    return out.size() - before;
+}
+
+// a byte made of four pixels of the same level
+static inline bool uniformByte(uint8_t b)
+{
+    return b == 0x00 || b == 0x55 || b == 0xAA || b == 0xFF;
+}
+
+size_t rle2(const uint8_t *in, size_t size, std::vector<uint8_t> &out)
+{
+    size_t before = out.size();
+    size_t i = 0;
+    while (i < size)
+    {
+        uint8_t b = in[i];
+        if (uniformByte(b))
+        {
+            size_t run = runLength(in, size, i, 4096);
+            if (run >= 2)
+            {
+                out.push_back(0xC0 | ((b / 0x55) << 4) | ((run - 1) >> 8));
+                out.push_back((run - 1) & 0xFF);
+                i += run;
+                continue;
+            }
+        }
+        else
+        {
+            size_t run = runLength(in, size, i, 65);
+            if (run >= 3)
+            {
+                out.push_back(0x80 | (run - 2));
+                out.push_back(b);
+                i += run;
+                continue;
+            }
+        }
+        // literals until something that would be cheaper as a run
+        size_t start = i;
+        i++;
+        while (i < size && i - start < 128)
+        {
+            if (i + 1 < size && in[i] == in[i + 1] &&
+                (uniformByte(in[i]) || (i + 2 < size && in[i] == in[i + 2])))
+                break;
+            i++;
+        }
+        out.push_back((uint8_t)(i - start - 1));
+        out.insert(out.end(), in + start, in + i);
+    }
+    return out.size() - before;
+}
+
+size_t compress(int method, const uint8_t *in, size_t size, std::vector<uint8_t> &out)
+{
+    switch (method)
+    {
+    case EL_COMPRESS_PACKBITS:
+        return packBits(in, size, out);
+    case EL_COMPRESS_RLE2:
+        return rle2(in, size, out);
+    default:
+        out.insert(out.end(), in, in + size);
+        return size;
+    }
+}
+
+const char *compressionName(int method)
+{
+    switch (method)
+    {
+    case EL_COMPRESS_PACKBITS:
+        return "PackBits";
+    case EL_COMPRESS_RLE2:
+        return "RLE2";
+    default:
+        return "None";
+    }
+}
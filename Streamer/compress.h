@@ -0,0 +1,17 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "el_decode.h"
+
+// encoders for the payload compression methods, the formats and the
+// matching decoders are in el_decode.h
+// each one appends to out and returns the number of bytes it appended
+
+size_t packBits(const uint8_t *in, size_t size, std::vector<uint8_t> &out);
+size_t rle2(const uint8_t *in, size_t size, std::vector<uint8_t> &out);
+
+// dispatch on an EL_COMPRESS_ method, EL_COMPRESS_NONE just copies
+size_t compress(int method, const uint8_t *in, size_t size, std::vector<uint8_t> &out);
+
+const char *compressionName(int method);
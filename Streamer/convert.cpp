@@ -0,0 +1,544 @@
+#include "convert.h"
+#include "pool.h"
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+LumaTables::LumaTables()
+{
+    for (int v = 0; v < 256; v++)
+    {
+        b[v] = v * LUMA_B;
+        g[v] = v * LUMA_G;
+        r[v] = v * LUMA_R;
+    }
+}
+
+const LumaTables lumaTables;
+
+void convertRowScalar(const uint8_t *bgra, int n, int threshHigh, int threshMid,
+                      uint8_t *preview, uint8_t *packed, uint32_t *histogram)
+{
+    int groups = n / 4;
+    for (int i = 0; i < groups; i++)
+    {
+        uint8_t byte = 0;
+        for (int j = 0; j < 4; j++)
+        {
+            const uint8_t *pixel = bgra + (i * 4 + j) * 4;
+            // pixel[0] B
+            // pixel[1] G
+            // pixel[2] R
+            int y = luma(pixel);
+            if (histogram != nullptr)
+                histogram[y]++;
+            uint8_t level;
+            if (y > threshHigh)
+                level = 2;
+            else if (y > threshMid)
+                level = 1;
+            else
+                level = 0;
+            preview[i * 4 + j] = level * 127;
+            byte |= level << (6 - j * 2);
+        }
+        packed[i] = byte;
+    }
+    // leftovers that don't fill a byte only get the luma
+    for (int i = groups * 4; i < n; i++)
+    {
+        int y = luma(bgra + i * 4);
+        if (histogram != nullptr)
+            histogram[y]++;
+        preview[i] = y;
+    }
+}
+
+// the lumas are at most 255, so any threshold outside of -1..255 behaves
+// exactly like the nearest end of that range, this keeps them in int16 lanes
+static inline int clampThreshold(int t)
+{
+    return t < -1 ? -1 : (t > 255 ? 255 : t);
+}
+
+// count the 8 bit lumas of a block of pixels, in any order
+static inline void countLumas(const uint8_t *lumas, int n, uint32_t *histogram)
+{
+    for (int k = 0; k < n; k++)
+    {
+        histogram[lumas[k]]++;
+    }
+}
+
+#if defined(__SSE2__)
+// luma() of 4 BGRA pixels in 32 bit lanes, the same integer weights as
+// lumaTables so the result is bit for bit the scalar one
+static inline __m128i luma_SSE2(__m128i px)
+{
+    const __m128i lowBytes = _mm_set1_epi32(0x00FF00FF);
+    const __m128i weightsBR = _mm_set1_epi32(LUMA_B | LUMA_R << 16);
+    const __m128i weightG = _mm_set1_epi32(LUMA_G);
+    const __m128i round = _mm_set1_epi32(128);
+    __m128i br = _mm_and_si128(px, lowBytes);       // B and R as 16 bit
+    __m128i ga = _mm_srli_epi16(px, 8);             // G and A as 16 bit
+    __m128i sum = _mm_add_epi32(_mm_madd_epi16(br, weightsBR), _mm_madd_epi16(ga, weightG));
+    return _mm_srli_epi32(_mm_add_epi32(sum, round), 8);
+}
+
+// four 2 bit levels per 32 bit lane (one per byte) into one byte, MSB first
+static inline __m128i packLevels_SSE2(__m128i lv)
+{
+    __m128i b0 = _mm_and_si128(_mm_slli_epi32(lv, 6), _mm_set1_epi32(0xC0));
+    __m128i b1 = _mm_and_si128(_mm_srli_epi32(lv, 4), _mm_set1_epi32(0x30));
+    __m128i b2 = _mm_and_si128(_mm_srli_epi32(lv, 14), _mm_set1_epi32(0x0C));
+    __m128i b3 = _mm_srli_epi32(lv, 24);
+    return _mm_or_si128(_mm_or_si128(b0, b1), _mm_or_si128(b2, b3));
+}
+
+void convertRowSSE2(const uint8_t *bgra, int n, int threshHigh, int threshMid,
+                    uint8_t *preview, uint8_t *packed, uint32_t *histogram)
+{
+    const __m128i high = _mm_set1_epi16(clampThreshold(threshHigh));
+    const __m128i mid = _mm_set1_epi16(clampThreshold(threshMid));
+    const __m128i two = _mm_set1_epi16(2);
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i full = _mm_set1_epi16(254);
+    const __m128i half = _mm_set1_epi16(127);
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        const uint8_t *p = bgra + i * 4;
+        __m128i s0 = luma_SSE2(_mm_loadu_si128((const __m128i *)(p + 0)));
+        __m128i s1 = luma_SSE2(_mm_loadu_si128((const __m128i *)(p + 16)));
+        __m128i s2 = luma_SSE2(_mm_loadu_si128((const __m128i *)(p + 32)));
+        __m128i s3 = luma_SSE2(_mm_loadu_si128((const __m128i *)(p + 48)));
+        __m128i lumaA = _mm_packs_epi32(s0, s1);
+        __m128i lumaB = _mm_packs_epi32(s2, s3);
+        if (histogram != nullptr)
+        {
+            uint8_t lumas[16];
+            _mm_storeu_si128((__m128i *)lumas, _mm_packus_epi16(lumaA, lumaB));
+            countLumas(lumas, 16, histogram);
+        }
+
+        __m128i hiA = _mm_cmpgt_epi16(lumaA, high);
+        __m128i midA = _mm_andnot_si128(hiA, _mm_cmpgt_epi16(lumaA, mid));
+        __m128i hiB = _mm_cmpgt_epi16(lumaB, high);
+        __m128i midB = _mm_andnot_si128(hiB, _mm_cmpgt_epi16(lumaB, mid));
+
+        __m128i lvA = _mm_or_si128(_mm_and_si128(hiA, two), _mm_and_si128(midA, one));
+        __m128i lvB = _mm_or_si128(_mm_and_si128(hiB, two), _mm_and_si128(midB, one));
+        __m128i pvA = _mm_or_si128(_mm_and_si128(hiA, full), _mm_and_si128(midA, half));
+        __m128i pvB = _mm_or_si128(_mm_and_si128(hiB, full), _mm_and_si128(midB, half));
+
+        _mm_storeu_si128((__m128i *)(preview + i), _mm_packus_epi16(pvA, pvB));
+
+        __m128i bytes = packLevels_SSE2(_mm_packus_epi16(lvA, lvB));
+        bytes = _mm_packus_epi16(_mm_packs_epi32(bytes, bytes), bytes);
+        int32_t out = _mm_cvtsi128_si32(bytes);
+        memcpy(packed + i / 4, &out, 4);
+    }
+    convertRowScalar(bgra + i * 4, n - i, threshHigh, threshMid, preview + i, packed + i / 4, histogram);
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static inline __m256i luma_AVX2(__m256i px)
+{
+    const __m256i lowBytes = _mm256_set1_epi32(0x00FF00FF);
+    const __m256i weightsBR = _mm256_set1_epi32(LUMA_B | LUMA_R << 16);
+    const __m256i weightG = _mm256_set1_epi32(LUMA_G);
+    const __m256i round = _mm256_set1_epi32(128);
+    __m256i br = _mm256_and_si256(px, lowBytes);
+    __m256i ga = _mm256_srli_epi16(px, 8);
+    __m256i sum = _mm256_add_epi32(_mm256_madd_epi16(br, weightsBR), _mm256_madd_epi16(ga, weightG));
+    return _mm256_srli_epi32(_mm256_add_epi32(sum, round), 8);
+}
+
+__attribute__((target("avx2")))
+void convertRowAVX2(const uint8_t *bgra, int n, int threshHigh, int threshMid,
+                    uint8_t *preview, uint8_t *packed, uint32_t *histogram)
+{
+    const __m256i high = _mm256_set1_epi16(clampThreshold(threshHigh));
+    const __m256i mid = _mm256_set1_epi16(clampThreshold(threshMid));
+    const __m256i two = _mm256_set1_epi16(2);
+    const __m256i one = _mm256_set1_epi16(1);
+    const __m256i full = _mm256_set1_epi16(254);
+    const __m256i half = _mm256_set1_epi16(127);
+    // the packs work per 128 bit lane, after both of them the groups of
+    // 4 pixels end up in dword order 0 2 4 6 1 3 5 7
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    int i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        const uint8_t *p = bgra + i * 4;
+        __m256i s0 = luma_AVX2(_mm256_loadu_si256((const __m256i *)(p + 0)));
+        __m256i s1 = luma_AVX2(_mm256_loadu_si256((const __m256i *)(p + 32)));
+        __m256i s2 = luma_AVX2(_mm256_loadu_si256((const __m256i *)(p + 64)));
+        __m256i s3 = luma_AVX2(_mm256_loadu_si256((const __m256i *)(p + 96)));
+        __m256i lumaA = _mm256_packs_epi32(s0, s1);
+        __m256i lumaB = _mm256_packs_epi32(s2, s3);
+        if (histogram != nullptr)
+        {
+            // the histogram doesn't care about the lane order
+            uint8_t lumas[32];
+            _mm256_storeu_si256((__m256i *)lumas, _mm256_packus_epi16(lumaA, lumaB));
+            countLumas(lumas, 32, histogram);
+        }
+
+        __m256i hiA = _mm256_cmpgt_epi16(lumaA, high);
+        __m256i midA = _mm256_andnot_si256(hiA, _mm256_cmpgt_epi16(lumaA, mid));
+        __m256i hiB = _mm256_cmpgt_epi16(lumaB, high);
+        __m256i midB = _mm256_andnot_si256(hiB, _mm256_cmpgt_epi16(lumaB, mid));
+
+        __m256i lvA = _mm256_or_si256(_mm256_and_si256(hiA, two), _mm256_and_si256(midA, one));
+        __m256i lvB = _mm256_or_si256(_mm256_and_si256(hiB, two), _mm256_and_si256(midB, one));
+        __m256i pvA = _mm256_or_si256(_mm256_and_si256(hiA, full), _mm256_and_si256(midA, half));
+        __m256i pvB = _mm256_or_si256(_mm256_and_si256(hiB, full), _mm256_and_si256(midB, half));
+
+        __m256i pv = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(pvA, pvB), order);
+        _mm256_storeu_si256((__m256i *)(preview + i), pv);
+
+        __m256i lv = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(lvA, lvB), order);
+        __m256i b0 = _mm256_and_si256(_mm256_slli_epi32(lv, 6), _mm256_set1_epi32(0xC0));
+        __m256i b1 = _mm256_and_si256(_mm256_srli_epi32(lv, 4), _mm256_set1_epi32(0x30));
+        __m256i b2 = _mm256_and_si256(_mm256_srli_epi32(lv, 14), _mm256_set1_epi32(0x0C));
+        __m256i b3 = _mm256_srli_epi32(lv, 24);
+        __m256i bytes = _mm256_or_si256(_mm256_or_si256(b0, b1), _mm256_or_si256(b2, b3));
+        __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(bytes), _mm256_extracti128_si256(bytes, 1));
+        _mm_storel_epi64((__m128i *)(packed + i / 4), _mm_packus_epi16(words, words));
+    }
+    convertRowScalar(bgra + i * 4, n - i, threshHigh, threshMid, preview + i, packed + i / 4, histogram);
+}
+#endif
+
+SampleRegion computeSampleRegion(int Width, int Height, uint size_x, uint size_y,
+                                 int offset_x, int offset_y, int step_x, int step_y,
+                                 bool fullscreen, int mode)
+{
+    SampleRegion region;
+    region.mode = mode;
+    region.size_x = size_x;
+    region.size_y = size_y;
+    if (size_x == 0 || size_y == 0 || Width <= 0 || Height <= 0)
+    {
+        region.x_step = region.y_step = 1;
+        region.x = region.y = region.width = region.height = 0;
+        return region;
+    }
+    if (fullscreen)
+    {
+        step_x = Width / size_x;
+        step_y = Height / size_y;
+    }
+    else
+    {
+        if (step_x > (int)(Width / size_x))
+            step_x = Width / size_x;
+        if (step_y > (int)(Height / size_y))
+            step_y = Height / size_y;
+    }
+    // a panel bigger than the screen still gets one sample per screen pixel
+    region.x_step = step_x > 0 ? step_x : 1;
+    region.y_step = step_y > 0 ? step_y : 1;
+
+    region.x = offset_x < 0 ? 0 : offset_x;
+    region.y = offset_y < 0 ? 0 : offset_y;
+    if (region.x >= Width)
+        region.x = Width > 0 ? Width - 1 : 0;
+    if (region.y >= Height)
+        region.y = Height > 0 ? Height - 1 : 0;
+
+    if (mode == SAMPLE_AREA)
+    {
+        // every cell in full
+        region.width = size_x * region.x_step;
+        region.height = size_y * region.y_step;
+    }
+    else
+    {
+        // from the first to the last sample point, inclusive
+        region.width = (size_x - 1) * region.x_step + 1;
+        region.height = (size_y - 1) * region.y_step + 1;
+    }
+    if (region.x + region.width > Width)
+        region.width = Width - region.x;
+    if (region.y + region.height > Height)
+        region.height = Height - region.y;
+    return region;
+}
+
+// averages every pixel of each x_step by y_step cell, cells cut off by the
+// edge of the screen average what is left of them
+static void sampleRowArea(const uint8_t *image, int stride, const SampleRegion &region, uint y,
+                          SampleScratch &scratch)
+{
+    uint size_x = region.size_x;
+    int y0 = y * region.y_step;
+    int y1 = y0 + region.y_step;
+    if (y0 >= region.height)
+        y0 = region.height - 1;
+    if (y1 > region.height)
+        y1 = region.height;
+    if (y1 <= y0)
+        y1 = y0 + 1;
+
+    scratch.acc.assign(size_x * 3, 0);
+    uint32_t *acc = &scratch.acc[0];
+    for (int sy = y0; sy < y1; sy++)
+    {
+        const uint8_t *src = image + sy * stride;
+        int sx = 0;
+        for (uint x = 0; x < size_x; x++)
+        {
+            int end = (x + 1) * region.x_step;
+            if (end > region.width)
+                end = region.width;
+            uint32_t b = 0, g = 0, r = 0;
+            for (; sx < end; sx++)
+            {
+                b += src[sx * 4 + 0];
+                g += src[sx * 4 + 1];
+                r += src[sx * 4 + 2];
+            }
+            acc[x * 3 + 0] += b;
+            acc[x * 3 + 1] += g;
+            acc[x * 3 + 2] += r;
+        }
+    }
+
+    uint8_t *out = &scratch.row[0];
+    int rows = y1 - y0;
+    for (uint x = 0; x < size_x; x++)
+    {
+        int x0 = x * region.x_step;
+        int x1 = x0 + region.x_step;
+        if (x1 > region.width)
+            x1 = region.width;
+        int count = (x1 - x0) * rows;
+        if (count <= 0)
+        {
+            // nothing left of this cell, repeat the last one
+            if (x > 0)
+                memcpy(out + x * 4, out + (x - 1) * 4, 4);
+            else
+                memcpy(out, image + (y0 * stride) + (region.width - 1) * 4, 4);
+            continue;
+        }
+        out[x * 4 + 0] = (acc[x * 3 + 0] + count / 2) / count;
+        out[x * 4 + 1] = (acc[x * 3 + 1] + count / 2) / count;
+        out[x * 4 + 2] = (acc[x * 3 + 2] + count / 2) / count;
+        out[x * 4 + 3] = 0xFF;
+    }
+}
+
+const uint8_t *sampleRow(const uint8_t *image, int stride, const SampleRegion &region, uint y,
+                         SampleScratch &scratch)
+{
+    uint size_x = region.size_x;
+    scratch.row.resize(size_x * 4);
+    if (region.mode == SAMPLE_AREA)
+    {
+        sampleRowArea(image, stride, region, y, scratch);
+        return &scratch.row[0];
+    }
+
+    // position inside the captured rectangle, clamped to the edge
+    int big_y = y * region.y_step;
+    if (big_y >= region.height)
+        big_y = region.height - 1;
+    const uint8_t *src = image + big_y * stride;
+    if (region.x_step == 1 && (int)size_x <= region.width)
+        return src;
+
+    uint8_t *out = &scratch.row[0];
+    for (uint x = 0; x < size_x; x++)
+    {
+        int big_x = x * region.x_step;
+        if (big_x >= region.width)
+            big_x = region.width - 1;
+        memcpy(out + x * 4, src + big_x * 4, 4);
+    }
+    return out;
+}
+
+ConvertRowFn selectConvertRow()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return convertRowAVX2;
+#endif
+#if defined(__SSE2__)
+    return convertRowSSE2;
+#else
+    return convertRowScalar;
+#endif
+}
+
+const char *convertRowName(ConvertRowFn fn)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (fn == convertRowAVX2)
+        return "AVX2";
+#endif
+#if defined(__SSE2__)
+    if (fn == convertRowSSE2)
+        return "SSE2";
+#endif
+    return "scalar";
+}
+
+void convertRow(const uint8_t *bgra, int n, int threshHigh, int threshMid,
+                uint8_t *preview, uint8_t *packed, uint32_t *histogram)
+{
+    static const ConvertRowFn fn = selectConvertRow();
+    fn(bgra, n, threshHigh, threshMid, preview, packed, histogram);
+}
+
+void clearBandHistograms(ConvertScratch &scratch, int bands)
+{
+    for (int band = 0; band < bands; band++)
+    {
+        memset(scratch.bands[band].histogram, 0, sizeof(scratch.bands[band].histogram));
+    }
+}
+
+void sumBandHistograms(const ConvertScratch &scratch, int bands, uint32_t *histogram)
+{
+    memset(histogram, 0, 256 * sizeof(uint32_t));
+    for (int band = 0; band < bands; band++)
+    {
+        const uint32_t *h = scratch.bands[band].histogram;
+        for (int v = 0; v < 256; v++)
+        {
+            histogram[v] += h[v];
+        }
+    }
+}
+
+void convertFrame(const uint8_t *image, int stride, const SampleRegion &region, int threshHigh,
+                  int threshMid, int dither, WorkerPool &pool, ConvertScratch &scratch,
+                  uint8_t *preview, uint8_t *packed, uint32_t *histogram)
+{
+    if (dither != DITHER_NONE)
+    {
+        ditherFrame(image, stride, region, threshHigh, threshMid, dither, pool, scratch, preview, packed,
+                    histogram);
+        return;
+    }
+    uint size_x = region.size_x;
+    uint size_y = region.size_y;
+    // rows can be converted on their own if every row fills whole bytes,
+    // otherwise the groups of 4 pixels wrap around and the samples of
+    // the whole frame are gathered first
+    bool rowAligned = size_x % 4 == 0;
+    if (!rowAligned)
+    {
+        scratch.frameSamples.resize(size_x * size_y * 4);
+    }
+    // a few row tiles per thread, the scratch goes with the thread
+    int threads = pool.size();
+    int tiles = rowTiles(size_y, threads);
+    if (scratch.bands.size() < (size_t)threads)
+    {
+        scratch.bands.resize(threads);
+    }
+    if (histogram != nullptr && rowAligned)
+    {
+        clearBandHistograms(scratch, threads);
+    }
+    pool.run(tiles, [&](int tile, int thread) {
+        uint y0 = size_y * tile / tiles;
+        uint y1 = size_y * (tile + 1) / tiles;
+        SampleScratch &sample = scratch.bands[thread];
+        for (uint y = y0; y < y1; y++)
+        {
+            const uint8_t *row = sampleRow(image, stride, region, y, sample);
+            if (rowAligned)
+            {
+                // luma, histogram, threshold and pack in one pass
+                convertRow(row, size_x, threshHigh, threshMid, &preview[y * size_x], &packed[y * size_x / 4],
+                           histogram != nullptr ? sample.histogram : nullptr);
+            }
+            else
+            {
+                memcpy(&scratch.frameSamples[y * size_x * 4], row, size_x * 4);
+            }
+        }
+    });
+    if (!rowAligned)
+    {
+        if (histogram != nullptr)
+            memset(histogram, 0, 256 * sizeof(uint32_t));
+        convertRow(&scratch.frameSamples[0], size_x * size_y, threshHigh, threshMid, preview, packed, histogram);
+    }
+    else if (histogram != nullptr)
+    {
+        sumBandHistograms(scratch, threads, histogram);
+    }
+}
+
+void grayFrame(const uint8_t *image, int stride, const SampleRegion &region, WorkerPool &pool,
+               ConvertScratch &scratch, uint8_t *preview, uint32_t *histogram)
+{
+    uint size_x = region.size_x;
+    uint size_y = region.size_y;
+    int threads = pool.size();
+    int tiles = rowTiles(size_y, threads);
+    if (scratch.bands.size() < (size_t)threads)
+    {
+        scratch.bands.resize(threads);
+    }
+    if (histogram != nullptr)
+    {
+        clearBandHistograms(scratch, threads);
+    }
+    pool.run(tiles, [&](int tile, int thread) {
+        uint y0 = size_y * tile / tiles;
+        uint y1 = size_y * (tile + 1) / tiles;
+        SampleScratch &sample = scratch.bands[thread];
+        for (uint y = y0; y < y1; y++)
+        {
+            const uint8_t *row = sampleRow(image, stride, region, y, sample);
+            uint8_t *out = &preview[y * size_x];
+            for (uint x = 0; x < size_x; x++)
+            {
+                int l = luma(row + x * 4);
+                if (histogram != nullptr)
+                    sample.histogram[l]++;
+                out[x] = (uint8_t)((l * 15 + 127) / 255 * 17);
+            }
+        }
+    });
+    if (histogram != nullptr)
+    {
+        sumBandHistograms(scratch, threads, histogram);
+    }
+}
+
+uint64_t frameHash(const uint8_t *data, size_t size)
+{
+    // FNV-1a a word at a time, the shift folds the high half back in so
+    // every bit of a word reaches every bit of the hash
+    const uint64_t prime = 1099511628211ULL;
+    uint64_t hash = 14695981039346656037ULL ^ size;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * prime;
+        hash ^= hash >> 32;
+    }
+    for (; i < size; i++)
+    {
+        hash = (hash ^ data[i]) * prime;
+    }
+    return hash;
+}
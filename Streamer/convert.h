@@ -0,0 +1,182 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <sys/types.h>
+
+class WorkerPool;
+
+// how a panel pixel is derived from the screen
+enum SampleMode
+{
+    SAMPLE_POINT = 0,           // one screen pixel per panel pixel
+    SAMPLE_AREA = 1,            // the average of every screen pixel in the step cell
+};
+
+// the part of the screen the panel samples from, together with the step
+// that was used to derive it, so the compute stage can map panel pixels back
+// into the captured rectangle without re-reading the sliders
+struct SampleRegion
+{
+    uint size_x;                // panel size in pixels
+    uint size_y;
+    int x_step;                 // distance between two samples on screen
+    int y_step;
+    int x;                      // top left corner of the rectangle on screen
+    int y;
+    int width;                  // size of the rectangle
+    int height;
+    int mode;                   // SampleMode
+};
+
+// work out the step and the bounding rectangle of all sample points (or
+// cells, in SAMPLE_AREA mode) for a size_x by size_y panel on a Width by
+// Height screen
+SampleRegion computeSampleRegion(int Width, int Height, uint size_x, uint size_y,
+                                 int offset_x, int offset_y, int step_x, int step_y,
+                                 bool fullscreen, int mode);
+
+// per thread buffers for sampleRow, reused between frames
+struct SampleScratch
+{
+    std::vector<uint8_t> row;   // size_x BGRA samples
+    std::vector<uint32_t> acc;  // per channel sums for SAMPLE_AREA
+    uint32_t histogram[256];    // luma histogram of the rows this thread converted
+};
+
+// produce the size_x BGRA samples of panel row y from the captured rectangle
+// (image, stride bytes per row), returns either a pointer straight into the
+// image (point sampling with step 1) or into scratch.row
+const uint8_t *sampleRow(const uint8_t *image, int stride, const SampleRegion &region, uint y,
+                         SampleScratch &scratch);
+
+// BT.601 luma in 1/256ths, the weights add up to 256 so white stays 255
+static const int LUMA_B = 29;
+static const int LUMA_G = 150;
+static const int LUMA_R = 77;
+
+// value * weight for every channel value, so the scalar paths get a pixel's
+// luma with three lookups and no multiply or divide
+struct LumaTables
+{
+    uint16_t b[256];
+    uint16_t g[256];
+    uint16_t r[256];
+
+    LumaTables();
+};
+
+extern const LumaTables lumaTables;
+
+// (29 B + 150 G + 77 R + 128) / 256 of a BGRA pixel, 0..255
+static inline int luma(const uint8_t *pixel)
+{
+    return (lumaTables.b[pixel[0]] + lumaTables.g[pixel[1]] + lumaTables.r[pixel[2]] + 128) >> 8;
+}
+
+// converts n BGRA pixels into the 2bpp panel format in a single pass
+// each pixel is reduced to its luma() and thresholded:
+//   > threshHigh -> 2 (10), > threshMid -> 1 (01), otherwise 0 (00)
+// preview gets level * 127 for every pixel (n bytes)
+// packed gets 4 pixels per byte, first pixel in the top bits (n / 4 bytes)
+// if n is not a multiple of 4 the trailing pixels are not packed and their
+// preview holds the plain luma
+// unless it is nullptr, histogram[l] is incremented for every pixel of luma l
+typedef void (*ConvertRowFn)(const uint8_t *bgra, int n, int threshHigh, int threshMid,
+                             uint8_t *preview, uint8_t *packed, uint32_t *histogram);
+
+// reference implementation, the SIMD kernels must match it bit for bit
+void convertRowScalar(const uint8_t *bgra, int n, int threshHigh, int threshMid,
+                      uint8_t *preview, uint8_t *packed, uint32_t *histogram);
+#if defined(__SSE2__)
+void convertRowSSE2(const uint8_t *bgra, int n, int threshHigh, int threshMid,
+                    uint8_t *preview, uint8_t *packed, uint32_t *histogram);
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+// only call this if the CPU supports AVX2, see selectConvertRow()
+void convertRowAVX2(const uint8_t *bgra, int n, int threshHigh, int threshMid,
+                    uint8_t *preview, uint8_t *packed, uint32_t *histogram);
+#endif
+
+// the fastest kernel the CPU we are running on supports
+ConvertRowFn selectConvertRow();
+const char *convertRowName(ConvertRowFn fn);
+
+// dispatches to selectConvertRow()
+void convertRow(const uint8_t *bgra, int n, int threshHigh, int threshMid,
+                uint8_t *preview, uint8_t *packed, uint32_t *histogram = nullptr);
+
+// how the luma of a pixel is turned into one of the 3 panel levels
+enum DitherMode
+{
+    DITHER_NONE = 0,            // hard threshold against threshMid/threshHigh
+    DITHER_BAYER = 1,           // 8x8 ordered dither
+    DITHER_FLOYD_STEINBERG = 2, // error diffusion, 7/16 3/16 5/16 1/16
+    DITHER_ATKINSON = 3,        // error diffusion, 1/8 to six neighbours, keeps more contrast
+};
+
+// buffers for ditherFrame, reused between frames
+struct DitherScratch
+{
+    int16_t lut[256];                       // luma -> level * 256, see buildLevelLut
+    int lutHigh;                            // thresholds the lut was built for
+    int lutMid;
+    std::vector<uint8_t> levels;            // 0..2 per pixel, packed at the end
+    std::vector<int16_t> errors;            // error diffused into rows below, size_y + 2 rows
+    std::unique_ptr<std::atomic<int>[]> progress; // pixels finished per row
+    uint progressRows;
+
+    DitherScratch() : lutHigh(-2), lutMid(-2), progressRows(0) {}
+};
+
+// per frame buffers for convertFrame, reused between frames
+struct ConvertScratch
+{
+    std::vector<SampleScratch> bands;   // one per thread of the pool
+    std::vector<uint8_t> frameSamples;  // the whole frame when rows don't fill whole bytes
+    DitherScratch dither;
+};
+
+// sample and convert a whole captured rectangle (image, stride bytes per
+// row) into preview (size_x * size_y bytes) and packed (size_x * size_y / 4
+// bytes), the rows are split into rowTiles() tiles for the threads of pool
+// dither is a DitherMode, anything but DITHER_NONE goes through ditherFrame
+// histogram, if not nullptr, gets the 256 bin luma histogram of the frame,
+// counted by the threads while they convert
+void convertFrame(const uint8_t *image, int stride, const SampleRegion &region, int threshHigh,
+                  int threshMid, int dither, WorkerPool &pool, ConvertScratch &scratch,
+                  uint8_t *preview, uint8_t *packed, uint32_t *histogram = nullptr);
+
+// 4 bit panels: sample a captured rectangle like convertFrame and round
+// the luma of every sample to one of 16 grays, preview gets gray * 17 so
+// the 4 bit packers take the gray from its top bits, no thresholds or
+// dithering, there are enough levels without
+void grayFrame(const uint8_t *image, int stride, const SampleRegion &region, WorkerPool &pool,
+               ConvertScratch &scratch, uint8_t *preview, uint32_t *histogram = nullptr);
+
+// maps a luma to a position between the levels in 1/256ths (0..512),
+// piecewise linear so that threshMid + 0.5 lands halfway between level 0 and
+// 1 and threshHigh + 0.5 halfway between 1 and 2, rounding it gives the same
+// levels as hard thresholding and dithering around it keeps the mean
+void buildLevelLut(int threshHigh, int threshMid, int16_t lut[256]);
+
+// the dithered counterpart of the rowAligned path in convertFrame, same
+// inputs and outputs
+// Bayer rows are independent and split into tiles, error diffusion runs
+// one row per job in a wavefront: a row only advances while the row above
+// it is at least two pixels ahead, which is all the error it takes from it
+void ditherFrame(const uint8_t *image, int stride, const SampleRegion &region, int threshHigh,
+                 int threshMid, int mode, WorkerPool &pool, ConvertScratch &scratch,
+                 uint8_t *preview, uint8_t *packed, uint32_t *histogram);
+
+// zeroes the histograms of the first bands threads of scratch, and adds
+// them up into histogram once they are filled
+void clearBandHistograms(ConvertScratch &scratch, int bands);
+void sumBandHistograms(const ConvertScratch &scratch, int bands, uint32_t *histogram);
+
+const char *ditherName(int mode);
+
+// 64 bit hash of a packed frame, compute compares it with the last one it
+// published to leave frames that didn't change out of the pipeline
+uint64_t frameHash(const uint8_t *data, size_t size);
@@ -0,0 +1,275 @@
+#include "convert.h"
+#include "pool.h"
+#include <cstring>
+#include <thread>
+
+// 8x8 Bayer matrix, 0..63
+static const uint8_t bayer8[8][8] = {
+    {0, 32, 8, 40, 2, 34, 10, 42},
+    {48, 16, 56, 24, 50, 18, 58, 26},
+    {12, 44, 4, 36, 14, 46, 6, 38},
+    {60, 28, 52, 20, 62, 30, 54, 22},
+    {3, 35, 11, 43, 1, 33, 9, 41},
+    {51, 19, 59, 27, 49, 17, 57, 25},
+    {15, 47, 7, 39, 13, 45, 5, 37},
+    {63, 31, 55, 23, 61, 29, 53, 21},
+};
+
+// error diffusion works on this many pixels between two looks at the row above
+static const int DIFFUSE_CHUNK = 32;
+
+const char *ditherName(int mode)
+{
+    switch (mode)
+    {
+    case DITHER_BAYER:
+        return "Bayer";
+    case DITHER_FLOYD_STEINBERG:
+        return "Floyd-Steinberg";
+    case DITHER_ATKINSON:
+        return "Atkinson";
+    default:
+        return "none";
+    }
+}
+
+void buildLevelLut(int threshHigh, int threshMid, int16_t lut[256])
+{
+    // knots of the piecewise linear map, the thresholds compare with >, so
+    // the switch to the next level sits between t and t + 1
+    float x[4];
+    float y[4];
+    int knots = 0;
+    x[knots] = 0;
+    y[knots++] = 0;
+    float high = threshHigh + 0.5f;
+    float mid = threshMid + 0.5f;
+    if (mid < high)
+    {
+        x[knots] = mid;
+        y[knots++] = 128;
+        x[knots] = high;
+        y[knots++] = 384;
+    }
+    else
+    {
+        // level 1 is never picked by the hard threshold either
+        x[knots] = high;
+        y[knots++] = 256;
+    }
+    x[knots] = 255;
+    y[knots++] = 512;
+    for (int i = 1; i < knots; i++)
+    {
+        if (x[i] < 0)
+            x[i] = 0;
+        if (x[i] > 255)
+            x[i] = 255;
+        if (x[i] < x[i - 1])
+            x[i] = x[i - 1];
+    }
+    int k = 0;
+    for (int v = 0; v < 256; v++)
+    {
+        while (k + 2 < knots && v > x[k + 1])
+            k++;
+        float span = x[k + 1] - x[k];
+        float t = span > 0 ? (v - x[k]) / span : 1;
+        if (t < 0)
+            t = 0;
+        if (t > 1)
+            t = 1;
+        lut[v] = (int16_t)(y[k] + (y[k + 1] - y[k]) * t + 0.5f);
+    }
+}
+
+// luma() of a pixel, counted into histogram unless that is nullptr
+static inline int countedLuma(const uint8_t *pixel, uint32_t *histogram)
+{
+    int y = luma(pixel);
+    if (histogram != nullptr)
+        histogram[y]++;
+    return y;
+}
+
+static void bayerRow(const uint8_t *bgra, uint size_x, uint y, const int16_t *lut, uint32_t *histogram,
+                     uint8_t *levels)
+{
+    const uint8_t *row = bayer8[y & 7];
+    for (uint x = 0; x < size_x; x++)
+    {
+        // offset the position by (b + 0.5) / 64 of a level and round down
+        int level = (lut[countedLuma(bgra + x * 4, histogram)] + row[x & 7] * 4 + 2) >> 8;
+        levels[x] = level > 2 ? 2 : level;
+    }
+}
+
+static inline int quantize(int value)
+{
+    int level = (value + 128) >> 8;
+    return level < 0 ? 0 : (level > 2 ? 2 : level);
+}
+
+// diffuse pixels [x0, x1) of row y, below1 and below2 are the error rows
+// of y + 1 and y + 2, carry holds the error going right within the row
+static void floydSteinbergSpan(const uint8_t *bgra, uint x0, uint x1, uint size_x, const int16_t *lut,
+                               const int16_t *error, int16_t *below1, int carry[2], uint32_t *histogram,
+                               uint8_t *levels)
+{
+    for (uint x = x0; x < x1; x++)
+    {
+        int value = lut[countedLuma(bgra + x * 4, histogram)] + error[x] + carry[0];
+        int level = quantize(value);
+        levels[x] = level;
+        int e = value - level * 256;
+        carry[0] = e * 7 / 16;
+        if (x > 0)
+            below1[x - 1] += e * 3 / 16;
+        below1[x] += e * 5 / 16;
+        if (x + 1 < size_x)
+            below1[x + 1] += e / 16;
+    }
+}
+
+static void atkinsonSpan(const uint8_t *bgra, uint x0, uint x1, uint size_x, const int16_t *lut,
+                         const int16_t *error, int16_t *below1, int16_t *below2, int carry[2],
+                         uint32_t *histogram, uint8_t *levels)
+{
+    for (uint x = x0; x < x1; x++)
+    {
+        int value = lut[countedLuma(bgra + x * 4, histogram)] + error[x] + carry[0];
+        int level = quantize(value);
+        levels[x] = level;
+        int e = (value - level * 256) / 8;
+        carry[0] = carry[1] + e;
+        carry[1] = e;
+        if (x > 0)
+            below1[x - 1] += e;
+        below1[x] += e;
+        if (x + 1 < size_x)
+            below1[x + 1] += e;
+        below2[x] += e;
+    }
+}
+
+// 4 levels per byte, first pixel in the top bits, same layout as convertRow
+static void packLevels(const uint8_t *levels, uint bytes, uint8_t *preview, uint8_t *packed)
+{
+    for (uint i = 0; i < bytes; i++)
+    {
+        const uint8_t *l = levels + i * 4;
+        packed[i] = (uint8_t)((l[0] << 6) | (l[1] << 4) | (l[2] << 2) | l[3]);
+        preview[i * 4 + 0] = l[0] * 127;
+        preview[i * 4 + 1] = l[1] * 127;
+        preview[i * 4 + 2] = l[2] * 127;
+        preview[i * 4 + 3] = l[3] * 127;
+    }
+}
+
+void ditherFrame(const uint8_t *image, int stride, const SampleRegion &region, int threshHigh,
+                 int threshMid, int mode, WorkerPool &pool, ConvertScratch &scratch,
+                 uint8_t *preview, uint8_t *packed, uint32_t *histogram)
+{
+    DitherScratch &d = scratch.dither;
+    uint size_x = region.size_x;
+    uint size_y = region.size_y;
+    if (d.lutHigh != threshHigh || d.lutMid != threshMid)
+    {
+        buildLevelLut(threshHigh, threshMid, d.lut);
+        d.lutHigh = threshHigh;
+        d.lutMid = threshMid;
+    }
+    const int16_t *lut = d.lut;
+    d.levels.resize(size_x * size_y);
+    uint8_t *levels = &d.levels[0];
+    int threads = pool.size();
+    if (scratch.bands.size() < (size_t)threads)
+    {
+        scratch.bands.resize(threads);
+    }
+    // every thread counts into its own histogram, they are added up at the end
+    if (histogram != nullptr)
+    {
+        clearBandHistograms(scratch, threads);
+    }
+
+    if (mode == DITHER_BAYER)
+    {
+        int tiles = rowTiles(size_y, threads);
+        pool.run(tiles, [&](int tile, int thread) {
+            uint y0 = size_y * tile / tiles;
+            uint y1 = size_y * (tile + 1) / tiles;
+            for (uint y = y0; y < y1; y++)
+            {
+                SampleScratch &sample = scratch.bands[thread];
+                const uint8_t *row = sampleRow(image, stride, region, y, sample);
+                bayerRow(row, size_x, y, lut, histogram != nullptr ? sample.histogram : nullptr,
+                         &levels[y * size_x]);
+            }
+        });
+    }
+    else
+    {
+        // two spare rows so the last ones can diffuse without bounds checks
+        d.errors.assign((size_y + 2) * size_x, 0);
+        if (d.progressRows < size_y)
+        {
+            d.progress.reset(new std::atomic<int>[size_y]);
+            d.progressRows = size_y;
+        }
+        for (uint y = 0; y < size_y; y++)
+        {
+            d.progress[y].store(0, std::memory_order_relaxed);
+        }
+        std::atomic<int> *progress = d.progress.get();
+        int16_t *errors = &d.errors[0];
+        bool atkinson = mode == DITHER_ATKINSON;
+        // rows are handed out in order, so the row a job waits on is
+        // always already being worked on by another thread
+        pool.runInOrder(size_y, [&](int job, int thread) {
+            uint y = job;
+            SampleScratch &sample = scratch.bands[thread];
+            const uint8_t *row = sampleRow(image, stride, region, y, sample);
+            int16_t *error = errors + y * size_x;
+            uint32_t *counts = histogram != nullptr ? sample.histogram : nullptr;
+            int carry[2] = {0, 0};
+            for (uint x0 = 0; x0 < size_x; x0 += DIFFUSE_CHUNK)
+            {
+                uint x1 = x0 + DIFFUSE_CHUNK < size_x ? x0 + DIFFUSE_CHUNK : size_x;
+                if (y > 0)
+                {
+                    // the row above diffuses into x - 1 .. x + 1, and writes
+                    // to our row below up to one pixel right of where it is
+                    int needed = x1 + 1 < size_x ? x1 + 1 : size_x;
+                    while (progress[y - 1].load(std::memory_order_acquire) < needed)
+                        std::this_thread::yield();
+                }
+                if (atkinson)
+                    atkinsonSpan(row, x0, x1, size_x, lut, error, error + size_x, error + size_x * 2, carry,
+                                 counts, &levels[y * size_x]);
+                else
+                    floydSteinbergSpan(row, x0, x1, size_x, lut, error, error + size_x, carry, counts,
+                                       &levels[y * size_x]);
+                progress[y].store(x1, std::memory_order_release);
+            }
+        });
+    }
+
+    // pack in byte tiles, a byte can straddle two rows so this runs on the
+    // finished frame
+    uint bytes = size_x * size_y / 4;
+    int packTiles = rowTiles(size_y, threads);
+    pool.run(packTiles, [&](int tile, int) {
+        uint b0 = bytes * tile / packTiles;
+        uint b1 = bytes * (tile + 1) / packTiles;
+        packLevels(levels + b0 * 4, b1 - b0, preview + b0 * 4, packed + b0);
+    });
+    for (uint i = bytes * 4; i < size_x * size_y; i++)
+    {
+        preview[i] = levels[i] * 127;
+    }
+    if (histogram != nullptr)
+    {
+        sumBandHistograms(scratch, threads, histogram);
+    }
+}
@@ -0,0 +1,180 @@
+#include "el_decode.h"
+#include <string.h>
+
+#define EL_MAX_VERSION 2
+
+static uint16_t get16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return (uint32_t)get16(p) | ((uint32_t)get16(p + 2) << 16);
+}
+
+uint16_t el_fletcher16(const uint8_t *data, size_t size)
+{
+    uint32_t a = 0;
+    uint32_t b = 0;
+    while (size > 0)
+    {
+        /* 5802 bytes is the most we can add up before b could overflow */
+        size_t block = size < 5802 ? size : 5802;
+        size -= block;
+        while (block--)
+        {
+            a += *data++;
+            b += a;
+        }
+        a %= 255;
+        b %= 255;
+    }
+    return (uint16_t)((b << 8) | a);
+}
+
+size_t el_unpackbits(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len)
+{
+    size_t i = 0;
+    size_t o = 0;
+    while (o < out_len)
+    {
+        uint8_t n;
+        if (i >= in_len)
+            return 0;
+        n = in[i++];
+        if (n < 128)
+        {
+            size_t count = (size_t)n + 1;
+            if (i + count > in_len || o + count > out_len)
+                return 0;
+            memcpy(out + o, in + i, count);
+            i += count;
+            o += count;
+        }
+        else if (n > 128)
+        {
+            size_t count = 257 - (size_t)n;
+            if (i >= in_len || o + count > out_len)
+                return 0;
+            memset(out + o, in[i++], count);
+            o += count;
+        }
+    }
+    return i;
+}
+
+size_t el_unrle2(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len)
+{
+    size_t i = 0;
+    size_t o = 0;
+    while (o < out_len)
+    {
+        uint8_t t;
+        size_t count;
+        if (i >= in_len)
+            return 0;
+        t = in[i++];
+        if (t < 0x80)
+        {
+            count = (size_t)t + 1;
+            if (i + count > in_len || o + count > out_len)
+                return 0;
+            memcpy(out + o, in + i, count);
+            i += count;
+        }
+        else if (t < 0xC0)
+        {
+            count = (size_t)(t & 0x3F) + 2;
+            if (i >= in_len || o + count > out_len)
+                return 0;
+            memset(out + o, in[i++], count);
+        }
+        else
+        {
+            if (i >= in_len)
+                return 0;
+            count = ((size_t)(t & 0x0F) << 8 | in[i++]) + 1;
+            if (o + count > out_len)
+                return 0;
+            memset(out + o, ((t >> 4) & 3) * 0x55, count);
+        }
+        o += count;
+    }
+    return i;
+}
+
+size_t el_decompress(int method, const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len)
+{
+    switch (method)
+    {
+    case EL_COMPRESS_NONE:
+        if (in_len < out_len)
+            return 0;
+        memcpy(out, in, out_len);
+        return out_len;
+    case EL_COMPRESS_PACKBITS:
+        return el_unpackbits(in, in_len, out, out_len);
+    case EL_COMPRESS_RLE2:
+        return el_unrle2(in, in_len, out, out_len);
+    default:
+        return 0;
+    }
+}
+
+int el_apply_packet(const uint8_t *packet, size_t len, uint8_t *fb, uint16_t size_x, uint16_t size_y)
+{
+    size_t fb_size = (size_t)size_x * size_y / 4;
+    size_t pos = EL_HEADER_SIZE;
+    uint8_t version;
+    int type;
+    int method;
+    uint16_t spans;
+    uint16_t s;
+
+    if (len < EL_HEADER_SIZE || packet[0] != 'E' || packet[1] != 'L')
+        return EL_ERR_HEADER;
+    version = packet[2];
+    if (version < 1 || version > EL_MAX_VERSION)
+        return EL_ERR_HEADER;
+    type = packet[3] & 0x0F;
+    method = version >= 2 ? (packet[3] >> 4) & 3 : EL_COMPRESS_NONE;
+    if (get16(packet + 6) != size_x || get16(packet + 8) != size_y)
+        return EL_ERR_GEOMETRY;
+    spans = get16(packet + 10);
+
+    if (type == EL_FRAME_KEY)
+    {
+        size_t used = el_decompress(method, packet + pos, len - pos, fb, fb_size);
+        if (used == 0 && fb_size != 0)
+            return EL_ERR_TRUNCATED;
+    }
+    else if (type == EL_FRAME_DELTA)
+    {
+        for (s = 0; s < spans; s++)
+        {
+            uint32_t offset;
+            uint16_t count;
+            size_t used;
+            if (pos + EL_SPAN_HEADER_SIZE > len)
+                return EL_ERR_TRUNCATED;
+            offset = get32(packet + pos);
+            count = get16(packet + pos + 4);
+            pos += EL_SPAN_HEADER_SIZE;
+            if ((size_t)offset + count > fb_size)
+                return EL_ERR_TRUNCATED;
+            used = el_decompress(method, packet + pos, len - pos, fb + offset, count);
+            if (used == 0 && count != 0)
+                return EL_ERR_TRUNCATED;
+            pos += used;
+        }
+    }
+    else
+    {
+        return EL_ERR_HEADER;
+    }
+
+    if (el_fletcher16(fb, fb_size) != get16(packet + 12))
+        return EL_ERR_CHECKSUM;
+    return EL_OK;
+}
@@ -0,0 +1,73 @@
+/*
+ * Reference decoder for the streamer's wire format, see protocol.h for the
+ * packet layout. Plain C99 with no allocation and no dependencies so that
+ * panel firmware can drop it in as is.
+ */
+#ifndef EL_DECODE_H
+#define EL_DECODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EL_HEADER_SIZE 14
+#define EL_SPAN_HEADER_SIZE 6
+
+/* frame types, low nibble of the type byte */
+#define EL_FRAME_KEY 0
+#define EL_FRAME_DELTA 1
+
+/* payload compression, bits 4-5 of the type byte (protocol version 2+) */
+#define EL_COMPRESS_NONE 0
+#define EL_COMPRESS_PACKBITS 1
+#define EL_COMPRESS_RLE2 2
+
+/* results of el_apply_packet */
+#define EL_OK 0
+#define EL_ERR_HEADER -1     /* not a packet, or a version we don't know */
+#define EL_ERR_GEOMETRY -2   /* the frame size does not match the framebuffer */
+#define EL_ERR_TRUNCATED -3  /* the packet ends early or a span is out of bounds */
+#define EL_ERR_CHECKSUM -4   /* the framebuffer does not match, ask for a keyframe */
+
+uint16_t el_fletcher16(const uint8_t *data, size_t size);
+
+/*
+ * PackBits: a header byte n followed by
+ *   n = 0..127     n + 1 literal bytes
+ *   n = 129..255   one byte repeated 257 - n times
+ *   n = 128        nothing
+ */
+size_t el_unpackbits(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len);
+
+/*
+ * RLE2, PackBits tuned for packed 2bpp frames where most bytes are one of the
+ * four single level bytes 0x00, 0x55, 0xAA and 0xFF:
+ *   0x00..0x7F     t + 1 literal bytes
+ *   0x80..0xBF     the next byte repeated (t & 0x3F) + 2 times
+ *   0xC0..0xFF     level l = (t >> 4) & 3, with the next byte n the run is
+ *                  ((t & 0x0F) << 8 | n) + 1 bytes of l * 0x55 (up to 4096)
+ */
+size_t el_unrle2(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len);
+
+/*
+ * Decode exactly out_len bytes with the given EL_COMPRESS_ method, returns
+ * the number of input bytes consumed or 0 if the input is broken.
+ */
+size_t el_decompress(int method, const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len);
+
+/*
+ * Apply one packet (keyframe or delta) to a size_x by size_y framebuffer of
+ * size_x * size_y / 4 bytes, returns EL_OK or one of the EL_ERR_ codes. The
+ * framebuffer may be partly updated when an error is returned, in which case
+ * the panel should ask for a keyframe.
+ */
+int el_apply_packet(const uint8_t *packet, size_t len, uint8_t *fb, uint16_t size_x, uint16_t size_y);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EL_DECODE_H */
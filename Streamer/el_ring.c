@@ -0,0 +1,299 @@
+#define _GNU_SOURCE
+#include "el_ring.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#define SLOT_BITS 4
+#define SLOT_MASK ((1u << SLOT_BITS) - 1)
+
+static int64_t now_us(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (int64_t)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+static size_t round_up(size_t value, size_t step)
+{
+    return (value + step - 1) / step * step;
+}
+
+static void wait_on(uint32_t *word, uint32_t value, int timeout_ms)
+{
+#ifdef __linux__
+    /* not FUTEX_PRIVATE, the word is shared between processes */
+    struct timespec t;
+    t.tv_sec = timeout_ms / 1000;
+    t.tv_nsec = (long)(timeout_ms % 1000) * 1000000;
+    syscall(SYS_futex, word, FUTEX_WAIT, value, timeout_ms < 0 ? NULL : &t, NULL, 0);
+#else
+    struct timespec t = {0, 1000000};
+    (void)word;
+    (void)value;
+    (void)timeout_ms;
+    nanosleep(&t, NULL);
+#endif
+}
+
+static void wake_all(uint32_t *word)
+{
+#ifdef __linux__
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#else
+    (void)word;
+#endif
+}
+
+static void bump_wake(el_ring_header *h)
+{
+    __atomic_add_fetch(&h->wake, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&h->waiters, __ATOMIC_SEQ_CST) != 0)
+        wake_all(&h->wake);
+}
+
+static int map_ring(el_ring *ring, int fd, size_t size)
+{
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        return EL_RING_ERR_SYSTEM;
+    ring->header = (el_ring_header *)map;
+    ring->size = size;
+    ring->writing = -1;
+    ring->last = -1;
+    return EL_RING_OK;
+}
+
+int el_ring_create(el_ring *ring, const char *name, uint32_t width, uint32_t height, uint32_t slots)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    uint32_t stride = (uint32_t)round_up((size_t)width * 4, 64);
+    size_t slot_bytes = round_up((size_t)stride * height, page);
+    size_t data_offset = round_up(sizeof(el_ring_header), page);
+    size_t size = data_offset + slot_bytes * slots;
+    int fd;
+    int result;
+    el_ring_header *h;
+    memset(ring, 0, sizeof(*ring));
+    if (width == 0 || height == 0 || slots < 2 || slots > EL_RING_MAX_SLOTS)
+        return EL_RING_ERR_ARGS;
+    /* a consumer still mapping an old ring keeps it, we start a new one */
+    shm_unlink(name);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        return EL_RING_ERR_SYSTEM;
+    if (ftruncate(fd, (off_t)size) != 0)
+    {
+        close(fd);
+        shm_unlink(name);
+        return EL_RING_ERR_SYSTEM;
+    }
+    result = map_ring(ring, fd, size);
+    close(fd);
+    if (result != EL_RING_OK)
+    {
+        shm_unlink(name);
+        return result;
+    }
+    /* the new memory is zeroed, so latest, the slots and closed start out 0 */
+    h = ring->header;
+    h->version = EL_RING_VERSION;
+    h->width = width;
+    h->height = height;
+    h->stride = stride;
+    h->slots = slots;
+    h->slot_bytes = slot_bytes;
+    h->data_offset = data_offset;
+    h->producer_pid = (int32_t)getpid();
+    ring->data = (uint8_t *)ring->header + data_offset;
+    /* consumers check the magic last */
+    __atomic_store_n(&h->magic, EL_RING_MAGIC, __ATOMIC_RELEASE);
+    return EL_RING_OK;
+}
+
+int el_ring_open(el_ring *ring, const char *name)
+{
+    struct stat info;
+    el_ring_header *h;
+    int fd;
+    int result;
+    memset(ring, 0, sizeof(*ring));
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+        return EL_RING_ERR_SYSTEM;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(el_ring_header))
+    {
+        close(fd);
+        return EL_RING_ERR_FORMAT;
+    }
+    result = map_ring(ring, fd, (size_t)info.st_size);
+    close(fd);
+    if (result != EL_RING_OK)
+        return result;
+    h = ring->header;
+    if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != EL_RING_MAGIC || h->version != EL_RING_VERSION ||
+        h->slots < 2 || h->slots > EL_RING_MAX_SLOTS || h->stride < h->width * 4 ||
+        h->slot_bytes < (uint64_t)h->stride * h->height ||
+        h->data_offset + h->slot_bytes * h->slots > ring->size)
+    {
+        el_ring_close(ring);
+        return EL_RING_ERR_FORMAT;
+    }
+    ring->data = (uint8_t *)h + h->data_offset;
+    return EL_RING_OK;
+}
+
+void el_ring_close(el_ring *ring)
+{
+    if (ring->header != NULL)
+        munmap(ring->header, ring->size);
+    ring->header = NULL;
+    ring->data = NULL;
+    ring->size = 0;
+}
+
+void el_ring_destroy(el_ring *ring, const char *name)
+{
+    if (ring->header == NULL)
+        return;
+    __atomic_store_n(&ring->header->closed, 1, __ATOMIC_SEQ_CST);
+    bump_wake(ring->header);
+    shm_unlink(name);
+    el_ring_close(ring);
+}
+
+uint8_t *el_ring_begin(el_ring *ring)
+{
+    el_ring_header *h = ring->header;
+    /* only we publish, so the newest frame stays where it is */
+    uint64_t latest = __atomic_load_n(&h->latest, __ATOMIC_ACQUIRE);
+    uint32_t k;
+    if (ring->writing >= 0)
+        return ring->data + (size_t)ring->writing * h->slot_bytes;
+    for (k = 1; k <= h->slots; k++)
+    {
+        uint32_t i = (uint32_t)(ring->last + (int)k) % h->slots;
+        el_ring_slot *slot = &h->slot[i];
+        uint64_t seq;
+        if (latest != 0 && i == (latest & SLOT_MASK))
+            continue;
+        /* take the slot away first, then look for readers: a consumer
+           either sees the slot gone or we see it reading, never neither */
+        seq = __atomic_exchange_n(&slot->seq, 0, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&slot->readers, __ATOMIC_SEQ_CST) != 0)
+        {
+            __atomic_store_n(&slot->seq, seq, __ATOMIC_SEQ_CST);
+            continue;
+        }
+        ring->writing = (int)i;
+        return ring->data + (size_t)i * h->slot_bytes;
+    }
+    return NULL;
+}
+
+void el_ring_publish(el_ring *ring, int64_t time_us)
+{
+    el_ring_header *h = ring->header;
+    el_ring_slot *slot;
+    uint64_t seq;
+    if (ring->writing < 0)
+        return;
+    slot = &h->slot[ring->writing];
+    seq = (__atomic_load_n(&h->latest, __ATOMIC_ACQUIRE) >> SLOT_BITS) + 1;
+    slot->time_us = time_us != 0 ? time_us : now_us();
+    __atomic_store_n(&slot->seq, seq, __ATOMIC_RELEASE);
+    __atomic_store_n(&h->latest, seq << SLOT_BITS | (uint64_t)ring->writing, __ATOMIC_SEQ_CST);
+    ring->last = ring->writing;
+    ring->writing = -1;
+    bump_wake(h);
+}
+
+uint64_t el_ring_latest(const el_ring *ring)
+{
+    return __atomic_load_n(&ring->header->latest, __ATOMIC_ACQUIRE) >> SLOT_BITS;
+}
+
+int el_ring_alive(const el_ring *ring)
+{
+    const el_ring_header *h = ring->header;
+    if (__atomic_load_n(&h->closed, __ATOMIC_ACQUIRE))
+        return 0;
+    /* a producer that crashed never got to set closed */
+    return !(kill((pid_t)h->producer_pid, 0) != 0 && errno == ESRCH);
+}
+
+int el_ring_wait(el_ring *ring, uint64_t after, int timeout_ms)
+{
+    el_ring_header *h = ring->header;
+    int64_t deadline = timeout_ms > 0 ? now_us() + (int64_t)timeout_ms * 1000 : 0;
+    for (;;)
+    {
+        uint32_t wake = __atomic_load_n(&h->wake, __ATOMIC_SEQ_CST);
+        int64_t left;
+        if (el_ring_latest(ring) > after)
+            return EL_RING_OK;
+        if (__atomic_load_n(&h->closed, __ATOMIC_ACQUIRE))
+            return EL_RING_CLOSED;
+        if (timeout_ms == 0)
+            return EL_RING_NONE;
+        left = timeout_ms < 0 ? -1 : (deadline - now_us() + 999) / 1000;
+        if (timeout_ms > 0 && left <= 0)
+            return EL_RING_NONE;
+        __atomic_add_fetch(&h->waiters, 1, __ATOMIC_SEQ_CST);
+        /* a publish after we read wake changed it, so this returns at once */
+        wait_on(&h->wake, wake, (int)left);
+        __atomic_sub_fetch(&h->waiters, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+int el_ring_acquire(el_ring *ring, uint64_t after, int timeout_ms, el_ring_frame *frame)
+{
+    el_ring_header *h = ring->header;
+    for (;;)
+    {
+        int result = el_ring_wait(ring, after, timeout_ms);
+        uint64_t latest;
+        uint64_t seq;
+        uint32_t i;
+        el_ring_slot *slot;
+        if (result != EL_RING_OK)
+            return result;
+        latest = __atomic_load_n(&h->latest, __ATOMIC_SEQ_CST);
+        seq = latest >> SLOT_BITS;
+        i = (uint32_t)(latest & SLOT_MASK);
+        if (i >= h->slots)
+            return EL_RING_ERR_FORMAT;
+        slot = &h->slot[i];
+        __atomic_add_fetch(&slot->readers, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) != seq)
+        {
+            /* the producer moved on and took the slot, try the newer frame */
+            __atomic_sub_fetch(&slot->readers, 1, __ATOMIC_SEQ_CST);
+            continue;
+        }
+        frame->pixels = ring->data + (size_t)i * h->slot_bytes;
+        frame->width = h->width;
+        frame->height = h->height;
+        frame->stride = h->stride;
+        frame->slot = (int)i;
+        frame->seq = seq;
+        frame->time_us = slot->time_us;
+        return EL_RING_OK;
+    }
+}
+
+void el_ring_release(el_ring *ring, int slot)
+{
+    if (slot >= 0 && (uint32_t)slot < ring->header->slots)
+        __atomic_sub_fetch(&ring->header->slot[slot].readers, 1, __ATOMIC_SEQ_CST);
+}
@@ -0,0 +1,152 @@
+/*
+ * Shared memory frame ring, for programs that render offscreen and want the
+ * streamer to show their frames without going through the X desktop. Plain
+ * C99 (with the GCC/Clang __atomic builtins) on POSIX shared memory, link
+ * el_ring.c into the producer, and -lrt on older glibc.
+ *
+ * The producer creates the ring with its frame size, then for every frame
+ * writes BGRA pixels (4 bytes per pixel, the fourth unused) into the slot
+ * el_ring_begin() hands out and el_ring_publish()es it:
+ *
+ *     el_ring ring;
+ *     if (el_ring_create(&ring, "/el_streamer", 1280, 720, 6) != EL_RING_OK)
+ *         return 1;
+ *     for (;;) {
+ *         uint8_t *pixels = el_ring_begin(&ring);
+ *         if (pixels != NULL) {
+ *             draw(pixels, ring.header->stride);
+ *             el_ring_publish(&ring, 0);
+ *         }
+ *     }
+ *     el_ring_destroy(&ring, "/el_streamer");
+ *
+ * and the streamer is started with --source shm --shm-name /el_streamer.
+ *
+ * Consumers always get the newest frame, a frame published before the last
+ * one was picked up is simply never seen. A consumer holds the slot of a
+ * frame it acquired until it releases it, the producer writes around held
+ * slots and the newest one, so slots must be at least 2 more than the
+ * frames all consumers hold at once, the streamer holds up to 3 and reads
+ * them in place with 5 slots or more (with fewer it copies every frame).
+ * Waiting consumers sleep on a futex in the ring (Linux, elsewhere they
+ * poll every millisecond), a publish with nobody waiting costs no syscall.
+ */
+#ifndef EL_RING_H
+#define EL_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EL_RING_MAGIC 0x474E5245u /* "ERNG" */
+#define EL_RING_VERSION 1
+#define EL_RING_MAX_SLOTS 16
+
+/* results */
+#define EL_RING_OK 0
+#define EL_RING_ERR_SYSTEM -1  /* shm_open, ftruncate or mmap failed, see errno */
+#define EL_RING_ERR_FORMAT -2  /* not a ring, or a version we don't know */
+#define EL_RING_ERR_ARGS -3    /* bad size or slot count */
+#define EL_RING_NONE -4        /* no frame newer than asked for */
+#define EL_RING_CLOSED -5      /* the producer closed the ring or is gone */
+
+typedef struct el_ring_slot {
+    uint64_t seq;              /* frame number, 0 while the producer writes the slot */
+    int64_t time_us;           /* CLOCK_MONOTONIC when the frame was published */
+    uint32_t readers;          /* consumers holding the slot */
+    uint32_t reserved;
+} el_ring_slot;
+
+/*
+ * At the start of the shared memory, the slots follow at data_offset, slot
+ * i at data_offset + i * slot_bytes, rows stride bytes apart. Everything but
+ * the fields below the size is written through the __atomic builtins.
+ */
+typedef struct el_ring_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;           /* bytes per row, a multiple of 64 */
+    uint32_t slots;
+    uint64_t slot_bytes;       /* a multiple of the page size */
+    uint64_t data_offset;      /* page aligned */
+    uint64_t latest;           /* seq << 4 | slot of the newest frame, 0 before the first */
+    uint32_t wake;             /* futex word, bumped by every publish and by close */
+    uint32_t waiters;          /* consumers sleeping on wake */
+    uint32_t closed;
+    int32_t producer_pid;
+    el_ring_slot slot[EL_RING_MAX_SLOTS];
+} el_ring_header;
+
+/* one process's view of a ring */
+typedef struct el_ring {
+    el_ring_header *header;
+    uint8_t *data;             /* the first slot */
+    size_t size;               /* of the whole mapping */
+    int writing;               /* producer: the slot el_ring_begin() handed out, -1 for none */
+    int last;                  /* producer: the slot written last */
+} el_ring;
+
+/* a frame a consumer holds */
+typedef struct el_ring_frame {
+    const uint8_t *pixels;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    int slot;                  /* pass to el_ring_release */
+    uint64_t seq;
+    int64_t time_us;
+} el_ring_frame;
+
+/*
+ * Producer: create the ring name ("/something"), replacing any ring left
+ * behind under that name, slots between 2 and EL_RING_MAX_SLOTS.
+ */
+int el_ring_create(el_ring *ring, const char *name, uint32_t width, uint32_t height, uint32_t slots);
+
+/* Producer: the slot to write the next frame into, NULL if consumers hold every slot. */
+uint8_t *el_ring_begin(el_ring *ring);
+
+/* Producer: make the slot from el_ring_begin() the newest frame, time_us 0 is now. */
+void el_ring_publish(el_ring *ring, int64_t time_us);
+
+/* Producer: tell the consumers, unlink name and unmap. */
+void el_ring_destroy(el_ring *ring, const char *name);
+
+/* Consumer: map an existing ring. */
+int el_ring_open(el_ring *ring, const char *name);
+
+/* Unmap, frames still held become invalid. */
+void el_ring_close(el_ring *ring);
+
+/* seq of the newest frame, 0 if none yet */
+uint64_t el_ring_latest(const el_ring *ring);
+
+/* 0 once the producer closed the ring or its process is gone */
+int el_ring_alive(const el_ring *ring);
+
+/*
+ * Consumer: wait up to timeout_ms (0 for not at all, -1 for ever) for a frame
+ * newer than seq after, returns EL_RING_OK, EL_RING_NONE on timeout or
+ * EL_RING_CLOSED.
+ */
+int el_ring_wait(el_ring *ring, uint64_t after, int timeout_ms);
+
+/*
+ * Consumer: hold the newest frame if it is newer than after, waiting as in
+ * el_ring_wait(), returns EL_RING_OK with frame filled in, EL_RING_NONE or
+ * EL_RING_CLOSED. Every frame acquired has to be released.
+ */
+int el_ring_acquire(el_ring *ring, uint64_t after, int timeout_ms, el_ring_frame *frame);
+
+void el_ring_release(el_ring *ring, int slot);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EL_RING_H */
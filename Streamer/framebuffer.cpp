@@ -0,0 +1,132 @@
+#include "framebuffer.h"
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+static std::atomic<uint64_t> allocated(0);
+
+static uint8_t *allocateAligned(size_t bytes)
+{
+    bytes = (bytes + FramePool::ALIGN - 1) / FramePool::ALIGN * FramePool::ALIGN;
+#ifdef _WIN32
+    void *memory = _aligned_malloc(bytes, FramePool::ALIGN);
+#else
+    void *memory = nullptr;
+    if (posix_memalign(&memory, FramePool::ALIGN, bytes) != 0)
+        memory = nullptr;
+#endif
+    if (memory != nullptr)
+        allocated++;
+    return (uint8_t *)memory;
+}
+
+static void freeAligned(uint8_t *memory)
+{
+#ifdef _WIN32
+    _aligned_free(memory);
+#else
+    free(memory);
+#endif
+}
+
+// what the pool and its buffers share, so buffers in use can outlive the pool
+struct FramePool::Shared
+{
+    std::mutex mutex;
+    std::vector<Pooled *> idle;
+    bool open;
+
+    Shared() : open(true) {}
+};
+
+class FramePool::Pooled : public FrameBuffer
+{
+public:
+    explicit Pooled(const std::shared_ptr<Shared> &home) : home(home) {}
+    ~Pooled() { freeAligned(data); }
+
+    bool resize(size_t bytes)
+    {
+        uint8_t *memory = allocateAligned(bytes);
+        if (memory == nullptr)
+            return false;
+        freeAligned(data);
+        data = memory;
+        capacity = bytes;
+        return true;
+    }
+
+protected:
+    void recycle() override
+    {
+        // deleting this drops home, which may be the last of it
+        std::shared_ptr<Shared> keep = home;
+        {
+            std::lock_guard<std::mutex> lock(keep->mutex);
+            if (keep->open)
+            {
+                keep->idle.push_back(this);
+                return;
+            }
+        }
+        delete this;
+    }
+
+private:
+    std::shared_ptr<Shared> home;
+};
+
+FramePool::FramePool() : shared(std::make_shared<Shared>()) {}
+
+FramePool::~FramePool()
+{
+    std::vector<Pooled *> idle;
+    {
+        std::lock_guard<std::mutex> lock(shared->mutex);
+        shared->open = false;
+        idle.swap(shared->idle);
+    }
+    for (size_t i = 0; i < idle.size(); i++)
+        delete idle[i];
+}
+
+FrameRef FramePool::acquire(size_t bytes)
+{
+    Pooled *buffer = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(shared->mutex);
+        std::vector<Pooled *> &idle = shared->idle;
+        // the most recently used buffer that fits, it is the most likely
+        // to still be in cache, or else one to grow
+        for (size_t i = idle.size(); i-- > 0;)
+        {
+            if (idle[i]->capacity >= bytes)
+            {
+                buffer = idle[i];
+                idle.erase(idle.begin() + i);
+                break;
+            }
+        }
+        if (buffer == nullptr && !idle.empty())
+        {
+            buffer = idle.back();
+            idle.pop_back();
+        }
+    }
+    if (buffer == nullptr)
+        buffer = new Pooled(shared);
+    if (buffer->capacity < bytes && !buffer->resize(bytes))
+    {
+        delete buffer;
+        return FrameRef();
+    }
+    return FrameRef(buffer);
+}
+
+uint64_t FramePool::allocations()
+{
+    return allocated.load();
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+// frame memory the pipeline stages hand each other by reference instead of
+// copying it, every FrameRef counts as one user and the buffer is recycled
+// (given back to whoever owns the memory) when the last one is dropped, on
+// whichever thread that happens
+class FrameBuffer
+{
+public:
+    uint8_t *data;
+    size_t capacity;            // bytes
+
+    int users() const { return refs.load(std::memory_order_acquire); }
+
+protected:
+    FrameBuffer() : data(nullptr), capacity(0), refs(0) {}
+    virtual ~FrameBuffer() {}
+
+    // the last FrameRef went away
+    virtual void recycle() = 0;
+
+private:
+    friend class FrameRef;
+    std::atomic<int> refs;
+};
+
+class FrameRef
+{
+public:
+    FrameRef() : buffer(nullptr) {}
+    explicit FrameRef(FrameBuffer *buffer) : buffer(buffer) { take(); }
+    FrameRef(const FrameRef &other) : buffer(other.buffer) { take(); }
+    FrameRef(FrameRef &&other) : buffer(other.buffer) { other.buffer = nullptr; }
+    ~FrameRef() { reset(); }
+
+    FrameRef &operator=(FrameRef other)
+    {
+        std::swap(buffer, other.buffer);
+        return *this;
+    }
+
+    void reset()
+    {
+        FrameBuffer *old = buffer;
+        buffer = nullptr;
+        if (old != nullptr && old->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            old->recycle();
+    }
+
+    uint8_t *data() const { return buffer != nullptr ? buffer->data : nullptr; }
+    size_t capacity() const { return buffer != nullptr ? buffer->capacity : 0; }
+    // nobody else can see the buffer, it can be written
+    bool unique() const { return buffer != nullptr && buffer->users() == 1; }
+    FrameBuffer *get() const { return buffer; }
+    explicit operator bool() const { return buffer != nullptr; }
+
+private:
+    void take()
+    {
+        if (buffer != nullptr)
+            buffer->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    FrameBuffer *buffer;
+};
+
+// page aligned frame buffers, recycled instead of freed: once the pool has
+// as many as are ever in use at the same time nothing more is allocated
+// buffers still in use when the pool goes are freed by their last user
+class FramePool
+{
+public:
+    // pages, so a buffer suits mmap and any SIMD width
+    static const size_t ALIGN = 4096;
+
+    FramePool();
+    ~FramePool();
+    FramePool(const FramePool &) = delete;
+    FramePool &operator=(const FramePool &) = delete;
+
+    // a buffer of at least bytes, holding whatever its last user left in it
+    // an empty ref if the memory can't be had
+    FrameRef acquire(size_t bytes);
+
+    // buffers allocated (or grown) by every pool so far
+    static uint64_t allocations();
+
+private:
+    struct Shared;
+    class Pooled;
+
+    std::shared_ptr<Shared> shared;
+};
+
+// rows of bytes rounded up to whole cache lines, the stride of pooled frames
+inline size_t alignedStride(size_t bytes)
+{
+    return (bytes + 63) & ~(size_t)63;
+}
@@ -0,0 +1,423 @@
+// TODO fix the pixel size and offset slider crashing the app
+#include <GL/glew.h>
+#include "imgui.h"
+#include "imgui_impl_glfw.h"
+#include "imgui_impl_opengl3.h"
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include "ports.h"
+#include "streamer.h"
+#include "stats.h"
+#include "threshold.h"
+
+#define GL_SILENCE_DEPRECATION
+#if defined(IMGUI_IMPL_OPENGL_ES2)
+#include <GLES2/gl2.h>
+#endif
+#include <GLFW/glfw3.h> // Will drag system OpenGL headers
+
+static void glfw_error_callback(int error, const char *description)
+{
+    fprintf(stderr, "GLFW Error %d: %s\n", error, description);
+}
+
+uint window_width = 800;
+uint window_height = 600;
+
+// the preview as a single channel texture that lives as long as the window,
+// frames go in through a pixel buffer object so the upload doesn't wait for
+// the GPU, and ImGui's shader applies the tint when it draws the image
+struct PreviewTexture
+{
+    GLuint texture;
+    GLuint pbo;
+    int width;
+    int height;
+
+    PreviewTexture() : texture(0), pbo(0), width(0), height(0) {}
+
+    void upload(const PreviewFrame &frame)
+    {
+        if (frame.pixels.empty())
+            return;
+        if (texture == 0)
+        {
+            glGenTextures(1, &texture);
+#if !defined(IMGUI_IMPL_OPENGL_ES2)
+            glGenBuffers(1, &pbo);
+#endif
+        }
+        glBindTexture(GL_TEXTURE_2D, texture);
+        // rows are a multiple of 4 pixels, but don't rely on it
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        bool resized = (int)frame.size_x != width || (int)frame.size_y != height;
+        width = frame.size_x;
+        height = frame.size_y;
+#if defined(IMGUI_IMPL_OPENGL_ES2)
+        // no PBOs or swizzles, luminance already reads as gray
+        if (resized)
+        {
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, width, height, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, nullptr);
+        }
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_LUMINANCE, GL_UNSIGNED_BYTE, &frame.pixels[0]);
+#else
+        if (resized)
+        {
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            // one byte a pixel, sampled as gray so the tint can scale it
+            GLint gray[4] = {GL_RED, GL_RED, GL_RED, GL_ONE};
+            glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, gray);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width, height, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+        }
+        size_t bytes = (size_t)width * height;
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+        // orphan the last frame's storage, the GPU may still be reading it
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+        void *mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+                                        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (mapped != nullptr)
+        {
+            memcpy(mapped, &frame.pixels[0], bytes);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            // reads from the bound PBO, offset 0
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+#endif
+    }
+
+    void destroy()
+    {
+        if (texture != 0)
+            glDeleteTextures(1, &texture);
+#if !defined(IMGUI_IMPL_OPENGL_ES2)
+        if (pbo != 0)
+            glDeleteBuffers(1, &pbo);
+#endif
+        texture = pbo = 0;
+        width = height = 0;
+    }
+};
+
+void guiThread(){
+    PreviewTexture previewTexture;
+    // lists the serial ports for the setup dialog and keeps the list current
+    PortScanner portScanner;
+    portScanner.start();
+    static bool first_start = true;
+    // a FIFO with the last 250 frametimes
+    std::deque<double> frametimes;
+    glfwSetErrorCallback(glfw_error_callback);
+    if (!glfwInit())
+        return;
+
+    // Decide GL+GLSL versions
+#if defined(IMGUI_IMPL_OPENGL_ES2)
+    // GL ES 2.0 + GLSL 100
+    const char *glsl_version = "#version 100";
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 2);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 0);
+    glfwWindowHint(GLFW_CLIENT_API, GLFW_OPENGL_ES_API);
+#elif defined(__APPLE__)
+    // GL 3.2 + GLSL 150
+    const char *glsl_version = "#version 150";
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE); // 3.2+ only
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);           // Required on Mac
+#else
+    // GL 3.0 + GLSL 130
+    const char *glsl_version = "#version 130";
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE); // 3.2+ only
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);           // 3.0+ only
+#endif
+
+    // Create window with graphics context
+    GLFWwindow *window = glfwCreateWindow(window_width, window_height, "EL Streamer", NULL, NULL);
+    if (window == NULL)
+        return;
+    glfwMakeContextCurrent(window);
+    glfwSwapInterval(1); // Enable vsync
+    // set the smallest allowed window size
+    glfwSetWindowSizeLimits(window, 400, 300, GLFW_DONT_CARE, GLFW_DONT_CARE);
+
+    // Setup Dear ImGui context
+    IMGUI_CHECKVERSION();
+    ImGui::CreateContext();
+    ImGuiIO &io = ImGui::GetIO();
+    (void)io;
+    io.ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard; // Enable Keyboard Controls
+    io.ConfigFlags |= ImGuiConfigFlags_NavEnableGamepad;  // Enable Gamepad Controls
+
+    // Setup Dear ImGui style
+    ImGui::StyleColorsDark();
+
+    // Setup Platform/Renderer backends
+    ImGui_ImplGlfw_InitForOpenGL(window, true);
+    ImGui_ImplOpenGL3_Init(glsl_version);
+    glewInit();
+    // Our state
+    ImVec4 clear_color = ImVec4(1.0f, 1.0f, 0.0f, 1.00f);
+
+    // Main loop
+#ifdef __EMSCRIPTEN__
+    // For an Emscripten build we are disabling file-system access, so let's not attempt to do a fopen() of the imgui.ini file.
+    // You may manually call LoadIniSettingsFromMemory() to load settings from your own storage.
+    io.IniFilename = NULL;
+    EMSCRIPTEN_MAINLOOP_BEGIN
+#else
+    while (!glfwWindowShouldClose(window))
+#endif
+    {
+        // Poll and handle events (inputs, window resize, etc.)
+        glfwPollEvents();
+
+        // Start the Dear ImGui frame
+        ImGui_ImplOpenGL3_NewFrame();
+        ImGui_ImplGlfw_NewFrame();
+        ImGui::NewFrame();
+
+        // get glfw window size
+        int width, height;
+        glfwGetWindowSize(window, &width, &height);
+        window_width = width;
+        window_height = height;
+        if (!first_start)
+        {
+            // set our flags
+            ImGuiWindowFlags window_flags = 0;
+            window_flags |= ImGuiWindowFlags_NoTitleBar;
+            window_flags |= ImGuiWindowFlags_NoResize;
+            window_flags |= ImGuiWindowFlags_NoMove;
+            window_flags |= ImGuiWindowFlags_NoScrollbar;
+
+            ImGui::Begin("EL STREAMER", NULL, window_flags);
+            ImGui::SetWindowSize(ImVec2(window_width, window_height));
+            ImGui::SetWindowPos(ImVec2(0, 0));
+            ImGui::ColorEdit3("Color", (float *)&clear_color);
+            // the sliders below and the preview are for one panel at a time
+            static int currentPanel = 0;
+            if (panels.size() > 1)
+            {
+                std::vector<std::string> names(panels.size());
+                std::vector<const char *> items(panels.size());
+                for (size_t i = 0; i < panels.size(); i++)
+                {
+                    names[i] = std::to_string(i + 1) + ": " + panels[i]->current().port;
+                    items[i] = names[i].c_str();
+                }
+                ImGui::Combo("Panel", &currentPanel, &items[0], (int)items.size());
+            }
+            Panel &panel = *panels[currentPanel];
+            // edited here and handed back whole, the pipeline threads never
+            // see half a change
+            PanelSettings settings = panel.current();
+            ImGui::SliderInt("High Threshold", &settings.threshHigh, 0, 255);
+            ImGui::SliderInt("Mid Threshold", &settings.threshMid, 0, 255);
+            // the sliders are where auto thresholding starts from, what it
+            // picked is only shown
+            const char *autoModes[] = {"Off", "Otsu", "Percentile"};
+            ImGui::Combo("Auto threshold", &settings.autoThreshold, autoModes, IM_ARRAYSIZE(autoModes));
+            if (settings.autoThreshold != AUTO_THRESHOLD_OFF && panel.autoHigh.load() != Panel::AUTO_UNSET)
+            {
+                ImGui::SameLine();
+                ImGui::Text("high %d, mid %d", panel.autoHigh.load(), panel.autoMid.load());
+            }
+            ImGui::Checkbox("Delta frames", &deltaFrames);
+            ImGui::SameLine();
+            const char *compressionModes[] = {"None", "PackBits", "RLE2"};
+            ImGui::PushItemWidth(150);
+            ImGui::Combo("Compression", &compression, compressionModes, IM_ARRAYSIZE(compressionModes));
+            ImGui::PopItemWidth();
+            
+            if(!settings.entireDisp){
+                // calculate the maximum offset for the sliders, taking the step size into account
+                int max_x_offset = (monitor_width - settings.x_disp_size * settings.x_step);
+                int max_y_offset = (monitor_height - settings.y_disp_size * settings.y_step);
+                ImGui::SliderInt("Offset X", &settings.x_offset, 0, max_x_offset);
+                ImGui::SliderInt("Offset Y", &settings.y_offset, 0, max_y_offset);
+                ImGui::SliderInt("Step X", &settings.x_step, 1, monitor_width / settings.x_disp_size);
+                ImGui::SliderInt("Step Y", &settings.y_step, 1, monitor_height / settings.y_disp_size);
+                if(settings.x_offset > max_x_offset){
+                    settings.x_offset = max_x_offset;
+                }
+                if(settings.y_offset > max_y_offset){
+                    settings.y_offset = max_y_offset;
+                }
+            }
+            // point sampling is cheapest, area averaging keeps text readable when downscaling
+            const char *sampleModes[] = {"Point", "Area average"};
+            ImGui::Combo("Sampling", &settings.sampleMode, sampleModes, IM_ARRAYSIZE(sampleModes));
+            // dithering keeps gradients and photos from turning into flat blobs
+            const char *ditherModes[] = {"None", "Bayer", "Floyd-Steinberg", "Atkinson"};
+            ImGui::Combo("Dithering", &settings.ditherMode, ditherModes, IM_ARRAYSIZE(ditherModes));
+            panel.publish(settings);
+
+            float frameTime = 1000.0f / io.Framerate;
+            ImGui::SliderFloat("Target FPS", &frameRate, 1.0f, 120.0f);
+            // on demand the panels pace the capture and fps only bounds how old a frame may be
+            const char *scheduleModes[] = {"Timed", "On demand"};
+            ImGui::Combo("Scheduling", &scheduleMode, scheduleModes, IM_ARRAYSIZE(scheduleModes));
+            // add frame time to the vector and if it's too big, remove the first element
+            frametimes.push_back(frameTime);
+            if (frametimes.size() > 250)
+            {
+                frametimes.erase(frametimes.begin());
+            }
+            float arrFrameTimes[250] = {0};
+            for (long unsigned int i = 0; i < frametimes.size(); i++)
+            {
+                arrFrameTimes[i] = frametimes[i];
+            }
+            float maxFrameTime = frameTime + 1;
+            for (long unsigned int i = 0; i < frametimes.size(); i++)
+            {
+                if (frametimes[i] > maxFrameTime)
+                {
+                    maxFrameTime = frametimes[i];
+                }
+            }
+            double scTime = 0;
+            scTime = deltaScTime;
+            double serialTime = 0;
+            serialTime = deltaSerialTime;
+            // show the frame time and FPS
+            ImGui::Text("Application average %.3f ms/frame (%.1f FPS); Screenshot thread: %.3f ms/frame; Serial thread: %.3f ms", frameTime, io.Framerate, scTime, serialTime);
+            ImGui::Text("Capture to wire p50 %.1f ms, p99 %.1f ms; dropped: capture %llu, compute %llu, not requested %llu",
+                        pipelineStats.endToEnd.percentile(50) / 1000.0, pipelineStats.endToEnd.percentile(99) / 1000.0,
+                        (unsigned long long)pipelineStats.captureDropped.load(),
+                        (unsigned long long)pipelineStats.computeDropped.load(),
+                        (unsigned long long)pipelineStats.unrequested.load());
+            ImGui::PlotLines("##Frame Time Graph", arrFrameTimes, IM_ARRAYSIZE(arrFrameTimes), 0, NULL, 0, maxFrameTime, ImVec2(window_width, 80));
+
+            if (panel.previews.update())
+            {
+                // the front slot is ours until the next update
+                previewTexture.upload(panel.previews.front());
+            }
+            // display the image, tinted by the color picked above
+            ImGui::Image((void *)(intptr_t)previewTexture.texture, ImVec2(previewTexture.width, previewTexture.height),
+                         ImVec2(0, 0), ImVec2(1, 1), ImVec4(clear_color.x, clear_color.y, clear_color.z, 1.0f));
+            ImGui::End();
+            // se the background color to white
+            glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+        }else{
+            first_start = false;
+            ImGuiWindowFlags window_flags = 0;
+            window_flags |= ImGuiWindowFlags_NoTitleBar;
+            window_flags |= ImGuiWindowFlags_NoResize;
+            window_flags |= ImGuiWindowFlags_NoMove;
+            window_flags |= ImGuiWindowFlags_NoScrollbar;
+
+            ImGui::Begin("EL STREAMER", NULL, window_flags);
+
+            // define the size of the subwindow
+            ImGui::SetWindowSize(ImVec2(300, 200));
+            if(window_width > 300 && window_height > 200)
+                ImGui::SetWindowPos(ImVec2((window_width/2)-150, (window_height/2)-100));
+            // the first panel, any others come from the command line or the config file
+            PanelSettings settings = panels[0]->current();
+            ImGui::Text("Please Select the display size");
+            static int x_size = settings.x_disp_size;
+            static int y_size = settings.y_disp_size;
+            ImGui::SliderInt("X Size", &x_size, 1, monitor_width);
+            ImGui::SliderInt("Y Size", &y_size, 1, monitor_height);
+            // the selected size needs to be a multiple of 4
+            if(x_size % 4 != 0){
+                x_size = x_size - (x_size % 4);
+            }
+            if(y_size % 4 != 0){
+                y_size = y_size - (y_size % 4);
+            }
+            settings.x_disp_size = x_size;
+            settings.y_disp_size = y_size;
+            ImGui::Text("Should the stream be fullscreen?");
+            ImGui::Checkbox("Fullscreen", &settings.entireDisp);
+
+            // refreshed whenever the scanner finished another scan
+            static std::vector<PortInfo> ports;
+            static unsigned portsSeen = 0;
+            if (portScanner.generation() != portsSeen)
+            {
+                portsSeen = portScanner.generation();
+                ports = portScanner.ports();
+            }
+            ImGui::PushItemWidth(150);
+            if (ImGui::BeginCombo("##PortSelector", settings.port))
+            {
+                for (size_t n = 0; n < ports.size(); n++)
+                {
+                    const PortInfo &port = ports[n];
+                    const bool is_selected = port.path == settings.port;
+                    // the ids tell identical panels from USB serial adapters
+                    char label[320];
+                    if (port.vid != 0)
+                        snprintf(label, sizeof(label), "%s  %04x:%04x %s%s", port.path.c_str(), port.vid, port.pid,
+                                 port.product.c_str(), port.available ? "" : " (busy)");
+                    else
+                        snprintf(label, sizeof(label), "%s%s", port.path.c_str(), port.available ? "" : " (busy)");
+                    if (ImGui::Selectable(label, is_selected)){
+                        strncpy(settings.port, port.path.c_str(), sizeof(settings.port) - 1);
+                    }
+                    // Set the initial focus when opening the combo (scrolling + keyboard navigation focus)
+                    if (is_selected){
+                        ImGui::SetItemDefaultFocus();
+                    }
+                }
+                ImGui::EndCombo();
+            }
+
+            ImGui::SameLine();
+
+            // the scan runs on the scanner's thread, the window keeps drawing
+            if (ImGui::Button(portScanner.scanning() ? "Scanning##scan" : "Scan##scan", ImVec2(100, 20))){
+                portScanner.rescan();
+            }
+            // center the button
+            ImGui::SetCursorPosX((300-100)/2);
+            ImGui::SetCursorPosY(150);
+            first_start = !ImGui::Button("Apply", ImVec2(100, 20));
+            // the serial thread opens whatever port was handed back last
+            panels[0]->publish(settings);
+            ImGui::End();
+        }
+        // Rendering
+        ImGui::Render();
+        int display_w, display_h;
+        glfwGetFramebufferSize(window, &display_w, &display_h);
+        glViewport(0, 0, display_w, display_h);
+        glClear(GL_COLOR_BUFFER_BIT);
+        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+
+        glfwSwapBuffers(window);
+    }
+#ifdef __EMSCRIPTEN__
+    EMSCRIPTEN_MAINLOOP_END;
+#endif
+
+    // Cleanup
+    portScanner.stop();
+    previewTexture.destroy();
+    ImGui_ImplOpenGL3_Shutdown();
+    ImGui_ImplGlfw_Shutdown();
+    ImGui::DestroyContext();
+
+    glfwDestroyWindow(window);
+    glfwTerminate();
+
+    return;
+}
+
@@ -0,0 +1,118 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+// single producer / single consumer triple buffer
+// the producer always has a slot of its own to write the next frame into and
+// the consumer always has a slot of its own to read the last one from, the
+// third slot sits in the middle and is swapped with either side through one
+// atomic exchange, so neither side ever waits for the other to finish with
+// its slot and a frame can never be torn
+// if the producer publishes twice before the consumer picks up, the older
+// frame is dropped and counted in overwritten()
+// the mutex and condition variable are only touched when the consumer goes to
+// sleep in wait(), publish() skips them while nobody is waiting
+template <typename T>
+class TripleBuffer
+{
+public:
+    TripleBuffer() : backIndex(0), middle(1), frontIndex(2), waiting(0), dropped(0) {}
+
+    // producer side: the slot to fill in, stays ours until publish()
+    T &back() { return slots[backIndex]; }
+
+    // producer side: hand the back slot over to the consumer and wake it
+    void publish()
+    {
+        int old = middle.exchange(backIndex | FRESH);
+        backIndex = old & INDEX;
+        if (old & FRESH)
+            dropped++;
+        if (waiting.load() > 0)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            wake.notify_one();
+        }
+    }
+
+    // consumer side: the last frame picked up by update() or wait()
+    T &front() { return slots[frontIndex]; }
+
+    // consumer side: pick up the newest frame if there is one, returns false
+    // (and leaves front() alone) if nothing was published since the last call
+    bool update()
+    {
+        if (!(middle.load() & FRESH))
+            return false;
+        int old = middle.exchange(frontIndex);
+        frontIndex = old & INDEX;
+        return true;
+    }
+
+    // consumer side: sleep until a new frame is published, then pick it up
+    // returns false if the timeout ran out first
+    template <typename Rep, typename Period>
+    bool wait(const std::chrono::duration<Rep, Period> &timeout)
+    {
+        if (update())
+            return true;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            waiting++;
+            wake.wait_for(lock, timeout, [this] { return (middle.load() & FRESH) != 0; });
+            waiting--;
+        }
+        return update();
+    }
+
+    // frames the producer replaced before the consumer got to them
+    unsigned long overwritten() const { return dropped.load(); }
+
+private:
+    static const int INDEX = 3;
+    static const int FRESH = 4;
+
+    T slots[3];
+    int backIndex;              // only touched by the producer
+    std::atomic<int> middle;    // slot index, FRESH if not picked up yet
+    int frontIndex;             // only touched by the consumer
+    std::atomic<int> waiting;
+    std::atomic<unsigned long> dropped;
+    std::mutex mutex;
+    std::condition_variable wake;
+};
+
+// wakes a thread that only works when asked to, requests made while it is
+// busy are folded into one, so a burst of requests costs a single pass
+class DemandSignal
+{
+public:
+    DemandSignal() : pending(false) {}
+
+    void request()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending = true;
+        }
+        wake.notify_one();
+    }
+
+    // sleep until there is a request and take it, false on timeout
+    template <typename Rep, typename Period>
+    bool wait(const std::chrono::duration<Rep, Period> &timeout)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait_for(lock, timeout, [this] { return pending; });
+        bool requested = pending;
+        pending = false;
+        return requested;
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool pending;
+};
@@ -1,149 +1,256 @@
-// TODO fix the pixel size and offset slider crashing the app
-#include <GL/glew.h>
-#include "imgui.h"
-#include "imgui_impl_glfw.h"
-#include "imgui_impl_opengl3.h"
 #include <chrono>
 #include <thread>
 #include <opencv2/opencv.hpp>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#include "convert.h"
+#include "framebuffer.h"
+#include "pool.h"
+#include "handoff.h"
+#include "protocol.h"
+#include "record.h"
+#include "serial.h"
+#include "source.h"
+#include "stats.h"
+#include "threshold.h"
 #include <cstdint>
 #include <cstring>
+#include <algorithm>
 #include <vector>
 #include <thread>
 #include <mutex>
-#include <lib/serialib.h>
 #include <stdio.h>
-
-#define GL_SILENCE_DEPRECATION
-#if defined(IMGUI_IMPL_OPENGL_ES2)
-#include <GLES2/gl2.h>
-#endif
-#include <GLFW/glfw3.h> // Will drag system OpenGL headers
-
-static void glfw_error_callback(int error, const char *description)
-{
-    fprintf(stderr, "GLFW Error %d: %s\n", error, description);
+#include <signal.h>
+#include "streamer.h"
+#include "options.h"
+
+// size of the frames the source will hand out, without keeping the source
+// open, a raw input can only be opened once
+static void getSize(const SourceOptions &options, int &Width, int &Height){
+    Width = options.width;
+    Height = options.height;
+    if(options.kind != SOURCE_SCREEN && options.kind != SOURCE_SHM){
+        return;
+    }
+    std::unique_ptr<FrameSource> source = createFrameSource(options);
+    if(source->open()){
+        source->getSize(Width, Height);
+    }
 }
 
-// TODO idk if this actually works as I don't use windows
-#ifdef WIN_ENABLED
-void ImageFromDisplay(std::vector<uint8_t> &Pixels, int &Width, int &Height, int &BitsPerPixel)
+uint monitor_width = 0;
+uint monitor_height = 0;
+
+PanelSettings::PanelSettings()
+    : x_disp_size(320), y_disp_size(240), x_offset(0), y_offset(0), x_step(1), y_step(1),
+      entireDisp(false), sampleMode(SAMPLE_POINT), ditherMode(DITHER_NONE), threshHigh(100), threshMid(50),
+      autoThreshold(AUTO_THRESHOLD_OFF), baud(115200)
 {
-    HWND hDesktop = GetDesktopWindow();
-    HDC hDC = GetDC(hDesktop);
-    HDC hMemDC = CreateCompatibleDC(hDC);
-    HBITMAP hBitmap = CreateCompatibleBitmap(hDC, Width, Height);
-    SelectObject(hMemDC, hBitmap);
-    BitBlt(hMemDC, 0, 0, Width, Height, hDC, 0, 0, SRCCOPY);
-    BITMAPINFOHEADER bi;
-    bi.biSize = sizeof(BITMAPINFOHEADER);
-    bi.biWidth = Width;
-    bi.biHeight = -Height;
-    bi.biPlanes = 1;
-    bi.biBitCount = 32;
-    bi.biCompression = BI_RGB;
-    bi.biSizeImage = 0;
-    bi.biXPelsPerMeter = 0;
-    bi.biYPelsPerMeter = 0;
-    bi.biClrUsed = 0;
-    bi.biClrImportant = 0;
-    GetDIBits(hDC, hBitmap, 0, Height, &Pixels[0], (BITMAPINFO *)&bi, DIB_RGB_COLORS);
-    DeleteObject(hBitmap);
-    DeleteDC(hMemDC);
-    ReleaseDC(hDesktop, hDC);
+    format.bits = 2;
+    format.bitOrder = MSB_FIRST;
+    format.scanOrder = SCAN_ROWS;
+    strcpy(port, "Select port");
 }
-#else
-void ImageFromDisplay(std::vector<uint8_t> &Pixels, int &Width, int &Height, int &BitsPerPixel)
-{
-    Display *display = XOpenDisplay(nullptr);
-    Window root = DefaultRootWindow(display);
-
-    XWindowAttributes attributes = {0};
-    XGetWindowAttributes(display, root, &attributes);
 
-    Width = attributes.width;
-    Height = attributes.height;
+std::vector<std::unique_ptr<Panel>> panels;
 
-    XImage *img = XGetImage(display, root, 0, 0, Width, Height, AllPlanes, ZPixmap);
-    BitsPerPixel = img->bits_per_pixel;
-    Pixels.resize(Width * Height * 4);
+char magic_symbol = 'A';
+bool deltaFrames = true;            // answer delta capable panels with deltas, see protocol.h
+int compression = EL_COMPRESS_RLE2; // payload compression for panels that speak version 2
 
-    memcpy(&Pixels[0], img->data, Pixels.size());
+std::atomic<bool> running(true);
 
-    XDestroyImage(img);
-    XCloseDisplay(display);
+// a captured rectangle and where every panel samples from it
+struct CaptureFrame
+{
+    cv::Mat image;                      // a view of pixels
+    FrameRef pixels;                    // lent by the source, or a pooled copy
+    int x;                              // top left corner of image on screen
+    int y;
+    std::vector<SampleRegion> regions;  // one per panel, in screen coordinates
+    int64_t capturedUs;                 // statsNowUs() when the grab started
+
+    CaptureFrame() : x(0), y(0), capturedUs(0) {}
+};
+
+// work out every panel's region from the current settings and the smallest
+// rectangle holding all of them, which is what gets captured
+static void panelRegions(int Width, int Height, std::vector<SampleRegion> &regions, int &x, int &y,
+                         int &width, int &height)
+{
+    regions.resize(panels.size());
+    int x0 = Width, y0 = Height, x1 = 0, y1 = 0;
+    for(size_t i = 0; i < panels.size(); i++){
+        PanelSettings s = panels[i]->current();
+        SampleRegion &region = regions[i];
+        region = computeSampleRegion(Width, Height, s.x_disp_size, s.y_disp_size, s.x_offset, s.y_offset,
+                                     s.x_step, s.y_step, s.entireDisp, s.sampleMode);
+        if(region.width <= 0 || region.height <= 0){
+            continue;
+        }
+        x0 = std::min(x0, region.x);
+        y0 = std::min(y0, region.y);
+        x1 = std::max(x1, region.x + region.width);
+        y1 = std::max(y1, region.y + region.height);
+    }
+    if(x1 <= x0 || y1 <= y0){
+        x = y = width = height = 0;
+        return;
+    }
+    x = x0;
+    y = y0;
+    width = x1 - x0;
+    height = y1 - y0;
 }
-void getSize(int &Width, int &Height){
-    Display *display = XOpenDisplay(nullptr);
-    Window root = DefaultRootWindow(display);
-
-    XWindowAttributes attributes = {0};
-    XGetWindowAttributes(display, root, &attributes);
 
-    Width = attributes.width;
-    Height = attributes.height;
+// the settings that decide what a panel makes of the screen, the ones
+// compute uses and the ones behind its region
+static bool sameOutput(const PanelSettings &a, const PanelSettings &b)
+{
+    return a.x_disp_size == b.x_disp_size && a.y_disp_size == b.y_disp_size && a.x_offset == b.x_offset &&
+           a.y_offset == b.y_offset && a.x_step == b.x_step && a.y_step == b.y_step &&
+           a.entireDisp == b.entireDisp && a.sampleMode == b.sampleMode && a.ditherMode == b.ditherMode &&
+           a.threshHigh == b.threshHigh && a.threshMid == b.threshMid && a.format.bits == b.format.bits &&
+           a.format.bitOrder == b.format.bitOrder && a.format.scanOrder == b.format.scanOrder;
 }
-#endif
-
-uint monitor_width = 0;
-uint monitor_height = 0;
 
-uint x_disp_size = 320;
-uint y_disp_size = 240;
+// capture -> compute, compute reads the newest frame in place
+TripleBuffer<CaptureFrame> captureFrames;
+// capturedUs of the last frame compute went through
+std::atomic<int64_t> computedUs(0);
 
-int x_offset = 0;
-int y_offset = 0;
+// a static screen is not grabbed again, but at least this often in case
+// the server missed reporting a change
+static const int64_t REFRESH_US = 1000000;
 
-int global_x_step = 1;
-int global_y_step = 1;
-
-bool entireDisp = false;
-
-int threshHigh = 100;
-int threshMid = 50;
-
-char selected_port[24] = "Select port\0";
-
-char magic_symbol = 'A';
+int scheduleMode = SCHEDULE_TIMED;
+float frameRate = 30.0;   // the target frame rate
+// serial -> capture in SCHEDULE_DEMAND mode
+DemandSignal captureDemand;
+std::atomic<double> deltaScTime(0.0); // time between two screenshots
 
-cv::Mat img1;                       // the first frame buffer
-bool changeFb = false;              // flag to indicate that the frame buffer has changed
-int scWidth = 0;                    // the width of the screenshot
-int scHeight = 0;                   // the height of the screenshot
-
-std::mutex scFbChangeMutex;         // mutex for the flag changeFb
-
-float frameRate = 0.0;    // the target frame rate
-double deltaScTime = 0.0; // time between two screenshots
-
-void ScreenshotThread()
+void ScreenshotThread(SourceOptions options)
 {
     int Width = 0;
     int Height = 0;
     int Bpp = 0;
-    uint size_x = 0;
-    uint size_y = 0;
-    std::vector<std::uint8_t> Pixels;
-    cv::Mat buff;
-    while (true)
+    // grabs that can't be kept are copied into these
+    FramePool copies;
+    // opened once for the lifetime of the thread, for X11 that is one
+    // connection and one SHM segment
+    std::unique_ptr<FrameSource> capture = createFrameSource(options);
+    if(capture->open()){
+        capture->trackDamage();
+    }
+    // what the last grab was taken for, a grab is skipped while none of it
+    // changed and the source reports no damage inside the rectangle
+    std::vector<PanelSettings> grabbed;
+    // and the auto thresholds compute had picked by then
+    std::vector<std::pair<int, int>> grabbedAuto;
+    int64_t lastGrabUs = 0;
+    int lastX = 0, lastY = 0, lastWidth = 0, lastHeight = 0;
+    while (running)
     {
+        // on demand the panels say when, otherwise the clock at the bottom does
+        if(scheduleMode == SCHEDULE_DEMAND && !captureDemand.wait(std::chrono::milliseconds(100))){
+            continue;
+        }
         // here we just take a screenshot and convert it to a cv::Mat
         auto start = std::chrono::system_clock::now();
-        ImageFromDisplay(Pixels, Width, Height, Bpp);
-        buff = cv::Mat(Height, Width, Bpp > 24 ? CV_8UC4 : CV_8UC3, &Pixels[0]);
-        scWidth = Width;
-        scHeight = Height;
-        img1 = buff.clone();
-        scFbChangeMutex.lock();
-        changeFb = true;
-        scFbChangeMutex.unlock();
+        int64_t grabStart = statsNowUs();
+        // our slot, the regions are worked out straight into it
+        CaptureFrame &frame = captureFrames.back();
+        int x = 0, y = 0, width = 0, height = 0;
+        if(!capture->isOpen()){
+            if(!capture->open()){
+                std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+                continue;
+            }
+            capture->trackDamage();
+        }
+        capture->getSize(Width, Height);
+        // one grab covers every panel, however many there are
+        panelRegions(Width, Height, frame.regions, x, y, width, height);
+        if(width <= 0 || height <= 0){
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+        bool dirty = capture->takeDamage(x, y, width, height);
+        bool sameSettings = grabbed.size() == panels.size();
+        for(size_t i = 0; sameSettings && i < panels.size(); i++){
+            sameSettings = sameOutput(grabbed[i], panels[i]->current()) &&
+                           grabbedAuto[i] == std::make_pair(panels[i]->autoHigh.load(), panels[i]->autoMid.load());
+        }
+        if(!dirty && sameSettings && x == lastX && y == lastY && width == lastWidth && height == lastHeight &&
+           grabStart - lastGrabUs < REFRESH_US){
+            pipelineStats.captureSkipped++;
+            // once compute is through the last grab the panels' newest
+            // frames are as good as a new one
+            if(computedUs == lastGrabUs){
+                for(size_t i = 0; i < panels.size(); i++){
+                    panels[i]->currentUs = grabStart;
+                }
+            }
+            // demand mode waits for the next request, timed mode for the next
+            // tick, or less if the source can tell when it has a new frame
+            if(scheduleMode == SCHEDULE_TIMED){
+                capture->waitForChange((int)(1000.0 / frameRate));
+            }
+            continue;
+        }
+        grabbed.resize(panels.size());
+        grabbedAuto.resize(panels.size());
+        for(size_t i = 0; i < panels.size(); i++){
+            grabbed[i] = panels[i]->current();
+            grabbedAuto[i] = std::make_pair(panels[i]->autoHigh.load(), panels[i]->autoMid.load());
+        }
+        lastGrabUs = grabStart;
+        lastX = x;
+        lastY = y;
+        lastWidth = width;
+        lastHeight = height;
+        // compute is done with our slot, what it held goes back to the
+        // source or the pool before the grab, so the grab can reuse it
+        frame.image.release();
+        frame.pixels.reset();
+        int Stride = 0;
+        const uint8_t *data = capture->grab(x, y, width, height, Bpp, Stride);
+        if(data == nullptr){
+            pipelineStats.captureFailed++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+        int type = Bpp > 24 ? CV_8UC4 : CV_8UC3;
+        if(Bpp > 24 && capture->keep(frame.pixels)){
+            // compute reads the source's memory in place
+            frame.image = cv::Mat(height, width, type, (void *)data, Stride);
+        }else{
+            // the only copy, into a page aligned buffer the pool had spare
+            size_t rowBytes = (size_t)width * (Bpp > 24 ? 4 : 3);
+            size_t stride = alignedStride(rowBytes);
+            frame.pixels = copies.acquire(stride * height);
+            if(!frame.pixels){
+                pipelineStats.captureFailed++;
+                continue;
+            }
+            for(int row = 0; row < height; row++){
+                memcpy(frame.pixels.data() + row * stride, data + (size_t)row * Stride, rowBytes);
+            }
+            frame.image = cv::Mat(height, width, type, frame.pixels.data(), stride);
+        }
+        frame.x = x;
+        frame.y = y;
+        frame.capturedUs = grabStart;
+        captureFrames.publish();
+        pipelineStats.capture.record(statsNowUs() - grabStart);
+        pipelineStats.captured++;
+        pipelineStats.captureDropped = captureFrames.overwritten();
+        pipelineStats.frameBuffers = FramePool::allocations();
         auto end = std::chrono::system_clock::now();
         std::chrono::duration<double> elapsed_seconds = end - start;
         // calculate the required delay for to hit the target frame rate
         float delay = 1000.0 / frameRate - elapsed_seconds.count() * 1000;
-        if (delay > 0){
+        if (delay > 0 && scheduleMode == SCHEDULE_TIMED){
             std::this_thread::sleep_for(std::chrono::milliseconds((int)delay));
         }
         end = std::chrono::system_clock::now();
@@ -153,489 +260,489 @@ void ScreenshotThread()
 }
 
 
-std::vector<uint8_t> data_buffer;   // the raw binary frame buffer that will be sent to the display
-std::vector<uint8_t> target_buffer; // the buffer containing the image data that will be converted to raw binary data
-
-std::mutex scTbMutex;               // mutex for the preview
-std::mutex newImgMutex;             // mutex for the new image flag
-std::mutex newDataMutex;            // mutex for the new data flag
-
-cv::Mat img2;
-bool newImg = false;
-bool newData = false;
-
-void ComputeThread(){
-    uint size_x = 0;
-    uint size_y = 0;
-    int Width = 0;
-    int Height = 0;
-    int stride = 0;
-    int x_step = 0;
-    int y_step = 0;
-    uint offset_x = 0;
-    uint offset_y = 0;
-    cv::Mat buff;
-    while(true){
-        bool changed = false;
-        scFbChangeMutex.lock();
-        changed = changeFb;
-        changeFb = false;
-        scFbChangeMutex.unlock();
-        if(changed){
-            size_x = x_disp_size;
-            size_y = y_disp_size;
-            Width = scWidth;
-            Height = scHeight;
-            buff = img1.clone();
-            offset_x = x_offset;
-            offset_y = y_offset;
-            if(entireDisp){
-                x_step = Width / size_x;
-                y_step = Height / size_y;
-            }else{
-                x_step = global_x_step;
-                y_step = global_y_step;
-                if(x_step > Width / size_x){
-                    x_step = Width / size_x;
-                }
-                if(y_step > Height / size_y){
-                    y_step = Height / size_y;
-                }
+void ComputeThread(PoolOptions options){
+    // the row tiles of a frame are sampled, converted and packed in
+    // parallel, one panel after the other, so frames still leave in order
+    WorkerPool pool(options.threads, options.cpus);
+    // per panel, so each keeps its dither tables and row buffers
+    std::vector<ConvertScratch> scratch(panels.size());
+    // what each panel was last handed, a frame that hashes the same is not
+    // handed on again
+    std::vector<uint64_t> hashes(panels.size(), 0);
+    std::vector<uint> widths(panels.size(), 0);
+    // panels that don't take the EL format get it repacked from the preview
+    std::vector<std::vector<uint8_t>> native(panels.size());
+    std::vector<std::vector<uint8_t>> packScratch;  // per thread of pool
+    // luma histogram of the panel being converted, for --auto-threshold
+    uint32_t histogram[256];
+    while(running){
+        // sleep until the capture thread hands over a frame
+        if(!captureFrames.wait(std::chrono::milliseconds(100))){
+            continue;
+        }
+        // the front slot is ours until the next wait, no need to copy it
+        const CaptureFrame &frame = captureFrames.front();
+        int64_t computeStart = statsNowUs();
+        unsigned long dropped = 0;
+        for(size_t i = 0; i < panels.size() && i < frame.regions.size(); i++){
+            Panel &p = *panels[i];
+            PanelSettings s = p.current();
+            const SampleRegion &region = frame.regions[i];
+            uint size_x = region.size_x;
+            uint size_y = region.size_y;
+            if(region.width <= 0 || region.height <= 0){
+                continue;
+            }
+            // the panel's rectangle inside the shared capture
+            const uint8_t *image = frame.image.ptr(region.y - frame.y) + (region.x - frame.x) * frame.image.elemSize();
+            // write straight into our slots of the outgoing buffers
+            PanelFrame &panel = p.frames.back();
+            PreviewFrame &preview = p.previews.back();
+            panel.size_x = preview.size_x = size_x;
+            panel.size_y = preview.size_y = size_y;
+            preview.pixels.resize(size_x * size_y);
+            PackFn pack = nativeFormat(s.format) ? nullptr : selectPacker(s.format);
+            panel.data.resize(pack != nullptr ? packedSize(s.format, size_x, size_y) : size_x * size_y / 4);
+            panel.mapped = nullptr;
+            panel.format = s.format;
+            panel.capturedUs = frame.capturedUs;
+            uint8_t *packed = &panel.data[0];
+            if(pack != nullptr){
+                native[i].resize(size_x * size_y / 4);    // 4 pixels per byte
+                packed = &native[i][0];
+            }
+            bool automatic = s.autoThreshold != AUTO_THRESHOLD_OFF;
+            int high = s.threshHigh;
+            int mid = s.threshMid;
+            if(automatic && p.autoHigh.load() != Panel::AUTO_UNSET){
+                high = p.autoHigh.load();
+                mid = p.autoMid.load();
             }
-            // get the length of the buffer
-            if(Height != 0){
-                stride = (buff.total() * buff.elemSize()) / Height;
+            if(s.format.bits == 4){
+                // 16 grays instead of the 3 levels, packed from the preview below
+                grayFrame(image, frame.image.step, region, pool, scratch[i], &preview.pixels[0],
+                          automatic ? histogram : nullptr);
             }else{
-                continue;
+                convertFrame(image, frame.image.step, region, high, mid, s.ditherMode, pool, scratch[i],
+                             &preview.pixels[0], packed, automatic ? histogram : nullptr);
             }
-            uint32_t index = 0;
-            scTbMutex.lock();
-            // define the target buffer size
-            target_buffer.resize(size_x * size_y);
-            // iterate over each pixel of target display
-            for (int y = 0; y < size_y; y++)
-            {
-                for (int x = 0; x < size_x; x++)
-                {
-                    int big_x = x * x_step + offset_x;
-                    int big_y = y * y_step + offset_y;
-                    // if the pixel is out of bounds, set it to black
-                    if(big_x > Width){
-                        big_x = Width;
-                    }
-                    if(big_y > Height){
-                        big_y = Height;
-                    }
-
-                    // get the pixel value
-                    cv::Vec4b pixel = buff.at<cv::Vec4b>(big_y, big_x);
-                    // pixel[0] B
-                    // pixel[1] G
-                    // pixel[2] R
-                    // calculate and store the average value
-                    uint8_t avg = (pixel[0] + pixel[1] + pixel[2]) / 3;
-                    target_buffer[index] = avg;
-                    // set the pixel value
-                    index++;
-                }
+            if(automatic){
+                // takes effect from the next frame, the capture thread grabs
+                // it even if the screen is static when the thresholds moved
+                autoThreshold(s.autoThreshold, histogram, high, mid);
+                p.autoMid = mid;
+                p.autoHigh = high;
+            }else if(p.autoHigh.load() != Panel::AUTO_UNSET){
+                // turned back on it starts from the settings again
+                p.autoHigh = Panel::AUTO_UNSET;
+                p.autoMid = Panel::AUTO_UNSET;
             }
-
-            // now we will compute the raw binary data
-            data_buffer.resize(size_x * size_y / 4);    // 4 pixels per byte
-            for(int i = 0; i < data_buffer.size(); i++){
-                // threshold represents the maximum brightness value
-                // so if a pixel is > threshold, we set it to 11
-                // if it's threshold/2, we set it to 10
-                // if it's 0, we set it to 00
-                // byte structure:
-                // 00 00 00 00 - 1 byte
-                // each collection of 2 bits is a brightness value
-                // 00 = black
-                // 01 = 1 - 50% in our case
-                // 10 || 11 = 2 - 100% in our case
-                uchar data[4] = {0};
-                // get the pixel values
-                for(int j = 0; j < 4; j++){
-                    uchar buff = target_buffer[i * 4 + j];
-                    if(buff > threshHigh){
-                        data[j] = 2;
-                    }else if(buff > threshMid){
-                        data[j] = 1;
-                    }else{
-                        data[j] = 0;
-                    } 
-                    target_buffer[i * 4 + j] = data[j] * 127;
-                }
-                uchar byte = 0;
-                for(int j = 0; j < 4; j++){
-                    byte |= data[j] << (6 - j * 2);
-                }        
-                data_buffer[i] = byte;
+            if(pack != nullptr){
+                packTiles(s.format, pack, &preview.pixels[0], size_x, size_y, &panel.data[0], pool, packScratch);
             }
-            // convert the target buffer into a black and white CV2 image
-            img2 = cv::Mat(size_y, size_x, CV_8UC1, &target_buffer[0]);
-            scTbMutex.unlock();
-            newDataMutex.lock();
-            newData = true;
-            newDataMutex.unlock();
-            newImgMutex.lock();
-            newImg = true;
-            newImgMutex.unlock();
+            uint64_t hash = frameHash(&panel.data[0], panel.data.size());
+            if(hash == hashes[i] && size_x == widths[i]){
+                // the panel already has this frame, its serial thread stays idle
+                pipelineStats.unchanged++;
+                p.currentUs = frame.capturedUs;
+                continue;
+            }
+            hashes[i] = hash;
+            widths[i] = size_x;
+            p.frames.publish();
+            p.previews.publish();
+            p.currentUs = frame.capturedUs;
+            dropped += p.frames.overwritten();
         }
+        computedUs = frame.capturedUs;
+        pipelineStats.compute.record(statsNowUs() - computeStart);
+        pipelineStats.converted++;
+        pipelineStats.computeDropped = dropped;
     }
 
 }
 
-double deltaSerialTime = 0.0; // time between two serial frames
-void SerialThread(){
-    serialib device;
-    auto lastStart = std::chrono::system_clock::now();
-    while(true){
-        if(device.openDevice(selected_port, 115200) == 1){
-            bool new_data = false;
-            std::vector<uint8_t> data;
-            while(true){
-                newDataMutex.lock();
-                new_data = newData;
-                newData = false;
-                newDataMutex.unlock();
-                if(new_data){
-                    scTbMutex.lock();
-                    data = data_buffer;
-                    scTbMutex.unlock();
-                    char read = 0;
-                    device.readChar(&read);
-                    if(read == magic_symbol){
-                        device.flushReceiver();
-                        device.writeBytes(data.data(), data.size());
-                        auto end = std::chrono::system_clock::now();
-                        std::chrono::duration<double> elapsed_seconds = end - lastStart;
-                        deltaSerialTime = elapsed_seconds.count() * 1000;
-                        lastStart = std::chrono::system_clock::now();
-                    }
-                    device.flushReceiver();
-                }
-            }
+std::atomic<double> deltaSerialTime(0.0); // time between two serial frames
+
+// --record, shared by every panel's serial thread
+FrameRecorder recorder;
+
+// --replay stands in for capture and compute, the recorded frames go to
+// their panels' frames as if compute had just made them
+void ReplayThread(FrameReplay *replay, bool maxSpeed, bool stopAtEnd)
+{
+    RecordHeader header;
+    const uint8_t *data = nullptr;
+    int64_t firstUs = 0;
+    int64_t startUs = 0;
+    unsigned long frames = 0;
+    // framesSent of each panel's port when its last frame was handed over
+    std::vector<uint64_t> handedAt(panels.size(), 0);
+    std::vector<bool> handed(panels.size(), false);
+    // at max speed a panel gets its next frame once the last one is out
+    auto waitSent = [&](size_t i, int64_t timeoutUs){
+        int64_t deadline = statsNowUs() + timeoutUs;
+        while(running && handed[i] && panels[i]->linkStats->framesSent == handedAt[i] && statsNowUs() < deadline){
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    };
+    while(running && replay->next(header, data)){
+        if(header.panel >= panels.size()){
+            continue;
+        }
+        // a frame packed for another layout would only be noise on this panel
+        PanelFormat format = header.format();
+        PanelFormat wanted = panels[header.panel]->current().format;
+        if(format.bits != wanted.bits || format.bitOrder != wanted.bitOrder || format.scanOrder != wanted.scanOrder ||
+           header.bytes != packedSize(format, header.size_x, header.size_y)){
+            continue;
+        }
+        // only the EL format can be shown in the preview
+        bool showPreview = nativeFormat(format);
+        if(frames == 0){
+            firstUs = header.timeUs;
+            startUs = statsNowUs();
+        }
+        Panel &p = *panels[header.panel];
+        if(maxSpeed){
+            waitSent(header.panel, INT64_MAX / 2);
         }else{
-            std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+            int64_t wait = startUs + (header.timeUs - firstUs) - statsNowUs();
+            if(wait > 0){
+                std::this_thread::sleep_for(std::chrono::microseconds(wait));
+            }
+        }
+        int64_t now = statsNowUs();
+        PanelFrame &frame = p.frames.back();
+        // the mapping outlives the serial threads, nothing to copy
+        frame.mapped = data;
+        frame.mappedBytes = header.bytes;
+        frame.format = format;
+        frame.size_x = header.size_x;
+        frame.size_y = header.size_y;
+        frame.capturedUs = now;
+        PreviewFrame &preview = p.previews.back();
+        if(showPreview){
+            preview.size_x = header.size_x;
+            preview.size_y = header.size_y;
+            // 4 pixels per byte, first pixel in the top bits
+            preview.pixels.resize((size_t)header.size_x * header.size_y);
+            for(size_t i = 0; i < preview.pixels.size(); i++){
+                preview.pixels[i] = ((data[i / 4] >> (6 - (i % 4) * 2)) & 3) * 127;
+            }
+        }
+        handedAt[header.panel] = p.linkStats->framesSent;
+        handed[header.panel] = true;
+        p.frames.publish();
+        if(showPreview){
+            p.previews.publish();
+        }
+        p.currentUs = now;
+        pipelineStats.converted++;
+        unsigned long dropped = 0;
+        for(size_t i = 0; i < panels.size(); i++){
+            dropped += panels[i]->frames.overwritten();
         }
+        pipelineStats.computeDropped = dropped;
+        frames++;
+    }
+    // give the last frames a moment to go out
+    for(size_t i = 0; i < panels.size(); i++){
+        waitSent(i, 1000000);
+    }
+    fprintf(stderr, "Replay: %lu frames\n", frames);
+    if(stopAtEnd){
+        running = false;
     }
 }
 
-uint window_width = 800;
-uint window_height = 600;
-// GUI thread
-GLuint textureID;
-
-void guiThread(){
-    cv::Mat img;
-    static bool first_start = true;
-    // a FIFO with the last 250 frametimes
-    std::deque<double> frametimes;
-    std::vector<std::uint8_t> Pixels;
-    glfwSetErrorCallback(glfw_error_callback);
-    if (!glfwInit())
-        return;
-
-    // Decide GL+GLSL versions
-#if defined(IMGUI_IMPL_OPENGL_ES2)
-    // GL ES 2.0 + GLSL 100
-    const char *glsl_version = "#version 100";
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 2);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 0);
-    glfwWindowHint(GLFW_CLIENT_API, GLFW_OPENGL_ES_API);
-#elif defined(__APPLE__)
-    // GL 3.2 + GLSL 150
-    const char *glsl_version = "#version 150";
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE); // 3.2+ only
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);           // Required on Mac
-#else
-    // GL 3.0 + GLSL 130
-    const char *glsl_version = "#version 130";
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE); // 3.2+ only
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);           // 3.0+ only
-#endif
-
-    // Create window with graphics context
-    GLFWwindow *window = glfwCreateWindow(window_width, window_height, "EL Streamer", NULL, NULL);
-    if (window == NULL)
-        return;
-    glfwMakeContextCurrent(window);
-    glfwSwapInterval(1); // Enable vsync
-    // set the smallest allowed window size
-    glfwSetWindowSizeLimits(window, 400, 300, GLFW_DONT_CARE, GLFW_DONT_CARE);
-
-    // Setup Dear ImGui context
-    IMGUI_CHECKVERSION();
-    ImGui::CreateContext();
-    ImGuiIO &io = ImGui::GetIO();
-    (void)io;
-    io.ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard; // Enable Keyboard Controls
-    io.ConfigFlags |= ImGuiConfigFlags_NavEnableGamepad;  // Enable Gamepad Controls
-
-    // Setup Dear ImGui style
-    ImGui::StyleColorsDark();
-
-    // Setup Platform/Renderer backends
-    ImGui_ImplGlfw_InitForOpenGL(window, true);
-    ImGui_ImplOpenGL3_Init(glsl_version);
-    glewInit();
-    // Our state
-    ImVec4 clear_color = ImVec4(1.0f, 1.0f, 0.0f, 1.00f);
-
-    // Main loop
-#ifdef __EMSCRIPTEN__
-    // For an Emscripten build we are disabling file-system access, so let's not attempt to do a fopen() of the imgui.ini file.
-    // You may manually call LoadIniSettingsFromMemory() to load settings from your own storage.
-    io.IniFilename = NULL;
-    EMSCRIPTEN_MAINLOOP_BEGIN
-#else
-    while (!glfwWindowShouldClose(window))
-#endif
-    {
-        // Poll and handle events (inputs, window resize, etc.)
-        glfwPollEvents();
-
-        // Start the Dear ImGui frame
-        ImGui_ImplOpenGL3_NewFrame();
-        ImGui_ImplGlfw_NewFrame();
-        ImGui::NewFrame();
+// how recent the screen in front() of the panel's frames is, a static
+// screen keeps the newest frame current without publishing a new one
+// currentUs is read before picking up the frame it speaks for
+static int64_t frameTime(Panel &panel)
+{
+    int64_t current = panel.currentUs;
+    panel.frames.update();
+    return std::max(panel.frames.front().capturedUs, current);
+}
 
-        // get glfw window size
-        int width, height;
-        glfwGetWindowSize(window, &width, &height);
-        window_width = width;
-        window_height = height;
-        if (!first_start)
-        {
-            // set our flags
-            ImGuiWindowFlags window_flags = 0;
-            window_flags |= ImGuiWindowFlags_NoTitleBar;
-            window_flags |= ImGuiWindowFlags_NoResize;
-            window_flags |= ImGuiWindowFlags_NoMove;
-            window_flags |= ImGuiWindowFlags_NoScrollbar;
+// SCHEDULE_DEMAND: make front() of the panel's frames one that is at most
+// 1 / frameRate old, usually the capture asked for right after the last
+// send is already waiting, otherwise capture one now and wait for it
+static bool demandFrame(Panel &panel, int64_t requestUs)
+{
+    int64_t maxAge = (int64_t)(1000000 / frameRate);
+    if(panel.frames.front().size() != 0 && frameTime(panel) >= requestUs - maxAge){
+        pipelineStats.prefetched++;
+        return true;
+    }
+    captureDemand.request();
+    // capture and compute take a few ms, don't leave the panel hanging if
+    // the screen can't be grabbed
+    int64_t deadline = requestUs + 200000;
+    while(running && statsNowUs() < deadline){
+        panel.frames.wait(std::chrono::milliseconds(10));
+        if(panel.frames.front().size() != 0 && frameTime(panel) >= requestUs){
+            pipelineStats.justInTime++;
+            return true;
+        }
+    }
+    // an old frame beats no answer at all
+    return panel.frames.front().size() != 0;
+}
+// long enough for size bytes at baud (10 bits a byte) plus some slack for
+// USB scheduling
+static int writeTimeoutMs(size_t size, unsigned baud)
+{
+    return (int)(size * 10000ULL / baud) + 500;
+}
 
-            ImGui::Begin("EL STREAMER", NULL, window_flags);
-            ImGui::SetWindowSize(ImVec2(window_width, window_height));
-            ImGui::SetWindowPos(ImVec2(0, 0));
-            ImGui::ColorEdit3("Color", (float *)&clear_color);
-            ImGui::SliderInt("High Threshold", &threshHigh, 0, 255);
-            ImGui::SliderInt("Mid Threshold", &threshMid, 0, 255);
-            
-            if(!entireDisp){
-                // calculate the maximum offset for the sliders, taking the step size into account
-                int max_x_offset = (monitor_width - x_disp_size * global_x_step);
-                int max_y_offset = (monitor_height - y_disp_size * global_y_step);
-                ImGui::SliderInt("Offset X", &x_offset, 0, max_x_offset);
-                ImGui::SliderInt("Offset Y", &y_offset, 0, max_y_offset);
-                ImGui::SliderInt("Step X", &global_x_step, 1, monitor_width / x_disp_size);
-                ImGui::SliderInt("Step Y", &global_y_step, 1, monitor_height / y_disp_size);
-                if(x_offset > max_x_offset){
-                    x_offset = max_x_offset;
+void SerialThread(Panel *panel){
+    // recordings name panels by index
+    uint32_t index = 0;
+    while(panels[index].get() != panel){
+        index++;
+    }
+    SerialLink link;
+    PortStats &port = *panel->linkStats;
+    DeltaEncoder encoder;
+    std::vector<uint8_t> packet;
+    auto lastStart = std::chrono::system_clock::now();
+    while(running){
+        // the port and rate this connection was opened with
+        const PanelSettings settings = panel->current();
+        if(link.open(settings.port, settings.baud) != 1){
+            // try again soon, so a panel that gets plugged in is picked up quickly
+            std::this_thread::sleep_for(std::chrono::milliseconds(250));
+            continue;
+        }
+        // a new connection starts with a keyframe
+        encoder.reset();
+        // and gets the frame the panels show even if the screen is static
+        bool unsent = panel->frames.front().size() != 0;
+        // pick up the newest frame compute handed over, the one before it
+        // goes unsent if the panel didn't ask for it in time
+        auto pickUp = [&](){
+            if(panel->frames.update()){
+                if(unsent){
+                    pipelineStats.unrequested++;
                 }
-                if(y_offset > max_y_offset){
-                    y_offset = max_y_offset;
+                unsent = true;
+            }
+        };
+        pipelineStats.serialOpens++;
+        port.setPort(settings.port);
+        port.connects++;
+        // cleared when the port goes away or a write times out, we close it
+        // and open it again
+        bool connected = true;
+        // write a whole buffer, keeping the port's throughput stats
+        auto send = [&](const uint8_t *data, size_t size){
+            int64_t start = statsNowUs();
+            int result = link.write(data, size, writeTimeoutMs(size, settings.baud));
+            port.writeUs += statsNowUs() - start;
+            if(result == 1){
+                port.bytesSent += size;
+                port.framesSent++;
+            }else{
+                port.errors++;
+                // the panel got part of the buffer and the rest is still
+                // queued, drop it so close() doesn't wait for it, the new
+                // connection starts over with a keyframe
+                if(result == 0){
+                    link.flushOutput();
                 }
+                connected = false;
             }
-
-            float frameTime = 1000.0f / io.Framerate;
-            frameRate = io.Framerate;
-            // add frame time to the vector and if it's too big, remove the first element
-            frametimes.push_back(frameTime);
-            if (frametimes.size() > 250)
-            {
-                frametimes.erase(frametimes.begin());
+            return result == 1;
+        };
+        while(running && connected){
+            bool demand = scheduleMode == SCHEDULE_DEMAND;
+            char read = 0;
+            // every request gets an answer, so wait for the panel rather
+            // than for a frame, don't block forever so the thread can be stopped
+            int got = link.readByte(read, 100);
+            if(!demand){
+                pickUp();
             }
-            float arrFrameTimes[250] = {0};
-            for (long unsigned int i = 0; i < frametimes.size(); i++)
-            {
-                arrFrameTimes[i] = frametimes[i];
+            if(got < 0){
+                connected = false;
+                break;
             }
-            float maxFrameTime = frameTime + 1;
-            for (long unsigned int i = 0; i < frametimes.size(); i++)
-            {
-                if (frametimes[i] > maxFrameTime)
-                {
-                    maxFrameTime = frametimes[i];
-                }
+            // another port or rate was picked, open that one
+            PanelSettings now = panel->current();
+            if(strcmp(now.port, settings.port) != 0 || now.baud != settings.baud){
+                break;
             }
-            double scTime = 0;
-            scTime = deltaScTime;
-            double serialTime = 0;
-            serialTime = deltaSerialTime;
-            // show the frame time and FPS
-            ImGui::Text("Application average %.3f ms/frame (%.1f FPS); Screenshot thread: %.3f ms/frame; Serial thread: %.3f ms", frameTime, io.Framerate, scTime, serialTime);
-            ImGui::PlotLines("##Frame Time Graph", arrFrameTimes, IM_ARRAYSIZE(arrFrameTimes), 0, NULL, 0, maxFrameTime, ImVec2(window_width, 80));
-
-            bool bufferChanged = false;
-            newImgMutex.lock();
-            bufferChanged = newImg;
-            newImg = false;
-            newImgMutex.unlock();
-            if (bufferChanged)
-            {
-                scTbMutex.lock();
-                img = img2.clone();
-                scTbMutex.unlock();
-                cv::cvtColor(img, img, cv::COLOR_GRAY2RGB);
-                // multiply each pixel by respective clear_color value
-                for (int i = 0; i < img.rows; i++)
-                {
-                    for (int j = 0; j < img.cols; j++)
-                    {
-                        img.at<cv::Vec3b>(i, j)[0] = img.at<cv::Vec3b>(i, j)[0] * clear_color.x;
-                        img.at<cv::Vec3b>(i, j)[1] = img.at<cv::Vec3b>(i, j)[1] * clear_color.y;
-                        img.at<cv::Vec3b>(i, j)[2] = img.at<cv::Vec3b>(i, j)[2] * clear_color.z;
-                    }
-                }
-                // create a texture from the image
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, img.cols, img.rows, 0, GL_RGB, GL_UNSIGNED_BYTE, img.ptr());
+            if(got == 0){
+                continue;
             }
-            // display the image
-            ImGui::Image((void *)(intptr_t)textureID, ImVec2(img.cols, img.rows));
-            ImGui::End();
-            // se the background color to white
-            glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-        }else{
-            first_start = false;
-            ImGuiWindowFlags window_flags = 0;
-            window_flags |= ImGuiWindowFlags_NoTitleBar;
-            window_flags |= ImGuiWindowFlags_NoResize;
-            window_flags |= ImGuiWindowFlags_NoMove;
-            window_flags |= ImGuiWindowFlags_NoScrollbar;
-
-            ImGui::Begin("EL STREAMER", NULL, window_flags);
-
-            // define the size of the subwindow
-            ImGui::SetWindowSize(ImVec2(300, 200));
-            if(window_width > 300 && window_height > 200)
-                ImGui::SetWindowPos(ImVec2((window_width/2)-150, (window_height/2)-100));
-            ImGui::Text("Please Select the display size");
-            static int x_size = x_disp_size;
-            static int y_size = y_disp_size;
-            ImGui::SliderInt("X Size", &x_size, 1, monitor_width);
-            ImGui::SliderInt("Y Size", &y_size, 1, monitor_height);
-            // the selected size needs to be a multiple of 4
-            if(x_size % 4 != 0){
-                x_size = x_size - (x_size % 4);
+            int64_t requestUs = statsNowUs();
+            // the request carries the newest protocol version the panel knows,
+            // read it now so it can't be taken for the next request
+            // anything else the panel sent is a request of its own and waits
+            // for its answer, a panel asking right after a frame is not ignored
+            char version = 0;
+            if(read == REQUEST_DELTA || read == REQUEST_KEYFRAME){
+                link.readByte(version, 100);
             }
-            if(y_size % 4 != 0){
-                y_size = y_size - (y_size % 4);
+            if(demand && !demandFrame(*panel, requestUs)){
+                continue;
             }
-            x_disp_size = x_size;
-            y_disp_size = y_size;
-            ImGui::Text("Should the stream be fullscreen?");
-            ImGui::Checkbox("Fullscreen", &entireDisp);
-
-            static char* items[99] = {0};
-            static int item_current = -1; // If the selection isn't within 0..count, Combo won't display a preview
-            ImGui::PushItemWidth(150);
-            if (ImGui::BeginCombo("##PortSelector", selected_port))
-            {
-                for (int n = 0; n < IM_ARRAYSIZE(items); n++)
-                {
-                    const bool is_selected = (item_current == n);
-                    if(items[n] != NULL){
-                        if (ImGui::Selectable(items[n], is_selected)){
-                            item_current = n;
-                            strcpy(selected_port, items[n]);
-                        }
-                        // Set the initial focus when opening the combo (scrolling + keyboard navigation focus)
-                        if (is_selected){
-                            ImGui::SetItemDefaultFocus();
-                        }
-                    }
+            if(!demand && !unsent){
+                // the panel has the front frame already, give compute a frame
+                // interval to hand over a newer one, which also keeps a panel
+                // that asks as fast as it can at the frame rate
+                // compute hands over nothing while the screen is static, the
+                // panel then gets the same frame again (an empty delta)
+                if(panel->frames.wait(std::chrono::microseconds((int64_t)(1000000 / frameRate)))){
+                    unsent = true;
                 }
-                ImGui::EndCombo();
             }
-
-            ImGui::SameLine();
-
-            static bool scan = true;
-            char device_name[99][24];
-            if(scan){
-                scan = false;
-                serialib device;
-                for (int i=0;i<98;i++)
-                {
-                    // Prepare the port name (Windows)
-                    #if defined (_WIN32) || defined( _WIN64)
-                        sprintf (device_name[i],"\\\\.\\COM%d",i+1);
-                    #endif
-                    // Prepare the port name (Linux)
-                    #ifdef __linux__
-                        sprintf (device_name[i],"/dev/ttyACM%d",i);
-                    #endif
-                    // try to connect to the device
-                    if (device.openDevice(device_name[i],115200)==1)
-                    {
-                        // set the pointer to the array
-                        items[i] = device_name[i];
-                        // Close the device before testing the next port
-                        device.closeDevice();
-                    }else{
-                        items[i] = NULL;
-                    }
+            if(panel->frames.front().size() == 0){
+                // nothing captured yet, the panel will ask again
+                continue;
+            }
+            // the front slot is ours until the next wait
+            const PanelFrame &frame = panel->frames.front();
+            const uint8_t *data = frame.bytes();
+            size_t size = frame.size();
+            size_t written = 0;
+            bool sent = false;
+            if(read == magic_symbol){
+                // legacy firmware, raw frame
+                sent = send(data, size);
+                written = size;
+            }else if(read == REQUEST_DELTA || read == REQUEST_KEYFRAME){
+                // packets are sized for 2 bits per pixel (see protocol.h), 1
+                // and 4 bit panels get the raw frame whatever they ask for
+                bool packets = size == (size_t)frame.size_x * frame.size_y / 4;
+                if(version >= 1 && packets){
+                    bool keyframe = read == REQUEST_KEYFRAME || !deltaFrames;
+                    encoder.compression = compression;
+                    encoder.encode(data, size, frame.size_x, frame.size_y, keyframe, version, packet);
+                    sent = send(packet.data(), packet.size());
+                    written = packet.size();
+                }else{
+                    sent = send(data, size);
+                    written = size;
                 }
             }
-            scan = ImGui::Button("Scan", ImVec2(100, 20));
-            // center the button
-            ImGui::SetCursorPosX((300-100)/2);
-            ImGui::SetCursorPosY(150);
-            first_start = !ImGui::Button("Apply", ImVec2(100, 20));
-            ImGui::End();
+            if(sent){
+                unsent = false;
+                if(demand){
+                    // have the next frame ready by the time the panel asks for it
+                    captureDemand.request();
+                }
+                int64_t now = statsNowUs();
+                if(recorder.isOpen()){
+                    recorder.append(index, data, size, frame.size_x, frame.size_y, frame.format, now);
+                }
+                pipelineStats.serial.record(now - requestUs);
+                pipelineStats.endToEnd.record(now - frame.capturedUs);
+                pipelineStats.sent++;
+                pipelineStats.bytesSent += written;
+                auto end = std::chrono::system_clock::now();
+                std::chrono::duration<double> elapsed_seconds = end - lastStart;
+                // the GUI shows the first panel's
+                if(panel == panels[0].get()){
+                    deltaSerialTime = elapsed_seconds.count() * 1000;
+                }
+                lastStart = std::chrono::system_clock::now();
+            }
         }
-        // Rendering
-        ImGui::Render();
-        int display_w, display_h;
-        glfwGetFramebufferSize(window, &display_w, &display_h);
-        glViewport(0, 0, display_w, display_h);
-        glClear(GL_COLOR_BUFFER_BIT);
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        link.close();
+    }
+}
+
+// SIGINT/SIGTERM stop the pipeline in headless mode
+static void stopHandler(int)
+{
+    running = false;
+}
 
-        glfwSwapBuffers(window);
+int main(int argc, char **argv)
+{
+    RunOptions run = {};
+    if(!parseOptions(argc, argv, run)){
+        return 1;
     }
-#ifdef __EMSCRIPTEN__
-    EMSCRIPTEN_MAINLOOP_END;
+#ifdef HEADLESS
+    // built without GLFW/ImGui, there is nothing else to run
+    run.headless = true;
 #endif
+    for(size_t i = 0; i < run.panels.size(); i++){
+        if(run.headless && strcmp(run.panels[i].port, "Select port") == 0){
+            fprintf(stderr, "Headless mode needs a serial port for every panel, pass --port or set port in the config file\n");
+            return 1;
+        }
+        panels.push_back(std::unique_ptr<Panel>(new Panel));
+        panels.back()->publish(run.panels[i]);
+        panels.back()->linkStats = pipelineStats.addPort(run.panels[i].port);
+    }
 
-    // Cleanup
-    ImGui_ImplOpenGL3_Shutdown();
-    ImGui_ImplGlfw_Shutdown();
-    ImGui::DestroyContext();
-
-    glfwDestroyWindow(window);
-    glfwTerminate();
+    // stats go out on their own thread, see stats.h
+    StatsExporter statsExporter;
+    if(!statsExporter.start(run.statsFile, run.statsSocket)){
+        return 1;
+    }
 
-    return;
-}
+    if(!run.recordFile.empty() && !recorder.open(run.recordFile.c_str())){
+        return 1;
+    }
+    FrameReplay replay;
+    if(!run.replayFile.empty() && !replay.open(run.replayFile.c_str())){
+        return 1;
+    }
 
-int main(int, char **)
-{
     int Width = 0;
     int Height = 0;
-    getSize(Width, Height);
+    getSize(run.source, Width, Height);
     monitor_width = Width;
     monitor_height = Height;
 
-    // start the screenshot thread
-    std::thread screenshotThread(ScreenshotThread);
-    // start the compute thread
-    std::thread computeThread(ComputeThread);
-    // start the serial stream thread
-    std::thread serialThread(SerialThread);
-    // start the imgui thread
-    std::thread imguiThread(guiThread);
+    std::thread screenshotThread;
+    std::thread computeThread;
+    std::thread replayThread;
+    if(run.replayFile.empty()){
+        // start the screenshot thread
+        screenshotThread = std::thread(ScreenshotThread, run.source);
+        // start the compute thread
+        computeThread = std::thread(ComputeThread, run.compute);
+    }else{
+        // a headless replay is done when the recording is
+        replayThread = std::thread(ReplayThread, &replay, run.replayMaxSpeed, run.headless);
+    }
+    // start a serial stream thread per panel
+    std::vector<std::thread> serialThreads;
+    for(size_t i = 0; i < panels.size(); i++){
+        serialThreads.push_back(std::thread(SerialThread, panels[i].get()));
+    }
 
-    // wait for the threads to finish (which they never do unless the program is closed)
-    imguiThread.join();
+    if(run.headless){
+        signal(SIGINT, stopHandler);
+        signal(SIGTERM, stopHandler);
+        // the pipeline threads poll running at least every 100 ms
+        while(running){
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }else{
+#ifndef HEADLESS
+        // the window runs on this thread until it is closed
+        guiThread();
+#endif
+        running = false;
+    }
+
+    if(run.replayFile.empty()){
+        screenshotThread.join();
+        computeThread.join();
+    }else{
+        replayThread.join();
+    }
+    for(size_t i = 0; i < serialThreads.size(); i++){
+        serialThreads[i].join();
+    }
+    recorder.close();
     return 0;
 }
@@ -0,0 +1,431 @@
+#include "options.h"
+#include "streamer.h"
+#include "convert.h"
+#include "el_decode.h"
+#include "serial.h"
+#include "threshold.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+static bool parseInt(const std::string &value, int &out)
+{
+    char *end = nullptr;
+    long v = strtol(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0')
+        return false;
+    out = (int)v;
+    return true;
+}
+
+// "AxB" or "A,B"
+static bool parsePair(const std::string &value, int &a, int &b)
+{
+    size_t split = value.find_first_of("x,");
+    if (split == std::string::npos)
+        return false;
+    return parseInt(value.substr(0, split), a) && parseInt(value.substr(split + 1), b);
+}
+
+static bool parseBool(const std::string &value, bool &out)
+{
+    if (value == "1" || value == "true" || value == "yes" || value == "on")
+        out = true;
+    else if (value == "0" || value == "false" || value == "no" || value == "off")
+        out = false;
+    else
+        return false;
+    return true;
+}
+
+// true if the option takes a value on the command line
+static bool takesValue(const std::string &name)
+{
+    return name != "headless" && name != "fullscreen" && name != "no-delta" && name != "help" && name != "panel";
+}
+
+// the panel the next panel setting applies to
+static PanelSettings &currentPanel(RunOptions &run)
+{
+    return run.panels.empty() ? run.defaults : run.panels.back();
+}
+
+static bool applyOption(const std::string &name, const std::string &value, RunOptions &run)
+{
+    int a = 0;
+    int b = 0;
+    bool flag = true;
+    PanelSettings &panel = currentPanel(run);
+    if (name == "headless")
+    {
+        if (!value.empty() && !parseBool(value, flag))
+            return false;
+        run.headless = flag;
+    }
+    else if (name == "config")
+    {
+        return loadConfig(value.c_str(), run);
+    }
+    else if (name == "threads")
+    {
+        if (!parseInt(value, a) || a < 0 || a > 256)
+            return false;
+        run.compute.threads = a;
+    }
+    else if (name == "cpus")
+    {
+        if (!parseCpuList(value, run.compute.cpus))
+            return false;
+    }
+    else if (name == "stats")
+    {
+        run.statsFile = value;
+    }
+    else if (name == "stats-socket")
+    {
+        run.statsSocket = value;
+    }
+    else if (name == "record")
+    {
+        run.recordFile = value;
+    }
+    else if (name == "replay")
+    {
+        run.replayFile = value;
+    }
+    else if (name == "replay-speed")
+    {
+        if (value == "original")
+            run.replayMaxSpeed = false;
+        else if (value == "max")
+            run.replayMaxSpeed = true;
+        else
+            return false;
+    }
+    else if (name == "source")
+    {
+        if (value == "screen")
+            run.source.kind = SOURCE_SCREEN;
+        else if (value == "pattern")
+            run.source.kind = SOURCE_PATTERN;
+        else if (value == "raw")
+            run.source.kind = SOURCE_RAW;
+        else if (value == "shm")
+            run.source.kind = SOURCE_SHM;
+        else
+            return false;
+    }
+    else if (name == "shm-name")
+    {
+        if (value.empty())
+            return false;
+        run.source.kind = SOURCE_SHM;
+        run.source.shmName = value;
+    }
+    else if (name == "source-size")
+    {
+        if (!parsePair(value, a, b) || a < 1 || b < 1)
+            return false;
+        run.source.width = a;
+        run.source.height = b;
+    }
+    else if (name == "raw-input")
+    {
+        if (value.empty())
+            return false;
+        run.source.kind = SOURCE_RAW;
+        run.source.path = value;
+    }
+    else if (name == "raw-format")
+    {
+        if (value == "bgra")
+            run.source.rawFormat = RAW_BGRA;
+        else if (value == "gray")
+            run.source.rawFormat = RAW_GRAY;
+        else
+            return false;
+    }
+    else if (name == "panel")
+    {
+        // starts from the defaults, only the port has to be different
+        run.panels.push_back(run.defaults);
+    }
+    else if (name == "port")
+    {
+        strncpy(panel.port, value.c_str(), sizeof(panel.port) - 1);
+        panel.port[sizeof(panel.port) - 1] = '\0';
+    }
+    else if (name == "baud")
+    {
+        if (!parseInt(value, a) || a <= 0 || !SerialLink::baudSupported(a))
+            return false;
+        panel.baud = a;
+    }
+    else if (name == "size")
+    {
+        if (!parsePair(value, a, b) || a < 4 || b < 4)
+            return false;
+        // the panel size needs to be a multiple of 4, same as in the GUI
+        panel.x_disp_size = a - a % 4;
+        panel.y_disp_size = b - b % 4;
+    }
+    else if (name == "offset")
+    {
+        if (!parsePair(value, a, b) || a < 0 || b < 0)
+            return false;
+        panel.x_offset = a;
+        panel.y_offset = b;
+    }
+    else if (name == "step")
+    {
+        if (!parsePair(value, a, b) || a < 1 || b < 1)
+            return false;
+        panel.x_step = a;
+        panel.y_step = b;
+    }
+    else if (name == "fullscreen")
+    {
+        if (!value.empty() && !parseBool(value, flag))
+            return false;
+        panel.entireDisp = flag;
+    }
+    else if (name == "bits")
+    {
+        if (!parseInt(value, a) || (a != 1 && a != 2 && a != 4))
+            return false;
+        panel.format.bits = a;
+    }
+    else if (name == "bit-order")
+    {
+        if (value == "msb")
+            panel.format.bitOrder = MSB_FIRST;
+        else if (value == "lsb")
+            panel.format.bitOrder = LSB_FIRST;
+        else
+            return false;
+    }
+    else if (name == "scan")
+    {
+        if (value == "rows")
+            panel.format.scanOrder = SCAN_ROWS;
+        else if (value == "columns")
+            panel.format.scanOrder = SCAN_COLUMNS;
+        else
+            return false;
+    }
+    else if (name == "sampling")
+    {
+        if (value == "point")
+            panel.sampleMode = SAMPLE_POINT;
+        else if (value == "area")
+            panel.sampleMode = SAMPLE_AREA;
+        else
+            return false;
+    }
+    else if (name == "dither")
+    {
+        if (value == "none")
+            panel.ditherMode = DITHER_NONE;
+        else if (value == "bayer")
+            panel.ditherMode = DITHER_BAYER;
+        else if (value == "floyd-steinberg")
+            panel.ditherMode = DITHER_FLOYD_STEINBERG;
+        else if (value == "atkinson")
+            panel.ditherMode = DITHER_ATKINSON;
+        else
+            return false;
+    }
+    else if (name == "auto-threshold")
+    {
+        if (value == "off")
+            panel.autoThreshold = AUTO_THRESHOLD_OFF;
+        else if (value == "otsu")
+            panel.autoThreshold = AUTO_THRESHOLD_OTSU;
+        else if (value == "percentile")
+            panel.autoThreshold = AUTO_THRESHOLD_PERCENTILE;
+        else
+            return false;
+    }
+    else if (name == "high")
+    {
+        if (!parseInt(value, panel.threshHigh))
+            return false;
+    }
+    else if (name == "mid")
+    {
+        if (!parseInt(value, panel.threshMid))
+            return false;
+    }
+    else if (name == "schedule")
+    {
+        if (value == "timed")
+            scheduleMode = SCHEDULE_TIMED;
+        else if (value == "demand")
+            scheduleMode = SCHEDULE_DEMAND;
+        else
+            return false;
+    }
+    else if (name == "fps")
+    {
+        if (!parseInt(value, a) || a < 1)
+            return false;
+        frameRate = a;
+    }
+    else if (name == "delta")
+    {
+        if (!parseBool(value, deltaFrames))
+            return false;
+    }
+    else if (name == "no-delta")
+    {
+        deltaFrames = false;
+    }
+    else if (name == "compression")
+    {
+        if (value == "none")
+            compression = EL_COMPRESS_NONE;
+        else if (value == "packbits")
+            compression = EL_COMPRESS_PACKBITS;
+        else if (value == "rle2")
+            compression = EL_COMPRESS_RLE2;
+        else
+            return false;
+    }
+    else
+    {
+        fprintf(stderr, "Unknown option '%s'\n", name.c_str());
+        return false;
+    }
+    return true;
+}
+
+static std::string trim(const std::string &s)
+{
+    size_t start = s.find_first_not_of(" \t\r\n");
+    if (start == std::string::npos)
+        return "";
+    size_t end = s.find_last_not_of(" \t\r\n");
+    return s.substr(start, end - start + 1);
+}
+
+bool loadConfig(const char *path, RunOptions &run)
+{
+    FILE *file = fopen(path, "r");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "Unable to open config file %s\n", path);
+        return false;
+    }
+    char buffer[512];
+    int line = 0;
+    bool ok = true;
+    while (fgets(buffer, sizeof(buffer), file) != nullptr)
+    {
+        line++;
+        std::string text = trim(buffer);
+        if (text.empty() || text[0] == '#')
+            continue;
+        if (text == "[panel]")
+            text = "panel";
+        size_t split = text.find('=');
+        std::string name = trim(text.substr(0, split));
+        std::string value = split == std::string::npos ? "" : trim(text.substr(split + 1));
+        if (!applyOption(name, value, run))
+        {
+            fprintf(stderr, "%s:%d: bad value for '%s'\n", path, line, name.c_str());
+            ok = false;
+        }
+    }
+    fclose(file);
+    return ok;
+}
+
+bool parseOptions(int argc, char **argv, RunOptions &run)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg.compare(0, 2, "--") != 0)
+        {
+            fprintf(stderr, "Unexpected argument '%s'\n", arg.c_str());
+            printUsage(argv[0]);
+            return false;
+        }
+        std::string name = arg.substr(2);
+        std::string value;
+        size_t split = name.find('=');
+        if (split != std::string::npos)
+        {
+            value = name.substr(split + 1);
+            name = name.substr(0, split);
+        }
+        else if (takesValue(name))
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "Option --%s needs a value\n", name.c_str());
+                return false;
+            }
+            value = argv[++i];
+        }
+        if (name == "help")
+        {
+            printUsage(argv[0]);
+            return false;
+        }
+        if (!applyOption(name, value, run))
+        {
+            fprintf(stderr, "Bad value for --%s\n", name.c_str());
+            return false;
+        }
+    }
+    if (run.panels.empty())
+        run.panels.push_back(run.defaults);
+    return true;
+}
+
+void printUsage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --headless              run without a window until SIGINT/SIGTERM\n"
+            "  --panel                 the options after this are for another panel\n"
+            "  --config FILE           read \"name = value\" options from FILE\n"
+            "  --port PATH             serial port of the panel\n"
+            "  --baud N                link speed, 9600 up to 4000000 (default 115200)\n"
+            "  --size WxH              panel size in pixels (default 320x240)\n"
+            "  --offset X,Y            top left corner of the sampled area\n"
+            "  --step X,Y              screen pixels per panel pixel\n"
+            "  --fullscreen            scale the whole screen onto the panel\n"
+            "  --sampling point|area   pick one pixel or average the whole step cell\n"
+            "  --high N, --mid N       thresholds for full and half brightness\n"
+            "  --auto-threshold off|otsu|percentile\n"
+            "                          pick the thresholds from the content of every frame\n"
+            "  --dither none|bayer|floyd-steinberg|atkinson\n"
+            "                          dither between the 3 levels instead of hard thresholds\n"
+            "  --bits 1|2|4            bits per pixel of the panel's frame buffer (default 2)\n"
+            "  --bit-order msb|lsb     whether the first pixel of a byte is in its top bits\n"
+            "  --scan rows|columns     the order pixels are sent in\n"
+            "  --fps N                 target capture rate (default 30)\n"
+            "  --schedule timed|demand capture every 1/fps, or when a panel asks for a frame\n"
+            "                          (then no frame is sent older than 1/fps)\n"
+            "  --no-delta              only send keyframes to delta capable panels\n"
+            "  --compression none|packbits|rle2\n"
+            "  --threads N             threads converting frames, 0 for one per core (the default)\n"
+            "  --cpus LIST             pin them to these cpus, e.g. 2-5 or 0,2,4\n"
+            "  --stats FILE            write pipeline stats as JSON to FILE every second\n"
+            "  --stats-socket PATH     serve the same JSON on a Unix socket\n"
+            "  --source screen|pattern|raw|shm\n"
+            "                          capture the desktop, a moving test pattern, raw frames\n"
+            "                          or frames another program writes to shared memory\n"
+            "  --source-size WxH       frame size of the pattern and raw sources (default 1280x720)\n"
+            "  --raw-input PATH        read raw frames from PATH, - for stdin (the default)\n"
+            "  --raw-format bgra|gray  4 bytes per pixel, B G R and one unused, or 1\n"
+            "  --shm-name NAME         the shared memory ring to read (default /el_streamer)\n"
+            "  --record FILE           record every frame sent to the panels into FILE\n"
+            "  --replay FILE           send the frames recorded in FILE instead of the screen\n"
+            "  --replay-speed original|max\n"
+            "                          recorded pace, or each frame as soon as the last is sent\n",
+            name);
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "pool.h"
+#include "source.h"
+#include "streamer.h"
+
+// command line and config file handling for the settings in streamer.h
+//
+// every option can be given on the command line as --name value (or
+// --name=value) or in a config file as a "name = value" line, lines
+// starting with # are comments, see printUsage() for the list
+//
+// --panel on the command line, or a [panel] line in a config file, starts
+// the settings of another panel, panel settings given before the first one
+// are the defaults every panel starts from, without any --panel there is
+// just the one panel with those settings
+
+struct RunOptions
+{
+    bool headless;              // no window, run until SIGINT/SIGTERM
+    std::string statsFile;      // where to write pipeline stats every second, see stats.h
+    std::string statsSocket;    // Unix socket that answers with a stats snapshot
+    std::string recordFile;     // append every frame sent to this file, see record.h
+    std::string replayFile;     // send the frames of this recording instead of the screen's
+    bool replayMaxSpeed;        // as fast as the panels take them rather than at the recorded pace
+    SourceOptions source;       // what is captured, the screen by default
+    PoolOptions compute;        // threads that convert the frames
+    PanelSettings defaults;     // panel settings given before the first --panel
+    std::vector<PanelSettings> panels;
+};
+
+// parse argv (and any --config file it names, in order), returns false on
+// bad input after printing what was wrong
+bool parseOptions(int argc, char **argv, RunOptions &run);
+
+// apply every option in a config file
+bool loadConfig(const char *path, RunOptions &run);
+
+void printUsage(const char *name);
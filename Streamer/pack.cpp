@@ -0,0 +1,255 @@
+#include "pack.h"
+#include "pool.h"
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// rows of the frame transposed at a time for SCAN_COLUMNS, keeps the
+// strided reads within a few cache lines
+static const uint TRANSPOSE_ROWS = 32;
+
+bool nativeFormat(const PanelFormat &format)
+{
+    return format.bits == 2 && format.bitOrder == MSB_FIRST && format.scanOrder == SCAN_ROWS;
+}
+
+size_t packedSize(const PanelFormat &format, uint size_x, uint size_y)
+{
+    return ((size_t)size_x * size_y * format.bits + 7) / 8;
+}
+
+static inline uint8_t pixelValue(int bits, uint8_t preview)
+{
+    if (bits == 1)
+        return preview >= 127;
+    if (bits == 2)
+        return (preview >= 127) + (preview >= 254);
+    return preview >> 4;
+}
+
+void packFrameReference(const PanelFormat &format, const uint8_t *preview, uint size_x, uint size_y,
+                        uint8_t *packed)
+{
+    memset(packed, 0, packedSize(format, size_x, size_y));
+    size_t n = (size_t)size_x * size_y;
+    for (size_t k = 0; k < n; k++)
+    {
+        size_t index = format.scanOrder == SCAN_COLUMNS ? (k % size_y) * size_x + k / size_y : k;
+        size_t bit = k * format.bits;
+        int shift = format.bitOrder == LSB_FIRST ? bit % 8 : 8 - format.bits - bit % 8;
+        packed[bit / 8] |= pixelValue(format.bits, preview[index]) << shift;
+    }
+}
+
+// count (at most 8 / Bits) pixels into one byte
+template <int Bits, bool LsbFirst>
+static inline uint8_t packByte(const uint8_t *pixels, int count)
+{
+    uint8_t byte = 0;
+    for (int j = 0; j < count; j++)
+    {
+        byte |= pixelValue(Bits, pixels[j]) << (LsbFirst ? j * Bits : 8 - Bits - j * Bits);
+    }
+    return byte;
+}
+
+#if defined(__SSE2__)
+// preview bytes to pixel values, one per byte
+template <int Bits>
+static inline __m128i pixelValuesSSE2(__m128i preview)
+{
+    if (Bits == 4)
+        return _mm_and_si128(_mm_srli_epi16(preview, 4), _mm_set1_epi8(0x0F));
+    const __m128i one = _mm_set1_epi8(1);
+    // unsigned a >= b is max(a, b) == a
+    __m128i mid = _mm_cmpeq_epi8(_mm_max_epu8(preview, _mm_set1_epi8(127)), preview);
+    __m128i values = _mm_and_si128(mid, one);
+    if (Bits == 2)
+    {
+        __m128i high = _mm_cmpeq_epi8(_mm_max_epu8(preview, _mm_set1_epi8((char)254)), preview);
+        values = _mm_add_epi8(values, _mm_and_si128(high, one));
+    }
+    return values;
+}
+
+// every lane holds two fields of Field bits, one at the bottom of each half,
+// merge them into 2 * Field bits at the bottom of the lane, the first (lower)
+// field ending up in the top bits for MSB first
+template <int Field, bool LsbFirst>
+static inline __m128i merge16(__m128i x)
+{
+    __m128i y = LsbFirst ? _mm_or_si128(x, _mm_srli_epi16(x, 8 - Field))
+                         : _mm_or_si128(_mm_slli_epi16(x, Field), _mm_srli_epi16(x, 8));
+    return _mm_and_si128(y, _mm_set1_epi16((1 << 2 * Field) - 1));
+}
+
+template <int Field, bool LsbFirst>
+static inline __m128i merge32(__m128i x)
+{
+    __m128i y = LsbFirst ? _mm_or_si128(x, _mm_srli_epi32(x, 16 - Field))
+                         : _mm_or_si128(_mm_slli_epi32(x, Field), _mm_srli_epi32(x, 16));
+    return _mm_and_si128(y, _mm_set1_epi32((1 << 2 * Field) - 1));
+}
+
+template <int Field, bool LsbFirst>
+static inline __m128i merge64(__m128i x)
+{
+    __m128i y = LsbFirst ? _mm_or_si128(x, _mm_srli_epi64(x, 32 - Field))
+                         : _mm_or_si128(_mm_slli_epi64(x, Field), _mm_srli_epi64(x, 32));
+    return _mm_and_si128(y, _mm_set1_epi64x(((int64_t)1 << 2 * Field) - 1));
+}
+
+// bytes in 32 bit lanes (the rest of the lane 0) of four vectors into one
+static inline __m128i gather32(__m128i a, __m128i b, __m128i c, __m128i d)
+{
+    return _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+}
+
+// 16 packed bytes from 16 * 8 / Bits pixels
+template <int Bits, bool LsbFirst>
+static inline void packBlockSSE2(const uint8_t *pixels, uint8_t *packed)
+{
+    const int vectors = 8 / Bits;
+    __m128i v[8];
+    for (int k = 0; k < vectors; k++)
+    {
+        v[k] = merge16<Bits, LsbFirst>(pixelValuesSSE2<Bits>(_mm_loadu_si128((const __m128i *)(pixels + k * 16))));
+        if (Bits <= 2)
+            v[k] = merge32<Bits * 2, LsbFirst>(v[k]);
+        if (Bits == 1)
+            v[k] = merge64<Bits * 4, LsbFirst>(v[k]);
+    }
+    __m128i out;
+    if (Bits == 4)
+    {
+        out = _mm_packus_epi16(v[0], v[1]);
+    }
+    else if (Bits == 2)
+    {
+        out = gather32(v[0], v[1], v[2], v[3]);
+    }
+    else
+    {
+        // the upper half of a 64 bit lane is 0, so packing pairs of them
+        // leaves one byte per 32 bit lane
+        out = gather32(_mm_packs_epi32(v[0], v[1]), _mm_packs_epi32(v[2], v[3]),
+                       _mm_packs_epi32(v[4], v[5]), _mm_packs_epi32(v[6], v[7]));
+    }
+    _mm_storeu_si128((__m128i *)packed, out);
+}
+#endif
+
+// n pixels in scan order into a bit stream
+template <int Bits, bool LsbFirst>
+static void packLinear(const uint8_t *pixels, size_t n, uint8_t *packed)
+{
+    const int perByte = 8 / Bits;
+    size_t bytes = n / perByte;
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= bytes; i += 16)
+    {
+        packBlockSSE2<Bits, LsbFirst>(pixels + i * perByte, packed + i);
+    }
+#endif
+    for (; i < bytes; i++)
+    {
+        packed[i] = packByte<Bits, LsbFirst>(pixels + i * perByte, perByte);
+    }
+    if (n % perByte != 0)
+        packed[bytes] = packByte<Bits, LsbFirst>(pixels + bytes * perByte, n % perByte);
+}
+
+template <int Bits, bool LsbFirst, bool ColumnMajor>
+static void packFrame(const uint8_t *preview, uint size_x, uint size_y, uint8_t *packed,
+                      std::vector<uint8_t> &scratch)
+{
+    size_t n = (size_t)size_x * size_y;
+    const uint8_t *pixels = preview;
+    if (ColumnMajor)
+    {
+        // turn the columns into rows, then it packs like any row major frame
+        scratch.resize(n);
+        for (uint y0 = 0; y0 < size_y; y0 += TRANSPOSE_ROWS)
+        {
+            uint y1 = y0 + TRANSPOSE_ROWS < size_y ? y0 + TRANSPOSE_ROWS : size_y;
+            for (uint x = 0; x < size_x; x++)
+            {
+                for (uint y = y0; y < y1; y++)
+                {
+                    scratch[(size_t)x * size_y + y] = preview[(size_t)y * size_x + x];
+                }
+            }
+        }
+        pixels = &scratch[0];
+    }
+    packLinear<Bits, LsbFirst>(pixels, n, packed);
+}
+
+struct Packer
+{
+    int bits;
+    int bitOrder;
+    int scanOrder;
+    PackFn pack;
+    const char *name;
+};
+
+static const Packer packers[] = {
+    {1, MSB_FIRST, SCAN_ROWS, packFrame<1, false, false>, "1bpp MSB rows"},
+    {1, LSB_FIRST, SCAN_ROWS, packFrame<1, true, false>, "1bpp LSB rows"},
+    {1, MSB_FIRST, SCAN_COLUMNS, packFrame<1, false, true>, "1bpp MSB columns"},
+    {1, LSB_FIRST, SCAN_COLUMNS, packFrame<1, true, true>, "1bpp LSB columns"},
+    {2, MSB_FIRST, SCAN_ROWS, packFrame<2, false, false>, "2bpp MSB rows"},
+    {2, LSB_FIRST, SCAN_ROWS, packFrame<2, true, false>, "2bpp LSB rows"},
+    {2, MSB_FIRST, SCAN_COLUMNS, packFrame<2, false, true>, "2bpp MSB columns"},
+    {2, LSB_FIRST, SCAN_COLUMNS, packFrame<2, true, true>, "2bpp LSB columns"},
+    {4, MSB_FIRST, SCAN_ROWS, packFrame<4, false, false>, "4bpp MSB rows"},
+    {4, LSB_FIRST, SCAN_ROWS, packFrame<4, true, false>, "4bpp LSB rows"},
+    {4, MSB_FIRST, SCAN_COLUMNS, packFrame<4, false, true>, "4bpp MSB columns"},
+    {4, LSB_FIRST, SCAN_COLUMNS, packFrame<4, true, true>, "4bpp LSB columns"},
+};
+
+static const Packer *findPacker(const PanelFormat &format)
+{
+    for (size_t i = 0; i < sizeof(packers) / sizeof(packers[0]); i++)
+    {
+        const Packer &p = packers[i];
+        if (p.bits == format.bits && p.bitOrder == format.bitOrder && p.scanOrder == format.scanOrder)
+            return &p;
+    }
+    return nullptr;
+}
+
+PackFn selectPacker(const PanelFormat &format)
+{
+    const Packer *p = findPacker(format);
+    return p != nullptr ? p->pack : nullptr;
+}
+
+void packTiles(const PanelFormat &format, PackFn pack, const uint8_t *preview, uint size_x, uint size_y,
+               uint8_t *packed, WorkerPool &pool, std::vector<std::vector<uint8_t>> &scratch)
+{
+    if (scratch.size() < (size_t)pool.size())
+        scratch.resize(pool.size());
+    bool rowTiled = format.scanOrder == SCAN_ROWS && (size_t)size_x * format.bits % 8 == 0;
+    if (!rowTiled)
+    {
+        pack(preview, size_x, size_y, packed, scratch[0]);
+        return;
+    }
+    size_t rowBytes = (size_t)size_x * format.bits / 8;
+    int tiles = rowTiles(size_y, pool.size());
+    pool.run(tiles, [&](int tile, int thread) {
+        uint y0 = size_y * tile / tiles;
+        uint y1 = size_y * (tile + 1) / tiles;
+        pack(preview + (size_t)y0 * size_x, size_x, y1 - y0, packed + y0 * rowBytes, scratch[thread]);
+    });
+}
+
+const char *formatName(const PanelFormat &format)
+{
+    const Packer *p = findPacker(format);
+    return p != nullptr ? p->name : "unknown";
+}
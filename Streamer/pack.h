@@ -0,0 +1,66 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <sys/types.h>
+
+class WorkerPool;
+
+// frame buffer layouts of other panels
+// the EL panel takes 2 bits per pixel, first pixel in the top bits, row
+// after row, and convertFrame() writes that straight into the frame, any
+// other layout is packed from the preview by one of the packers here, one
+// specialisation per layout, the preview holds level * 127 per pixel, or
+// gray * 17 from grayFrame() for 4 bit panels
+//
+// the frame is a single bit stream, a row (or column) that doesn't fill its
+// last byte continues in the same byte, the very last byte is padded with 0
+// levels map to a pixel value by bit depth:
+//   1 bit:  on for level 1 and 2, so threshMid is the threshold
+//   2 bits: the level
+//   4 bits: the top 4 bits, the gray for grayFrame()
+
+enum BitOrder
+{
+    MSB_FIRST = 0,              // first pixel in the top bits of a byte
+    LSB_FIRST = 1,
+};
+
+enum ScanOrder
+{
+    SCAN_ROWS = 0,              // left to right, then top to bottom
+    SCAN_COLUMNS = 1,           // top to bottom, then left to right
+};
+
+struct PanelFormat
+{
+    int bits;                   // 1, 2 or 4
+    int bitOrder;               // BitOrder
+    int scanOrder;              // ScanOrder
+};
+
+// what convertFrame() already produces
+bool nativeFormat(const PanelFormat &format);
+
+// bytes in a size_x by size_y frame
+size_t packedSize(const PanelFormat &format, uint size_x, uint size_y);
+
+// scratch holds the transposed frame for SCAN_COLUMNS
+typedef void (*PackFn)(const uint8_t *preview, uint size_x, uint size_y, uint8_t *packed,
+                       std::vector<uint8_t> &scratch);
+
+// one pixel at a time, the specialised packers must match it bit for bit
+void packFrameReference(const PanelFormat &format, const uint8_t *preview, uint size_x, uint size_y,
+                        uint8_t *packed);
+
+// the packer for format, nullptr for bit depths other than 1, 2 and 4
+PackFn selectPacker(const PanelFormat &format);
+
+// pack (the packer for format) on the threads of pool, in row tiles if the
+// format scans rows and a row fills whole bytes, a tile then packs like a
+// frame of its own, otherwise as one job, scratch is one per thread of pool
+void packTiles(const PanelFormat &format, PackFn pack, const uint8_t *preview, uint size_x, uint size_y,
+               uint8_t *packed, WorkerPool &pool, std::vector<std::vector<uint8_t>> &scratch);
+
+// "2bpp MSB rows" and so on
+const char *formatName(const PanelFormat &format);
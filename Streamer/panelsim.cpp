@@ -0,0 +1,614 @@
+// simulated EL panel on a pseudo-terminal, built with `make panelsim`
+// the streamer opens the pty like the port of a real panel, the simulator
+// asks for frames at a fixed rate the way the firmware does, decodes them
+// into its framebuffer and checks every one, so the serial path can be
+// soak tested and timed without a device:
+//   el_panelsim --link /tmp/el_panel --size 320x240 --rate 30 --protocol delta
+//   el_streamer_headless --port /tmp/el_panel --size 320x240 --source pattern
+// a frame fails if it is cut short, holds a pixel above level 2 (the EL
+// panel only has 3) or, with the delta protocol, does not decode or match
+// its checksum, the exit status is 1 if any frame failed
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+#include "protocol.h"
+#include "stats.h"
+
+struct SimOptions
+{
+    std::string link;           // symlink to the pty for the streamer's --port, empty for none
+    unsigned size_x;
+    unsigned size_y;
+    double rate;                // requests per second, 0 to ask again as soon as a frame is in
+    bool delta;                 // 'D'/'K' requests instead of the magic symbol
+    int version;                // protocol version sent with 'D'/'K'
+    char magic;                 // magic_symbol of the streamer
+    int timeoutMs;              // ask again if a frame is not in by then
+    double duration;            // seconds, 0 to run until SIGINT/SIGTERM
+    double reportEvery;         // seconds between progress lines
+    std::string jsonPath;       // final (and periodic) stats as JSON
+    std::string imagePath;      // the framebuffer as a PGM
+
+    SimOptions()
+        : link("/tmp/el_panel"), size_x(320), size_y(240), rate(30), delta(false), version(PROTOCOL_VERSION),
+          magic('A'), timeoutMs(1000), duration(0), reportEvery(1)
+    {
+    }
+};
+
+struct SimStats
+{
+    LatencyHistogram firstByte; // request until the first byte of the answer
+    LatencyHistogram frame;     // request until the whole frame is in
+    LatencyHistogram interval;  // between consecutive frames
+
+    uint64_t requests;
+    uint64_t frames;            // frames that passed every check
+    uint64_t keyframes;
+    uint64_t deltas;
+    uint64_t changed;           // frames that differ from the one before
+    uint64_t bytes;             // bytes of frames that passed
+    uint64_t timeouts;          // requests that got no answer at all
+    uint64_t unrequested;       // bytes that came while no request was open
+    uint64_t sequenceGaps;      // delta frames the streamer sent but we never saw
+
+    // frames that failed
+    uint64_t shortFrames;       // only part of a frame before the timeout
+    uint64_t badLevels;
+    uint64_t decodeErrors;
+    uint64_t checksumErrors;
+    uint64_t geometryErrors;
+
+    SimStats()
+        : requests(0), frames(0), keyframes(0), deltas(0), changed(0), bytes(0), timeouts(0), unrequested(0),
+          sequenceGaps(0), shortFrames(0), badLevels(0), decodeErrors(0), checksumErrors(0), geometryErrors(0)
+    {
+    }
+
+    uint64_t failed() const
+    {
+        return shortFrames + badLevels + decodeErrors + checksumErrors + geometryErrors + sequenceGaps;
+    }
+};
+
+static volatile sig_atomic_t stopping = 0;
+
+static void stopHandler(int)
+{
+    stopping = 1;
+}
+
+static void printUsage(const char *name)
+{
+    printf("Usage: %s [options]\n", name);
+    printf("  --link PATH         symlink to the pty for the streamer's --port (default /tmp/el_panel)\n");
+    printf("  --size WxH          panel size (default 320x240)\n");
+    printf("  --rate FPS          frames asked for per second, 0 for back to back (default 30)\n");
+    printf("  --protocol raw|delta  the magic symbol or 'D'/'K' requests (default raw)\n");
+    printf("  --version N         protocol version sent with delta requests (default %d)\n", PROTOCOL_VERSION);
+    printf("  --magic C           request byte of the raw protocol (default A)\n");
+    printf("  --timeout MS        ask again if a frame is not in by then (default 1000)\n");
+    printf("  --duration S        stop after S seconds, 0 to run until SIGINT/SIGTERM (default 0)\n");
+    printf("  --report S          seconds between progress lines (default 1)\n");
+    printf("  --json FILE         write the stats as JSON to FILE at every report and at the end\n");
+    printf("  --image FILE        write the framebuffer as a PGM to FILE at every report and at the end\n");
+}
+
+static bool parseSimOptions(int argc, char **argv, SimOptions &options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const char *name = argv[i];
+        if (strcmp(name, "--help") == 0)
+        {
+            printUsage(argv[0]);
+            exit(0);
+        }
+        if (i + 1 >= argc)
+        {
+            fprintf(stderr, "Unknown option or missing value: %s\n", name);
+            return false;
+        }
+        const char *value = argv[++i];
+        char *end = nullptr;
+        bool ok = true;
+        if (strcmp(name, "--link") == 0)
+        {
+            options.link = value;
+        }
+        else if (strcmp(name, "--size") == 0)
+        {
+            ok = sscanf(value, "%ux%u", &options.size_x, &options.size_y) == 2 && options.size_x > 0 &&
+                 options.size_y > 0 && options.size_x <= 65535 && options.size_y <= 65535 &&
+                 options.size_x * options.size_y % 4 == 0;
+        }
+        else if (strcmp(name, "--rate") == 0)
+        {
+            options.rate = strtod(value, &end);
+            ok = *end == '\0' && options.rate >= 0;
+        }
+        else if (strcmp(name, "--protocol") == 0)
+        {
+            ok = strcmp(value, "raw") == 0 || strcmp(value, "delta") == 0;
+            options.delta = strcmp(value, "delta") == 0;
+        }
+        else if (strcmp(name, "--version") == 0)
+        {
+            options.version = (int)strtol(value, &end, 10);
+            ok = *end == '\0' && options.version >= 1 && options.version <= 255;
+        }
+        else if (strcmp(name, "--magic") == 0)
+        {
+            options.magic = value[0];
+            ok = strlen(value) == 1;
+        }
+        else if (strcmp(name, "--timeout") == 0)
+        {
+            options.timeoutMs = (int)strtol(value, &end, 10);
+            ok = *end == '\0' && options.timeoutMs > 0;
+        }
+        else if (strcmp(name, "--duration") == 0)
+        {
+            options.duration = strtod(value, &end);
+            ok = *end == '\0' && options.duration >= 0;
+        }
+        else if (strcmp(name, "--report") == 0)
+        {
+            options.reportEvery = strtod(value, &end);
+            ok = *end == '\0' && options.reportEvery > 0;
+        }
+        else if (strcmp(name, "--json") == 0)
+        {
+            options.jsonPath = value;
+        }
+        else if (strcmp(name, "--image") == 0)
+        {
+            options.imagePath = value;
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option: %s\n", name);
+            return false;
+        }
+        if (!ok)
+        {
+            fprintf(stderr, "Bad value for %s: %s\n", name, value);
+            return false;
+        }
+    }
+    return true;
+}
+
+// the master end of a new pty, the slave end is set raw and kept open so the
+// master doesn't see a hangup every time the streamer closes the port
+static int openPanelPty(int &slave, std::string &slaveName)
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0)
+        return -1;
+    const char *name = nullptr;
+    if (grantpt(master) != 0 || unlockpt(master) != 0 || (name = ptsname(master)) == nullptr)
+    {
+        close(master);
+        return -1;
+    }
+    slaveName = name;
+    slave = open(name, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    termios options;
+    if (slave < 0 || tcgetattr(slave, &options) != 0)
+    {
+        if (slave >= 0)
+            close(slave);
+        close(master);
+        return -1;
+    }
+    cfmakeraw(&options);
+    tcsetattr(slave, TCSANOW, &options);
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+    fcntl(master, F_SETFD, FD_CLOEXEC);
+    return master;
+}
+
+// replaces a stale symlink, but never anything else
+static bool linkPty(const std::string &link, const std::string &slaveName)
+{
+    struct stat info;
+    if (lstat(link.c_str(), &info) == 0)
+    {
+        if (!S_ISLNK(info.st_mode))
+        {
+            fprintf(stderr, "Not replacing %s, it is not a symlink\n", link.c_str());
+            return false;
+        }
+        unlink(link.c_str());
+    }
+    if (symlink(slaveName.c_str(), link.c_str()) != 0)
+    {
+        fprintf(stderr, "Unable to link %s to %s: %s\n", link.c_str(), slaveName.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// any pixel at level 3, which the streamer never sends to the EL panel
+static bool hasBadLevels(const uint8_t *fb, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        if (fb[i] & (fb[i] >> 1) & 0x55)
+            return true;
+    }
+    return false;
+}
+
+// replaced atomically so a viewer never reads half an image
+static void writeImage(const std::string &path, const std::vector<uint8_t> &fb, unsigned size_x, unsigned size_y)
+{
+    std::string temp = path + ".tmp";
+    FILE *file = fopen(temp.c_str(), "wb");
+    if (file == nullptr)
+        return;
+    fprintf(file, "P5\n%u %u\n255\n", size_x, size_y);
+    std::vector<uint8_t> row(size_x);
+    for (unsigned y = 0; y < size_y; y++)
+    {
+        for (unsigned x = 0; x < size_x; x++)
+        {
+            size_t pixel = (size_t)y * size_x + x;
+            // the same gray as the streamer's preview, level * 127
+            row[x] = ((fb[pixel / 4] >> (6 - 2 * (pixel % 4))) & 3) * 127;
+        }
+        fwrite(row.data(), 1, size_x, file);
+    }
+    fclose(file);
+    rename(temp.c_str(), path.c_str());
+}
+
+static void appendHistogram(std::string &out, const char *name, const LatencyHistogram &h)
+{
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer),
+             "\"%s\": {\"count\": %llu, \"mean_us\": %.1f, \"p50_us\": %lld, \"p95_us\": %lld, "
+             "\"p99_us\": %lld, \"max_us\": %lld}",
+             name, (unsigned long long)h.count(), h.mean(), (long long)h.percentile(50),
+             (long long)h.percentile(95), (long long)h.percentile(99), (long long)h.max());
+    out += buffer;
+}
+
+static void writeJson(const std::string &path, const SimStats &stats, double seconds)
+{
+    char buffer[1024];
+    snprintf(buffer, sizeof(buffer),
+             "{\"elapsed_s\": %.3f, \"fps\": %.2f, \"kb_per_s\": %.1f, \"requests\": %llu, \"frames\": %llu, "
+             "\"keyframes\": %llu, \"deltas\": %llu, \"changed\": %llu, \"bytes\": %llu, \"timeouts\": %llu, "
+             "\"unrequested_bytes\": %llu, \"failed\": %llu, \"short_frames\": %llu, \"bad_levels\": %llu, "
+             "\"decode_errors\": %llu, \"checksum_errors\": %llu, \"geometry_errors\": %llu, "
+             "\"sequence_gaps\": %llu, ",
+             seconds, seconds > 0 ? stats.frames / seconds : 0, seconds > 0 ? stats.bytes / seconds / 1024 : 0,
+             (unsigned long long)stats.requests, (unsigned long long)stats.frames,
+             (unsigned long long)stats.keyframes, (unsigned long long)stats.deltas,
+             (unsigned long long)stats.changed, (unsigned long long)stats.bytes,
+             (unsigned long long)stats.timeouts, (unsigned long long)stats.unrequested,
+             (unsigned long long)stats.failed(), (unsigned long long)stats.shortFrames,
+             (unsigned long long)stats.badLevels, (unsigned long long)stats.decodeErrors,
+             (unsigned long long)stats.checksumErrors, (unsigned long long)stats.geometryErrors,
+             (unsigned long long)stats.sequenceGaps);
+    std::string out = buffer;
+    appendHistogram(out, "first_byte", stats.firstByte);
+    out += ", ";
+    appendHistogram(out, "frame", stats.frame);
+    out += ", ";
+    appendHistogram(out, "interval", stats.interval);
+    out += "}\n";
+    std::string temp = path + ".tmp";
+    FILE *file = fopen(temp.c_str(), "w");
+    if (file == nullptr)
+        return;
+    fputs(out.c_str(), file);
+    fclose(file);
+    rename(temp.c_str(), path.c_str());
+}
+
+// one panel asking for frames, everything happens on the calling thread
+class PanelSimulator
+{
+public:
+    PanelSimulator(const SimOptions &options, int fd)
+        : fb(options.size_x * options.size_y / 4, 0), options(options), fd(fd), waiting(false),
+          needKeyframe(true), haveSequence(false), sequence(0), requestUs(0), firstByteUs(0), lastFrameUs(0)
+    {
+    }
+
+    SimStats stats;
+    std::vector<uint8_t> fb;
+
+    void request(int64_t now)
+    {
+        char bytes[2] = {options.magic, (char)options.version};
+        size_t size = 1;
+        if (options.delta)
+        {
+            bytes[0] = needKeyframe ? REQUEST_KEYFRAME : REQUEST_DELTA;
+            size = 2;
+        }
+        // a couple of bytes always fit, a full pty buffer means nobody reads them
+        if (write(fd, bytes, size) != (ssize_t)size)
+            return;
+        stats.requests++;
+        received.clear();
+        waiting = true;
+        requestUs = now;
+        firstByteUs = 0;
+    }
+
+    // false once the pty is gone
+    bool receive(int64_t now)
+    {
+        uint8_t chunk[65536];
+        size_t got = 0;
+        while (true)
+        {
+            ssize_t n = read(fd, chunk, sizeof(chunk));
+            if (n > 0)
+            {
+                got += n;
+                if (waiting)
+                    received.insert(received.end(), chunk, chunk + n);
+                else
+                    stats.unrequested += n;
+                continue;
+            }
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && (errno == EAGAIN || errno == EIO))
+                break;
+            return false;
+        }
+        if (got == 0 || !waiting)
+        {
+            // we can't tell which frame the streamer thinks we have
+            if (got > 0)
+                needKeyframe = true;
+            return true;
+        }
+        if (firstByteUs == 0)
+        {
+            firstByteUs = now;
+            stats.firstByte.record(now - requestUs);
+        }
+        if (options.delta)
+            decodePacket(now);
+        else if (received.size() >= fb.size())
+            acceptRaw(now);
+        return true;
+    }
+
+    // ask again if the answer is overdue, a frame that only came in part failed
+    void checkTimeout(int64_t now)
+    {
+        if (!waiting || now - requestUs < (int64_t)options.timeoutMs * 1000)
+            return;
+        waiting = false;
+        if (received.empty())
+        {
+            stats.timeouts++;
+        }
+        else
+        {
+            stats.shortFrames++;
+            needKeyframe = true;
+            haveSequence = false;
+        }
+    }
+
+    bool isWaiting() const { return waiting; }
+    int64_t requestedUs() const { return requestUs; }
+
+private:
+    void acceptRaw(int64_t now)
+    {
+        stats.unrequested += received.size() - fb.size();
+        bool changed = memcmp(received.data(), fb.data(), fb.size()) != 0;
+        memcpy(fb.data(), received.data(), fb.size());
+        finish(now, fb.size(), changed);
+    }
+
+    // a packet is only complete once it decodes, so every read that leaves
+    // it truncated is tried again with what came since
+    void decodePacket(int64_t now)
+    {
+        if (received.size() < FRAME_HEADER_SIZE)
+            return;
+        decoded = fb;
+        int result = el_apply_packet(received.data(), received.size(), decoded.data(), (uint16_t)options.size_x,
+                                     (uint16_t)options.size_y);
+        if (result == EL_ERR_TRUNCATED)
+            return;
+        if (result != EL_OK)
+        {
+            if (result == EL_ERR_CHECKSUM)
+                stats.checksumErrors++;
+            else if (result == EL_ERR_GEOMETRY)
+                stats.geometryErrors++;
+            else
+                stats.decodeErrors++;
+            waiting = false;
+            needKeyframe = true;
+            haveSequence = false;
+            return;
+        }
+        bool key = (received[3] & 0x0F) == FRAME_KEY;
+        uint16_t number = (uint16_t)(received[4] | received[5] << 8);
+        if (key)
+            stats.keyframes++;
+        else
+            stats.deltas++;
+        // every request gets a new number, a delta after a skipped one was
+        // computed against a frame we never had
+        if (!key && haveSequence && number != (uint16_t)(sequence + 1))
+            stats.sequenceGaps++;
+        sequence = number;
+        haveSequence = true;
+        bool changed = decoded != fb;
+        fb.swap(decoded);
+        finish(now, received.size(), changed);
+    }
+
+    void finish(int64_t now, size_t bytes, bool changed)
+    {
+        waiting = false;
+        if (hasBadLevels(fb.data(), fb.size()))
+        {
+            stats.badLevels++;
+            needKeyframe = true;
+            return;
+        }
+        needKeyframe = false;
+        stats.frames++;
+        stats.bytes += bytes;
+        if (changed)
+            stats.changed++;
+        stats.frame.record(now - requestUs);
+        if (lastFrameUs != 0)
+            stats.interval.record(now - lastFrameUs);
+        lastFrameUs = now;
+    }
+
+    const SimOptions &options;
+    int fd;
+    std::vector<uint8_t> received;  // the answer to the open request so far
+    std::vector<uint8_t> decoded;   // fb with the packet applied, kept if it checks out
+    bool waiting;                   // a request is open
+    bool needKeyframe;              // ask with 'K', after boot and after anything went wrong
+    bool haveSequence;
+    uint16_t sequence;              // of the last packet taken
+    int64_t requestUs;
+    int64_t firstByteUs;
+    int64_t lastFrameUs;
+};
+
+int main(int argc, char **argv)
+{
+    SimOptions options;
+    if (!parseSimOptions(argc, argv, options))
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+    int slave = -1;
+    std::string slaveName;
+    int fd = openPanelPty(slave, slaveName);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Unable to open a pseudo-terminal: %s\n", strerror(errno));
+        return 1;
+    }
+    bool linked = !options.link.empty() && linkPty(options.link, slaveName);
+    if (!options.link.empty() && !linked)
+        return 1;
+    printf("Panel %ux%u on %s%s%s, %s requests\n", options.size_x, options.size_y, slaveName.c_str(),
+           linked ? " linked from " : "", linked ? options.link.c_str() : "", options.delta ? "delta" : "raw");
+    fflush(stdout);
+    signal(SIGINT, stopHandler);
+    signal(SIGTERM, stopHandler);
+
+    PanelSimulator panel(options, fd);
+    const int64_t startUs = statsNowUs();
+    const int64_t periodUs = options.rate > 0 ? (int64_t)(1e6 / options.rate) : 0;
+    const int64_t reportUs = (int64_t)(options.reportEvery * 1e6);
+    const int64_t endUs = options.duration > 0 ? startUs + (int64_t)(options.duration * 1e6) : 0;
+    int64_t nextRequestUs = startUs;
+    int64_t nextReportUs = startUs + reportUs;
+    uint64_t reportedFrames = 0;
+    uint64_t reportedBytes = 0;
+    bool lost = false;
+    while (!stopping)
+    {
+        int64_t now = statsNowUs();
+        if (endUs != 0 && now >= endUs)
+            break;
+        panel.checkTimeout(now);
+        if (!panel.isWaiting() && now >= nextRequestUs)
+        {
+            panel.request(now);
+            // the next one no earlier than a period after this one, but
+            // right away if the answer takes longer than that
+            nextRequestUs = now + periodUs;
+        }
+        if (now >= nextReportUs)
+        {
+            double seconds = (now - nextReportUs + reportUs) / 1e6;
+            const SimStats &s = panel.stats;
+            printf("%.1f fps, %.1f KB/s, frame p50 %.2f ms p99 %.2f ms, %llu timeouts, %llu failed\n",
+                   (s.frames - reportedFrames) / seconds, (s.bytes - reportedBytes) / seconds / 1024,
+                   s.frame.percentile(50) / 1000.0, s.frame.percentile(99) / 1000.0,
+                   (unsigned long long)s.timeouts, (unsigned long long)s.failed());
+            fflush(stdout);
+            reportedFrames = s.frames;
+            reportedBytes = s.bytes;
+            nextReportUs = now + reportUs;
+            if (!options.jsonPath.empty())
+                writeJson(options.jsonPath, s, (now - startUs) / 1e6);
+            if (!options.imagePath.empty())
+                writeImage(options.imagePath, panel.fb, options.size_x, options.size_y);
+        }
+        // sleep until there is something to read or to do
+        int64_t wakeUs = nextReportUs;
+        if (panel.isWaiting())
+            wakeUs = std::min(wakeUs, panel.requestedUs() + (int64_t)options.timeoutMs * 1000);
+        else
+            wakeUs = std::min(wakeUs, nextRequestUs);
+        if (endUs != 0)
+            wakeUs = std::min(wakeUs, endUs);
+        int64_t waitUs = wakeUs - statsNowUs();
+        pollfd p = {fd, POLLIN, 0};
+        int ready = poll(&p, 1, waitUs > 0 ? (int)((waitUs + 999) / 1000) : 0);
+        if (ready < 0 && errno != EINTR)
+        {
+            lost = true;
+            break;
+        }
+        if (ready > 0 && !panel.receive(statsNowUs()))
+        {
+            lost = true;
+            break;
+        }
+    }
+    double seconds = (statsNowUs() - startUs) / 1e6;
+    const SimStats &s = panel.stats;
+    if (lost)
+        fprintf(stderr, "Lost the pseudo-terminal: %s\n", strerror(errno));
+    printf("%llu frames in %.1f s (%.1f fps), %llu keyframes, %llu deltas, %llu changed, %llu bytes (%.1f KB/s)\n",
+           (unsigned long long)s.frames, seconds, seconds > 0 ? s.frames / seconds : 0,
+           (unsigned long long)s.keyframes, (unsigned long long)s.deltas, (unsigned long long)s.changed,
+           (unsigned long long)s.bytes, seconds > 0 ? s.bytes / seconds / 1024 : 0);
+    printf("latency first byte p50 %.2f ms p99 %.2f ms, frame p50 %.2f ms p99 %.2f ms max %.2f ms\n",
+           s.firstByte.percentile(50) / 1000.0, s.firstByte.percentile(99) / 1000.0, s.frame.percentile(50) / 1000.0,
+           s.frame.percentile(99) / 1000.0, s.frame.max() / 1000.0);
+    printf("%llu requests, %llu timeouts, %llu unrequested bytes, %llu failed (%llu short, %llu bad levels, "
+           "%llu decode, %llu checksum, %llu geometry, %llu sequence gaps)\n",
+           (unsigned long long)s.requests, (unsigned long long)s.timeouts, (unsigned long long)s.unrequested,
+           (unsigned long long)s.failed(), (unsigned long long)s.shortFrames, (unsigned long long)s.badLevels,
+           (unsigned long long)s.decodeErrors, (unsigned long long)s.checksumErrors,
+           (unsigned long long)s.geometryErrors, (unsigned long long)s.sequenceGaps);
+    if (!options.jsonPath.empty())
+        writeJson(options.jsonPath, s, seconds);
+    if (!options.imagePath.empty())
+        writeImage(options.imagePath, panel.fb, options.size_x, options.size_y);
+    if (linked)
+        unlink(options.link.c_str());
+    close(fd);
+    close(slave);
+    return s.failed() > 0 || lost ? 1 : 0;
+}
@@ -0,0 +1,251 @@
+#include "pool.h"
+#include <cstdio>
+#include <cstdlib>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+static uint64_t makeRange(uint32_t begin, uint32_t end)
+{
+    return begin | (uint64_t)end << 32;
+}
+
+static uint32_t rangeBegin(uint64_t range)
+{
+    return (uint32_t)range;
+}
+
+static uint32_t rangeEnd(uint64_t range)
+{
+    return (uint32_t)(range >> 32);
+}
+
+WorkerPool::WorkerPool(int threads, const std::vector<int> &cpus)
+    : cpus(cpus), batch(nullptr), batchSize(0), batchInOrder(false), generation(0), next(0), pending(0),
+      busy(0), steals(0), stop(false)
+{
+    if (threads <= 0)
+        threads = std::thread::hardware_concurrency();
+    if (threads <= 0)
+        threads = 1;
+    shares.reset(new Share[threads]);
+    for (int t = 0; t < threads; t++)
+        shares[t].range.store(0);
+    pin(0);
+    for (int t = 1; t < threads; t++)
+        workers.push_back(std::thread(&WorkerPool::workerLoop, this, t));
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+}
+
+// the calling thread, which is thread 0 while the pool is made
+void WorkerPool::pin(int thread)
+{
+    if (cpus.empty())
+        return;
+    int cpu = cpus[thread % cpus.size()];
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0)
+        return;
+#endif
+    fprintf(stderr, "Pool: unable to pin thread %d to cpu %d\n", thread, cpu);
+}
+
+void WorkerPool::start(int count, const Job &job, bool inOrder)
+{
+    if (count <= 0)
+        return;
+    if (workers.empty() || count == 1)
+    {
+        for (int i = 0; i < count; i++)
+            job(i, 0);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        batch = &job;
+        batchSize = count;
+        batchInOrder = inOrder;
+        pending = count;
+        next = 0;
+        int threads = size();
+        for (int t = 0; t < threads; t++)
+        {
+            uint32_t begin = inOrder ? 0 : (uint32_t)((int64_t)count * t / threads);
+            uint32_t end = inOrder ? 0 : (uint32_t)((int64_t)count * (t + 1) / threads);
+            shares[t].range.store(makeRange(begin, end), std::memory_order_relaxed);
+        }
+        generation++;
+    }
+    wake.notify_all();
+    int done = work(job, count, inOrder, 0);
+    std::unique_lock<std::mutex> lock(mutex);
+    pending -= done;
+    // wait for the workers to leave too, so none of them can pick up a job
+    // of the next batch with this batch's function
+    finished.wait(lock, [this] { return pending == 0 && busy == 0; });
+    batch = nullptr;
+}
+
+// run jobs until the batch runs dry
+int WorkerPool::work(const Job &job, int count, bool inOrder, int thread)
+{
+    int done = 0;
+    int i;
+    if (inOrder)
+    {
+        while ((i = next.fetch_add(1)) < count)
+        {
+            job(i, thread);
+            done++;
+        }
+        return done;
+    }
+    while (take(thread, i) || steal(thread, i))
+    {
+        job(i, thread);
+        done++;
+    }
+    return done;
+}
+
+// the front job of our own share
+bool WorkerPool::take(int thread, int &i)
+{
+    std::atomic<uint64_t> &range = shares[thread].range;
+    uint64_t r = range.load(std::memory_order_acquire);
+    while (rangeBegin(r) < rangeEnd(r))
+    {
+        if (range.compare_exchange_weak(r, makeRange(rangeBegin(r) + 1, rangeEnd(r)), std::memory_order_acq_rel))
+        {
+            i = (int)rangeBegin(r);
+            return true;
+        }
+    }
+    return false;
+}
+
+// the back half of the largest share left, its first job is ours to run
+// and the rest becomes our share, owners only ever take from the front so
+// a share that changed under us is simply looked at again
+bool WorkerPool::steal(int thread, int &i)
+{
+    int threads = size();
+    while (true)
+    {
+        int victim = -1;
+        uint64_t seen = 0;
+        uint32_t most = 0;
+        for (int t = 0; t < threads; t++)
+        {
+            if (t == thread)
+                continue;
+            uint64_t r = shares[t].range.load(std::memory_order_acquire);
+            if (rangeBegin(r) < rangeEnd(r) && rangeEnd(r) - rangeBegin(r) > most)
+            {
+                most = rangeEnd(r) - rangeBegin(r);
+                victim = t;
+                seen = r;
+            }
+        }
+        if (victim < 0)
+            return false;
+        uint32_t middle = rangeBegin(seen) + most / 2;
+        if (!shares[victim].range.compare_exchange_strong(seen, makeRange(rangeBegin(seen), middle),
+                                                          std::memory_order_acq_rel))
+            continue;
+        steals += rangeEnd(seen) - middle;
+        // nobody steals from an empty share, so ours is free to overwrite
+        shares[thread].range.store(makeRange(middle + 1, rangeEnd(seen)), std::memory_order_release);
+        i = (int)middle;
+        return true;
+    }
+}
+
+void WorkerPool::workerLoop(int thread)
+{
+    pin(thread);
+    unsigned long seen = 0;
+    while (true)
+    {
+        const Job *job;
+        int count;
+        bool inOrder;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this, seen] { return stop || (generation != seen && batch != nullptr); });
+            if (stop)
+                return;
+            seen = generation;
+            job = batch;
+            count = batchSize;
+            inOrder = batchInOrder;
+            busy++;
+        }
+        int done = work(*job, count, inOrder, thread);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending -= done;
+            busy--;
+            if (pending == 0 && busy == 0)
+                finished.notify_one();
+        }
+    }
+}
+
+int rowTiles(unsigned rows, int threads)
+{
+    if (threads <= 1 || rows <= MIN_TILE_ROWS)
+        return 1;
+    unsigned most = rows / MIN_TILE_ROWS;
+    unsigned tiles = (unsigned)threads * TILES_PER_THREAD;
+    return (int)(tiles < most ? tiles : most);
+}
+
+bool parseCpuList(const std::string &text, std::vector<int> &cpus)
+{
+    std::vector<int> list;
+    size_t at = 0;
+    while (at <= text.size())
+    {
+        size_t comma = text.find(',', at);
+        std::string item = text.substr(at, comma == std::string::npos ? std::string::npos : comma - at);
+        size_t dash = item.find('-');
+        char *end = nullptr;
+        long first = strtol(item.c_str(), &end, 10);
+        if (item.empty() || end == item.c_str() || first < 0 || (*end != '\0' && *end != '-'))
+            return false;
+        long last = first;
+        if (dash != std::string::npos)
+        {
+            const char *rest = item.c_str() + dash + 1;
+            last = strtol(rest, &end, 10);
+            if (end == rest || *end != '\0' || last < first)
+                return false;
+        }
+        if (last >= 4096)
+            return false;
+        for (long cpu = first; cpu <= last; cpu++)
+            list.push_back((int)cpu);
+        if (comma == std::string::npos)
+            break;
+        at = comma + 1;
+    }
+    if (list.empty())
+        return false;
+    cpus.swap(list);
+    return true;
+}
@@ -0,0 +1,122 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// a fixed set of worker threads that split a batch of independent jobs
+// (row tiles of a frame) between them, the calling thread helps out and
+// run() only returns once every job of the batch is done
+//
+// run() deals every thread a contiguous share of the jobs up front, a thread
+// that is through its share steals the back half of the largest one left,
+// so neighbouring tiles stay on one core and a slow or busy core doesn't
+// hold up the batch
+// runInOrder() hands the jobs out one at a time in index order instead, for
+// jobs that wait on the one before them
+// the callable is only referred to while the batch runs, a batch allocates
+// nothing, which a std::function holding a lambda's captures would
+class WorkerPool
+{
+public:
+    // job i of the batch, run by thread t of size(), the caller is thread 0
+    struct Job
+    {
+        void (*call)(const void *fn, int i, int t);
+        const void *fn;
+
+        void operator()(int i, int t) const { call(fn, i, t); }
+    };
+
+    // 0 threads means one per core, the calling thread counts as one of them
+    // cpus, unless empty, pins thread t to cpus[t % cpus.size()], the
+    // calling thread included
+    explicit WorkerPool(int threads = 0, const std::vector<int> &cpus = std::vector<int>());
+    ~WorkerPool();
+
+    // number of threads working on a batch, including the caller
+    int size() const { return (int)workers.size() + 1; }
+
+    // calls fn(i, t) for every i in [0, count)
+    template <typename Fn>
+    void run(int count, const Fn &fn)
+    {
+        start(count, jobFor(fn), false);
+    }
+    template <typename Fn>
+    void runInOrder(int count, const Fn &fn)
+    {
+        start(count, jobFor(fn), true);
+    }
+
+    // jobs that ran on another thread than the one they were dealt to
+    unsigned long stolen() const { return steals.load(); }
+
+private:
+    // [begin, end) of the jobs dealt to a thread, as begin | end << 32,
+    // a cache line each so owners and thieves don't slow each other down
+    struct Share
+    {
+        std::atomic<uint64_t> range;
+        char padding[64 - sizeof(std::atomic<uint64_t>)];
+    };
+
+    template <typename Fn>
+    static void invoke(const void *fn, int i, int t)
+    {
+        (*(const Fn *)fn)(i, t);
+    }
+    template <typename Fn>
+    static Job jobFor(const Fn &fn)
+    {
+        Job job = {&invoke<Fn>, &fn};
+        return job;
+    }
+
+    void start(int count, const Job &job, bool inOrder);
+    void workerLoop(int thread);
+    void pin(int thread);
+    // returns the number of jobs this thread finished
+    int work(const Job &job, int count, bool inOrder, int thread);
+    bool take(int thread, int &i);
+    bool steal(int thread, int &i);
+
+    std::vector<std::thread> workers;
+    std::vector<int> cpus;
+    std::unique_ptr<Share[]> shares;    // one per thread
+    std::mutex mutex;
+    std::condition_variable wake;       // a new batch is ready
+    std::condition_variable finished;   // the last job of a batch is done
+    const Job *batch;
+    int batchSize;
+    bool batchInOrder;
+    unsigned long generation;           // bumped for every batch
+    std::atomic<int> next;              // next job to hand out in order
+    int pending;                        // jobs not finished yet
+    int busy;                           // workers still inside the batch
+    std::atomic<unsigned long> steals;
+    bool stop;
+};
+
+// jobs to split rows into for a pool of threads: a few per thread, so
+// stealing can even out a thread that falls behind, but no tile under
+// MIN_TILE_ROWS rows where the per job overhead would start to show
+static const int TILES_PER_THREAD = 4;
+static const unsigned MIN_TILE_ROWS = 8;
+int rowTiles(unsigned rows, int threads);
+
+// what --threads and --cpus ask of the compute pool
+struct PoolOptions
+{
+    int threads;                // 0 for one per core
+    std::vector<int> cpus;      // empty to leave the threads unpinned
+
+    PoolOptions() : threads(0) {}
+};
+
+// "0-3,6,8-9", false if it isn't a list of cpus
+bool parseCpuList(const std::string &text, std::vector<int> &cpus);
@@ -0,0 +1,228 @@
+#include "ports.h"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <memory>
+#include <poll.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+// device names that can be a panel, USB CDC (the EL panel's firmware) and
+// USB serial adapters
+static const char *const candidatePrefixes[] = {"ttyACM", "ttyUSB", "tty.usb", "cu.usb"};
+
+// udev fixes up a new node's permissions shortly after it appears
+static const int HOTPLUG_SETTLE_MS = 300;
+
+static bool isCandidate(const char *name)
+{
+    for (size_t i = 0; i < sizeof(candidatePrefixes) / sizeof(candidatePrefixes[0]); i++)
+    {
+        if (strncmp(name, candidatePrefixes[i], strlen(candidatePrefixes[i])) == 0)
+            return true;
+    }
+    return false;
+}
+
+static std::string readLine(const std::string &path)
+{
+    FILE *file = fopen(path.c_str(), "r");
+    if (file == nullptr)
+        return "";
+    char buffer[256] = {0};
+    if (fgets(buffer, sizeof(buffer), file) == nullptr)
+        buffer[0] = '\0';
+    fclose(file);
+    buffer[strcspn(buffer, "\r\n")] = '\0';
+    return buffer;
+}
+
+#ifdef __linux__
+// the USB device a tty belongs to is a few levels above its sysfs device
+// (the interface for ttyACM, the interface's port for ttyUSB)
+static void readUsbInfo(const char *name, PortInfo &info)
+{
+    std::string link = std::string("/sys/class/tty/") + name + "/device";
+    char resolved[PATH_MAX];
+    if (realpath(link.c_str(), resolved) == nullptr)
+        return;
+    std::string dir = resolved;
+    for (int level = 0; level < 4 && dir.size() > 1; level++)
+    {
+        std::string vid = readLine(dir + "/idVendor");
+        if (!vid.empty())
+        {
+            info.vid = strtoul(vid.c_str(), nullptr, 16);
+            info.pid = strtoul(readLine(dir + "/idProduct").c_str(), nullptr, 16);
+            info.product = readLine(dir + "/product");
+            return;
+        }
+        dir = dir.substr(0, dir.rfind('/'));
+    }
+}
+#endif
+
+static std::vector<PortInfo> candidates()
+{
+    std::vector<PortInfo> list;
+#ifdef __linux__
+    // sysfs only lists ttys a driver registered, unlike /dev it has no
+    // leftovers from devices that are gone
+    const char *directory = "/sys/class/tty";
+#else
+    const char *directory = "/dev";
+#endif
+    DIR *dir = opendir(directory);
+    if (dir == nullptr)
+        return list;
+    while (dirent *entry = readdir(dir))
+    {
+        if (!isCandidate(entry->d_name))
+            continue;
+        PortInfo info;
+        info.path = std::string("/dev/") + entry->d_name;
+        info.vid = 0;
+        info.pid = 0;
+        info.available = false;
+#ifdef __linux__
+        readUsbInfo(entry->d_name, info);
+#endif
+        list.push_back(info);
+    }
+    closedir(dir);
+    std::sort(list.begin(), list.end(), [](const PortInfo &a, const PortInfo &b) { return a.path < b.path; });
+    return list;
+}
+
+// shared with the probe's thread, which may outlive the scan that started it
+struct Probe
+{
+    std::string path;
+    std::atomic<int> state;     // 0 still opening, 1 opened, 2 failed
+
+    Probe() : state(0) {}
+};
+
+std::vector<PortInfo> PortScanner::scan(int timeoutMs)
+{
+    std::vector<PortInfo> list = candidates();
+    std::vector<std::shared_ptr<Probe>> probes;
+    for (size_t i = 0; i < list.size(); i++)
+    {
+        std::shared_ptr<Probe> probe(new Probe);
+        probe->path = list[i].path;
+        probes.push_back(probe);
+        // only opened, not configured, a port a panel thread is using
+        // keeps its settings
+        std::thread([probe]() {
+            int fd = ::open(probe->path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+            if (fd >= 0)
+                ::close(fd);
+            probe->state = fd >= 0 ? 1 : 2;
+        }).detach();
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    for (size_t i = 0; i < probes.size(); i++)
+    {
+        while (probes[i]->state == 0 && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        list[i].available = probes[i]->state == 1;
+    }
+    return list;
+}
+
+PortScanner::PortScanner() : scans(0), busy(false), requested(false), stopping(false) {}
+
+PortScanner::~PortScanner()
+{
+    stop();
+}
+
+void PortScanner::start()
+{
+    if (thread.joinable())
+        return;
+    stopping = false;
+    requested = true;
+    thread = std::thread(&PortScanner::loop, this);
+}
+
+void PortScanner::stop()
+{
+    stopping = true;
+    if (thread.joinable())
+        thread.join();
+}
+
+void PortScanner::rescan()
+{
+    requested = true;
+}
+
+std::vector<PortInfo> PortScanner::ports() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return found;
+}
+
+void PortScanner::loop()
+{
+    int watch = -1;
+#ifdef __linux__
+    watch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch >= 0 && inotify_add_watch(watch, "/dev", IN_CREATE | IN_DELETE) < 0)
+    {
+        ::close(watch);
+        watch = -1;
+    }
+#endif
+    while (!stopping)
+    {
+        if (requested.exchange(false))
+        {
+            busy = true;
+            std::vector<PortInfo> list = scan(PROBE_TIMEOUT_MS);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                found.swap(list);
+            }
+            scans++;
+            busy = false;
+        }
+        // wake up at least every 100 ms for stop() and rescan()
+        if (watch < 0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+#ifdef __linux__
+        pollfd p = {watch, POLLIN, 0};
+        if (poll(&p, 1, 100) <= 0)
+            continue;
+        char buffer[4096] __attribute__((aligned(__alignof__(inotify_event))));
+        ssize_t n = read(watch, buffer, sizeof(buffer));
+        bool hotplug = false;
+        for (char *at = buffer; n > 0 && at < buffer + n;)
+        {
+            const inotify_event *event = (const inotify_event *)at;
+            if (event->len > 0 && isCandidate(event->name))
+                hotplug = true;
+            at += sizeof(inotify_event) + event->len;
+        }
+        if (hotplug)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(HOTPLUG_SETTLE_MS));
+            requested = true;
+        }
+#endif
+    }
+    if (watch >= 0)
+        ::close(watch);
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// a serial port that might have a panel on it
+struct PortInfo
+{
+    std::string path;           // e.g. /dev/ttyACM0
+    std::string product;        // USB product string, empty if unknown
+    unsigned vid;               // USB vendor and product id, 0 if not USB
+    unsigned pid;
+    bool available;             // could be opened when it was probed
+};
+
+// finds serial ports on its own thread so the GUI never waits for it
+// candidates are the ttyACM* and ttyUSB* devices listed in sysfs (a plain
+// look at /dev elsewhere), all of them are probed at once and a probe that
+// hasn't returned after PROBE_TIMEOUT_MS counts as not available
+// /dev is watched for ttys coming and going (inotify on Linux), every change
+// starts a new scan, in between ports() answers from the last one
+class PortScanner
+{
+public:
+    static const int PROBE_TIMEOUT_MS = 500;
+
+    PortScanner();
+    ~PortScanner();
+
+    // scans right away, then again on every hotplug or rescan()
+    void start();
+    void stop();
+    void rescan();
+
+    // the result of the last finished scan, sorted by path
+    std::vector<PortInfo> ports() const;
+    // counts finished scans, a new value means ports() may have changed
+    unsigned generation() const { return scans.load(); }
+    bool scanning() const { return busy.load(); }
+
+    // one scan on the calling thread
+    static std::vector<PortInfo> scan(int timeoutMs);
+
+private:
+    void loop();
+
+    mutable std::mutex mutex;
+    std::vector<PortInfo> found;
+    std::atomic<unsigned> scans;
+    std::atomic<bool> busy;
+    std::atomic<bool> requested;
+    std::atomic<bool> stopping;
+    std::thread thread;
+};
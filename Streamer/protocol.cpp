@@ -0,0 +1,118 @@
+#include "protocol.h"
+#include "compress.h"
+#include <cstring>
+
+// changes are looked for in blocks of this many bytes (32 pixels)
+static const size_t TILE_BYTES = 8;
+
+static void put16(std::vector<uint8_t> &out, uint16_t v)
+{
+    out.push_back(v & 0xFF);
+    out.push_back(v >> 8);
+}
+
+static void put32(std::vector<uint8_t> &out, uint32_t v)
+{
+    put16(out, v & 0xFFFF);
+    put16(out, v >> 16);
+}
+
+DeltaEncoder::DeltaEncoder(unsigned keyframeInterval)
+    : keyframeInterval(keyframeInterval), compression(EL_COMPRESS_NONE), refSizeX(0), refSizeY(0), sinceKeyframe(0), sequence(0)
+{
+}
+
+void DeltaEncoder::reset()
+{
+    reference.clear();
+}
+
+void DeltaEncoder::writeHeader(std::vector<uint8_t> &out, int version, uint8_t type, uint size_x, uint size_y,
+                               uint16_t spans, uint16_t checksum)
+{
+    out.push_back('E');
+    out.push_back('L');
+    out.push_back(version);
+    out.push_back(type);
+    put16(out, sequence++);
+    put16(out, size_x);
+    put16(out, size_y);
+    put16(out, spans);
+    put16(out, checksum);
+}
+
+bool DeltaEncoder::findSpans(const uint8_t *frame, size_t size)
+{
+    spans.clear();
+    size_t offset = 0;
+    while (offset < size)
+    {
+        // skip over unchanged tiles
+        size_t len = size - offset < TILE_BYTES ? size - offset : TILE_BYTES;
+        if (memcmp(frame + offset, &reference[offset], len) == 0)
+        {
+            offset += len;
+            continue;
+        }
+        // the span runs from the first changed byte to the last, over clean
+        // gaps no longer than a span header since sending them is cheaper
+        // than starting a new span
+        size_t start = offset;
+        while (frame[start] == reference[start])
+            start++;
+        size_t end = start + 1;
+        for (size_t at = end; at < size && at - start < 0xFFFF && at - end <= SPAN_HEADER_SIZE; at++)
+        {
+            if (frame[at] != reference[at])
+                end = at + 1;
+        }
+        if (spans.size() == 0xFFFF)
+            return false;
+        spans.push_back(std::make_pair(start, end));
+        offset = end;
+    }
+    return true;
+}
+
+void DeltaEncoder::encode(const uint8_t *frame, size_t size, uint size_x, uint size_y, bool keyframe,
+                          int version, std::vector<uint8_t> &out)
+{
+    out.clear();
+    if (version > PROTOCOL_VERSION)
+        version = PROTOCOL_VERSION;
+    // version 1 panels only know uncompressed payloads
+    int method = version >= 2 ? compression : EL_COMPRESS_NONE;
+    uint16_t checksum = el_fletcher16(frame, size);
+    if (reference.size() != size || refSizeX != size_x || refSizeY != size_y ||
+        sinceKeyframe + 1 >= keyframeInterval)
+    {
+        keyframe = true;
+    }
+    // a frame too fragmented to describe goes out whole, decided before
+    // the header takes a sequence number
+    if (!keyframe && !findSpans(frame, size))
+        keyframe = true;
+
+    if (keyframe)
+    {
+        writeHeader(out, version, FRAME_KEY | (method << 4), size_x, size_y, 0, checksum);
+        compress(method, frame, size, out);
+        reference.assign(frame, frame + size);
+        refSizeX = size_x;
+        refSizeY = size_y;
+        sinceKeyframe = 0;
+        return;
+    }
+
+    writeHeader(out, version, FRAME_DELTA | (method << 4), size_x, size_y, (uint16_t)spans.size(), checksum);
+    for (size_t i = 0; i < spans.size(); i++)
+    {
+        size_t start = spans[i].first;
+        size_t length = spans[i].second - start;
+        put32(out, start);
+        put16(out, length);
+        compress(method, frame + start, length, out);
+        memcpy(&reference[start], frame + start, length);
+    }
+    sinceKeyframe++;
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include <sys/types.h>
+#include "el_decode.h"
+
+// wire protocol between the streamer and the panel
+//
+// the panel asks for every frame with a single request byte:
+//   'A' (magic_symbol)   legacy firmware, answered with the raw packed frame
+//   'D' <version>        the panel understands delta frames up to <version>,
+//                        answered with a frame in min(<version>, PROTOCOL_VERSION)
+//   'K' <version>        same as 'D' but forces a keyframe, the panel sends
+//                        this after boot or when its checksum did not match
+// a 'D' implicitly acknowledges the frame sent before it, so the next delta is
+// computed against that frame
+//
+// version 1 frame, all fields little endian:
+//   0  'E' 'L'
+//   2  u8  version
+//   3  u8  type, FRAME_KEY or FRAME_DELTA in the low nibble
+//   4  u16 sequence number, +1 for every frame
+//   6  u16 size_x
+//   8  u16 size_y
+//   10 u16 number of spans (0 for a keyframe)
+//   12 u16 fletcher-16 of the whole packed frame after applying this one
+//   14 payload
+// keyframe payload: the raw packed frame, size_x * size_y / 4 bytes
+// delta payload: spans of changed bytes, each
+//   u32 byte offset into the packed frame, u16 length, <length> bytes
+// a panel whose geometry does not match size_x/size_y must ask for 'K'
+// the header carries no pixel format, packets are only sent for frames of 2
+// bits per pixel (size_x * size_y / 4 bytes, in any bit or scan order), a 1
+// or 4 bit panel gets the raw packed frame for 'D' and 'K' just like for 'A'
+//
+// version 2 adds payload compression, bits 4-5 of the type byte hold the
+// EL_COMPRESS_ method, the keyframe payload and the data of every span are
+// compressed on their own and decode to exactly the frame size / span length
+//
+// el_decode.c is a reference decoder in plain C for the firmware side
+
+const char REQUEST_DELTA = 'D';
+const char REQUEST_KEYFRAME = 'K';
+const uint8_t PROTOCOL_VERSION = 2;
+const size_t FRAME_HEADER_SIZE = EL_HEADER_SIZE;
+const size_t SPAN_HEADER_SIZE = EL_SPAN_HEADER_SIZE;
+
+enum FrameType
+{
+    FRAME_KEY = EL_FRAME_KEY,
+    FRAME_DELTA = EL_FRAME_DELTA,
+};
+
+// turns packed frames into keyframes and deltas against the last frame sent
+class DeltaEncoder
+{
+public:
+    // a keyframe goes out at least every keyframeInterval frames
+    explicit DeltaEncoder(unsigned keyframeInterval = 300);
+
+    // forget the last frame, the next one will be a keyframe
+    void reset();
+
+    // encode one packed frame into out (cleared first) for a panel speaking
+    // the given protocol version, as a keyframe if asked to, if there is
+    // nothing to diff against, or if it is time for one
+    void encode(const uint8_t *frame, size_t size, uint size_x, uint size_y, bool keyframe,
+                int version, std::vector<uint8_t> &out);
+
+    unsigned keyframeInterval;
+    int compression;                    // EL_COMPRESS_ method, used from version 2 on
+
+private:
+    void writeHeader(std::vector<uint8_t> &out, int version, uint8_t type, uint size_x, uint size_y,
+                     uint16_t spans, uint16_t checksum);
+    // fills spans with the changes against reference, false if there are
+    // more than a packet can describe
+    bool findSpans(const uint8_t *frame, size_t size);
+
+    std::vector<uint8_t> reference;     // what the panel shows right now
+    std::vector<std::pair<size_t, size_t>> spans;   // [start, end) of the changes in the next delta
+    uint refSizeX;
+    uint refSizeY;
+    unsigned sinceKeyframe;
+    uint16_t sequence;
+};
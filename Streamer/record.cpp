@@ -0,0 +1,195 @@
+#include "record.h"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// the file grows this much at a time, about 10 s of a 1024x768 panel at 30 fps
+static const size_t GROW_STEP = 64 << 20;
+
+static size_t padded(size_t bytes)
+{
+    return (bytes + 7) & ~(size_t)7;
+}
+
+FrameRecorder::FrameRecorder() : fd(-1), map(nullptr), mapped(0), used(0) {}
+
+FrameRecorder::~FrameRecorder()
+{
+    close();
+}
+
+bool FrameRecorder::open(const char *path)
+{
+    close();
+    std::lock_guard<std::mutex> lock(mutex);
+    fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        perror("Record");
+        return false;
+    }
+    if (!grow(sizeof(RECORD_MAGIC)))
+    {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    memcpy(map, RECORD_MAGIC, sizeof(RECORD_MAGIC));
+    used = sizeof(RECORD_MAGIC);
+    return true;
+}
+
+void FrameRecorder::close()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (fd < 0)
+        return;
+    if (map != nullptr)
+        munmap(map, mapped);
+    if (ftruncate(fd, used) != 0)
+        perror("Record");
+    ::close(fd);
+    fd = -1;
+    map = nullptr;
+    mapped = 0;
+    used = 0;
+}
+
+bool FrameRecorder::grow(size_t needed)
+{
+    if (used + needed <= mapped)
+        return true;
+    size_t size = mapped + GROW_STEP;
+    while (size < used + needed)
+        size += GROW_STEP;
+    // the new tail reads as zeros, which is also the end marker
+    if (ftruncate(fd, size) != 0)
+    {
+        perror("Record");
+        return false;
+    }
+    if (map != nullptr)
+        munmap(map, mapped);
+    map = (uint8_t *)mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        perror("Record");
+        map = nullptr;
+        mapped = 0;
+        return false;
+    }
+    mapped = size;
+    return true;
+}
+
+PanelFormat RecordHeader::format() const
+{
+    PanelFormat format = {bits, bitOrder, scanOrder};
+    return format;
+}
+
+bool FrameRecorder::append(uint32_t panel, const uint8_t *data, uint32_t bytes, uint32_t size_x,
+                           uint32_t size_y, const PanelFormat &format, int64_t timeUs)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (fd < 0 || map == nullptr)
+        return false;
+    size_t record = sizeof(RecordHeader) + padded(bytes);
+    if (!grow(record))
+        return false;
+    RecordHeader header;
+    memset(&header, 0, sizeof(header));
+    header.timeUs = timeUs;
+    header.panel = panel;
+    header.size_x = size_x;
+    header.size_y = size_y;
+    header.bytes = bytes;
+    header.bits = (uint8_t)format.bits;
+    header.bitOrder = (uint8_t)format.bitOrder;
+    header.scanOrder = (uint8_t)format.scanOrder;
+    memcpy(map + used, &header, sizeof(header));
+    memcpy(map + used + sizeof(header), data, bytes);
+    used += record;
+    return true;
+}
+
+FrameReplay::FrameReplay() : fd(-1), map(nullptr), size(0), offset(0) {}
+
+FrameReplay::~FrameReplay()
+{
+    close();
+}
+
+bool FrameReplay::open(const char *path)
+{
+    close();
+    fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        perror("Replay");
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(RECORD_MAGIC))
+    {
+        fprintf(stderr, "Replay: %s is not a recording\n", path);
+        close();
+        return false;
+    }
+    size = info.st_size;
+    map = (const uint8_t *)mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        perror("Replay");
+        map = nullptr;
+        close();
+        return false;
+    }
+    if (memcmp(map, RECORD_MAGIC, sizeof(RECORD_MAGIC)) != 0)
+    {
+        if (memcmp(map, RECORD_MAGIC, 5) == 0)
+            fprintf(stderr, "Replay: %s was recorded in another layout (%.3s), record it again\n", path,
+                    (const char *)map + 5);
+        else
+            fprintf(stderr, "Replay: %s is not a recording\n", path);
+        close();
+        return false;
+    }
+    // read front to back once, let the kernel read ahead
+    madvise((void *)map, size, MADV_SEQUENTIAL);
+    offset = sizeof(RECORD_MAGIC);
+    return true;
+}
+
+void FrameReplay::close()
+{
+    if (map != nullptr)
+        munmap((void *)map, size);
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+    map = nullptr;
+    size = 0;
+    offset = 0;
+}
+
+bool FrameReplay::next(RecordHeader &header, const uint8_t *&data)
+{
+    if (map == nullptr || offset + sizeof(RecordHeader) > size)
+        return false;
+    memcpy(&header, map + offset, sizeof(header));
+    if (header.bytes == 0 || header.bytes > size - offset - sizeof(RecordHeader))
+        return false;
+    data = map + offset + sizeof(RecordHeader);
+    offset += sizeof(RecordHeader) + padded(header.bytes);
+    return true;
+}
+
+void FrameReplay::rewind()
+{
+    if (map != nullptr)
+        offset = sizeof(RECORD_MAGIC);
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include "pack.h"
+
+// recordings of what was sent to the panels, for debugging firmware and for
+// replaying a real session into a panel or the benchmark
+//
+// file layout: the 8 byte RECORD_MAGIC, then one RecordHeader followed by
+// the frame as it was sent, packed in the header's format, per frame sent,
+// every record padded to a multiple of 8 bytes so headers stay aligned in
+// the mapping, a zeroed header ends the file (left behind if the recorder
+// never got to close it)
+
+// the last 3 characters are the version of the layout
+static const char RECORD_MAGIC[8] = {'E', 'L', 'R', 'E', 'C', '0', '0', '2'};
+
+struct RecordHeader
+{
+    int64_t timeUs;     // statsNowUs() when the frame went out
+    uint32_t panel;     // index into panels
+    uint32_t size_x;
+    uint32_t size_y;
+    uint32_t bytes;     // packed frame bytes that follow
+    uint8_t bits;       // the PanelFormat the frame was packed in
+    uint8_t bitOrder;
+    uint8_t scanOrder;
+    uint8_t unused[5];  // zero, keeps the header a multiple of 8 bytes
+
+    PanelFormat format() const;
+};
+
+// appends to a file mapped into memory, the mapping grows in large steps so
+// appending is a memcpy, any number of serial threads can share one
+class FrameRecorder
+{
+public:
+    FrameRecorder();
+    ~FrameRecorder();
+
+    // truncates path
+    bool open(const char *path);
+    // cuts the file down to what was recorded
+    void close();
+    bool isOpen() const { return fd >= 0; }
+
+    // false once the file can't grow any more, the recording stops there
+    bool append(uint32_t panel, const uint8_t *data, uint32_t bytes, uint32_t size_x, uint32_t size_y,
+                const PanelFormat &format, int64_t timeUs);
+
+private:
+    bool grow(size_t needed);
+
+    std::mutex mutex;
+    int fd;
+    uint8_t *map;
+    size_t mapped;      // bytes mapped, the file is this long until close()
+    size_t used;
+};
+
+// reads a recording mapped read-only, frames are handed out as pointers into
+// the mapping so nothing is copied
+class FrameReplay
+{
+public:
+    FrameReplay();
+    ~FrameReplay();
+
+    bool open(const char *path);
+    void close();
+
+    // the next frame, data stays valid until close(), false at the end of
+    // the recording (or at the first record that doesn't fit in the file)
+    bool next(RecordHeader &header, const uint8_t *&data);
+    // back to the first frame
+    void rewind();
+
+private:
+    int fd;
+    const uint8_t *map;
+    size_t size;
+    size_t offset;
+};
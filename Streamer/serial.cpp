@@ -0,0 +1,189 @@
+#include "serial.h"
+#include <cerrno>
+#include <chrono>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+// bytes handed to the driver per write() call
+static const size_t WRITE_CHUNK = 4096;
+
+struct BaudRate
+{
+    unsigned baud;
+    speed_t speed;
+};
+
+static const BaudRate baudRates[] = {
+    {9600, B9600},
+    {19200, B19200},
+    {38400, B38400},
+    {57600, B57600},
+    {115200, B115200},
+    {230400, B230400},
+#ifdef B460800
+    {460800, B460800},
+#endif
+#ifdef B921600
+    {921600, B921600},
+#endif
+#ifdef B1000000
+    {1000000, B1000000},
+#endif
+#ifdef B1500000
+    {1500000, B1500000},
+#endif
+#ifdef B2000000
+    {2000000, B2000000},
+#endif
+#ifdef B3000000
+    {3000000, B3000000},
+#endif
+#ifdef B4000000
+    {4000000, B4000000},
+#endif
+};
+
+static bool speedOf(unsigned baud, speed_t &speed)
+{
+    for (size_t i = 0; i < sizeof(baudRates) / sizeof(baudRates[0]); i++)
+    {
+        if (baudRates[i].baud == baud)
+        {
+            speed = baudRates[i].speed;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SerialLink::baudSupported(unsigned baud)
+{
+    speed_t speed;
+    return speedOf(baud, speed);
+}
+
+SerialLink::SerialLink() : fd(-1) {}
+
+SerialLink::~SerialLink()
+{
+    close();
+}
+
+int SerialLink::open(const char *path, unsigned baud)
+{
+    close();
+    speed_t speed;
+    if (!speedOf(baud, speed))
+        return -2;
+    fd = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    termios options;
+    if (tcgetattr(fd, &options) != 0)
+    {
+        close();
+        return -3;
+    }
+    cfmakeraw(&options);
+    options.c_cflag |= CLOCAL | CREAD;
+    options.c_cflag &= ~CRTSCTS;
+    // reads never wait in the driver, poll() does the waiting
+    options.c_cc[VMIN] = 0;
+    options.c_cc[VTIME] = 0;
+    cfsetispeed(&options, speed);
+    cfsetospeed(&options, speed);
+    if (tcsetattr(fd, TCSANOW, &options) != 0)
+    {
+        close();
+        return -3;
+    }
+    tcflush(fd, TCIOFLUSH);
+    return 1;
+}
+
+void SerialLink::close()
+{
+    if (fd >= 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+// 1 if fd is ready for events, 0 on timeout, -1 if the port went away
+static int waitFor(int fd, short events, int timeoutMs)
+{
+    pollfd p = {fd, events, 0};
+    int ready;
+    do
+    {
+        ready = poll(&p, 1, timeoutMs);
+    } while (ready < 0 && errno == EINTR);
+    if (ready < 0)
+        return -1;
+    if (ready == 0)
+        return 0;
+    // data that arrived before a hangup can still be read
+    if (p.revents & events)
+        return 1;
+    return -1;
+}
+
+int SerialLink::readByte(char &c, int timeoutMs)
+{
+    if (fd < 0)
+        return -1;
+    int ready = waitFor(fd, POLLIN, timeoutMs);
+    if (ready <= 0)
+        return ready;
+    ssize_t n = ::read(fd, &c, 1);
+    if (n == 1)
+        return 1;
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        return 0;
+    // readable but nothing there means the other end is gone
+    return -1;
+}
+
+int SerialLink::write(const uint8_t *data, size_t size, int timeoutMs)
+{
+    if (fd < 0)
+        return -1;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (size > 0)
+    {
+        ssize_t n = ::write(fd, data, size < WRITE_CHUNK ? size : WRITE_CHUNK);
+        if (n > 0)
+        {
+            data += n;
+            size -= n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && errno != EAGAIN)
+            return -1;
+        // the driver's buffer is full, wait until it drained some
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (left.count() <= 0)
+            return 0;
+        int ready = waitFor(fd, POLLOUT, (int)left.count());
+        if (ready <= 0)
+            return ready;
+    }
+    return 1;
+}
+
+void SerialLink::flushInput()
+{
+    if (fd >= 0)
+        tcflush(fd, TCIFLUSH);
+}
+
+void SerialLink::flushOutput()
+{
+    if (fd >= 0)
+        tcflush(fd, TCOFLUSH);
+}
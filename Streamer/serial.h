@@ -0,0 +1,40 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// raw serial port on a non-blocking termios fd, every wait goes through
+// poll() so nothing blocks longer than the timeout it was given
+// works with anything that looks like a tty: USB CDC devices, UARTs and
+// pseudo-terminals, which is how it can be tested without a panel
+// same return conventions as serialib: 1 on success, 0 on timeout and a
+// negative value once the port is gone (unplugged, other side closed),
+// after which the caller should close() and open() it again
+class SerialLink
+{
+public:
+    SerialLink();
+    ~SerialLink();
+
+    // 1 on success, -1 if the port can't be opened, -2 if the baud rate is
+    // not one the driver knows, -3 if the port can't be configured
+    int open(const char *path, unsigned baud);
+    void close();
+    bool isOpen() const { return fd >= 0; }
+
+    int readByte(char &c, int timeoutMs);
+
+    // writes all of data in chunks as fast as the driver takes them,
+    // returns 0 if it could not all go out within timeoutMs
+    int write(const uint8_t *data, size_t size, int timeoutMs);
+
+    // drop everything received so far
+    void flushInput();
+    // drop everything not sent yet, close() would otherwise wait for it
+    void flushOutput();
+
+    // rates up to 4000000 on Linux, USB CDC devices ignore the rate anyway
+    static bool baudSupported(unsigned baud);
+
+private:
+    int fd;
+};
@@ -0,0 +1,545 @@
+#include "source.h"
+#ifndef WIN_ENABLED
+#include "capture.h"
+#endif
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+// pixels the pattern's box moves per grab
+static const int PATTERN_SPEED = 4;
+
+// how often ShmSource looks for a producer that died without closing its ring
+static const int64_t ALIVE_CHECK_US = 1000000;
+
+static int64_t monotonicUs()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void FrameSource::waitForChange(int timeoutMs)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+}
+
+PatternSource::PatternSource(int Width, int Height)
+    : width(Width), height(Height), opened(false), frameNumber(0)
+{
+}
+
+bool PatternSource::open()
+{
+    if (width <= 0 || height <= 0)
+        return false;
+    frameNumber = 0;
+    opened = true;
+    return true;
+}
+
+void PatternSource::close()
+{
+    opened = false;
+    pixels.reset();
+}
+
+void PatternSource::getSize(int &Width, int &Height)
+{
+    Width = width;
+    Height = height;
+}
+
+const uint8_t *PatternSource::grab(int x, int y, int Width, int Height, int &BitsPerPixel, int &Stride)
+{
+    if (!opened || x < 0 || y < 0 || x + Width > width || y + Height > height)
+        return nullptr;
+    size_t stride = alignedStride((size_t)width * 4);
+    // the last frame is drawn over unless compute kept it
+    if (!pixels.unique())
+        pixels = pool.acquire(stride * height);
+    if (!pixels)
+        return nullptr;
+    int box = height / 6 > 1 ? height / 6 : 1;
+    int travel = width - box > 1 ? width - box : 1;
+    int boxX = (int)(frameNumber * PATTERN_SPEED % (2 * travel));
+    if (boxX >= travel)
+        boxX = 2 * travel - boxX;
+    int boxY = (height - box) / 2;
+    for (int py = y; py < y + Height; py++)
+    {
+        uint8_t *row = pixels.data() + py * stride;
+        for (int px = x; px < x + Width; px++)
+        {
+            uint8_t b, g, r;
+            if (px >= boxX && px < boxX + box && py >= boxY && py < boxY + box)
+            {
+                b = g = r = 255;
+            }
+            else if (py < height / 3)
+            {
+                // a ramp across the whole width
+                b = g = r = (uint8_t)(px * 255 / (width > 1 ? width - 1 : 1));
+            }
+            else if (py < height * 2 / 3)
+            {
+                // five steps, around and between the default thresholds
+                static const uint8_t steps[5] = {0, 64, 128, 192, 255};
+                b = g = r = steps[px * 5 / width];
+            }
+            else if (px < width / 2)
+            {
+                b = g = r = ((px ^ py) & 1) ? 255 : 0;
+            }
+            else
+            {
+                // red, green and blue bars, their luma differs
+                int bar = (px - width / 2) * 3 / (width - width / 2);
+                b = bar == 2 ? 255 : 0;
+                g = bar == 1 ? 255 : 0;
+                r = bar == 0 ? 255 : 0;
+            }
+            uint8_t *pixel = row + px * 4;
+            pixel[0] = b;
+            pixel[1] = g;
+            pixel[2] = r;
+            pixel[3] = 0xFF;
+        }
+    }
+    frameNumber++;
+    BitsPerPixel = 32;
+    Stride = (int)stride;
+    return pixels.data() + y * stride + x * 4;
+}
+
+bool PatternSource::keep(FrameRef &frame)
+{
+    if (!pixels)
+        return false;
+    frame = pixels;
+    return true;
+}
+
+RawVideoSource::RawVideoSource(const std::string &path, int Width, int Height, int format)
+    : path(path), width(Width), height(Height), format(format), fd(-1), seekable(false), ended(false),
+      fresh(false), frameBytes(0), filled(0)
+{
+}
+
+RawVideoSource::~RawVideoSource()
+{
+    close();
+}
+
+bool RawVideoSource::open()
+{
+    close();
+    if (ended || width <= 0 || height <= 0)
+        return false;
+    if (path == "-")
+    {
+        fd = STDIN_FILENO;
+    }
+    else
+    {
+        struct stat info;
+        bool fifo = stat(path.c_str(), &info) == 0 && S_ISFIFO(info.st_mode);
+        // with our own write end open a FIFO never reads as ended, and
+        // opening it doesn't wait for a producer
+        fd = ::open(path.c_str(), (fifo ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+        if (fd < 0)
+        {
+            perror("Raw input");
+            return false;
+        }
+    }
+    struct stat info;
+    seekable = fstat(fd, &info) == 0 && S_ISREG(info.st_mode);
+    frameBytes = (size_t)width * height * (format == RAW_GRAY ? 1 : 4);
+    if (seekable && (size_t)info.st_size < frameBytes)
+    {
+        fprintf(stderr, "Raw input: %s is smaller than one frame\n", path.c_str());
+        ended = true;
+        close();
+        return false;
+    }
+    filled = 0;
+    fresh = false;
+    frame = pool.acquire((size_t)width * height * 4);
+    next = pool.acquire(frameBytes);
+    if (!frame || !next)
+    {
+        fprintf(stderr, "Raw input: out of memory\n");
+        close();
+        return false;
+    }
+    // black until the first frame is complete
+    memset(frame.data(), 0, (size_t)width * height * 4);
+    return true;
+}
+
+void RawVideoSource::close()
+{
+    if (fd > STDIN_FILENO)
+        ::close(fd);
+    fd = -1;
+}
+
+void RawVideoSource::getSize(int &Width, int &Height)
+{
+    Width = width;
+    Height = height;
+}
+
+bool RawVideoSource::readAvailable()
+{
+    while (fd >= 0)
+    {
+        pollfd p = {fd, POLLIN, 0};
+        if (poll(&p, 1, 0) <= 0)
+            return false;
+        ssize_t n = read(fd, next.data() + filled, frameBytes - filled);
+        if (n < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            perror("Raw input");
+            close();
+            return false;
+        }
+        if (n == 0)
+        {
+            // the end of a file starts it over, a half frame is dropped
+            if (seekable && lseek(fd, 0, SEEK_SET) == 0)
+            {
+                filled = 0;
+                continue;
+            }
+            fprintf(stderr, "Raw input: end of %s\n", path == "-" ? "stdin" : path.c_str());
+            ended = true;
+            close();
+            return false;
+        }
+        filled += n;
+        if (filled < frameBytes)
+            continue;
+        filled = 0;
+        if (format == RAW_GRAY)
+        {
+            size_t pixels = (size_t)width * height;
+            // a frame compute kept stays as it is
+            FrameRef expanded = frame.unique() ? frame : pool.acquire(pixels * 4);
+            if (!expanded)
+                return false;
+            const uint8_t *in = next.data();
+            uint8_t *out = expanded.data();
+            for (size_t i = 0; i < pixels; i++)
+            {
+                uint8_t v = in[i];
+                out[i * 4 + 0] = v;
+                out[i * 4 + 1] = v;
+                out[i * 4 + 2] = v;
+                out[i * 4 + 3] = 0xFF;
+            }
+            frame = expanded;
+        }
+        else
+        {
+            // the last frame goes back to the pool unless compute kept it
+            FrameRef spare = pool.acquire(frameBytes);
+            if (!spare)
+                return false;
+            frame = next;
+            next = spare;
+        }
+        // one frame per call, a file would otherwise be read to its end
+        return true;
+    }
+    return false;
+}
+
+bool RawVideoSource::takeDamage(int x, int y, int Width, int Height)
+{
+    (void)x, (void)y, (void)Width, (void)Height;
+    if (readAvailable())
+        fresh = true;
+    bool changed = fresh;
+    fresh = false;
+    return changed;
+}
+
+void RawVideoSource::waitForChange(int timeoutMs)
+{
+    // a file always has the next frame ready, the caller paces it
+    if (fd < 0 || seekable)
+    {
+        FrameSource::waitForChange(timeoutMs);
+        return;
+    }
+    pollfd p = {fd, POLLIN, 0};
+    poll(&p, 1, timeoutMs);
+}
+
+const uint8_t *RawVideoSource::grab(int x, int y, int Width, int Height, int &BitsPerPixel, int &Stride)
+{
+    if (!frame || x < 0 || y < 0 || x + Width > width || y + Height > height)
+        return nullptr;
+    BitsPerPixel = 32;
+    Stride = width * 4;
+    return frame.data() + ((size_t)y * width + x) * 4;
+}
+
+bool RawVideoSource::keep(FrameRef &kept)
+{
+    if (!frame)
+        return false;
+    kept = frame;
+    return true;
+}
+
+// a mapped ring with a FrameBuffer for every slot, which stands for the
+// frame held in that slot, dropping its last ref gives the slot back to the
+// producer, the mapping stays until the source is done with it and no slot
+// is held any more, even after the producer moved on to a new ring
+struct ShmSource::Mapping
+{
+    class Slot : public FrameBuffer
+    {
+    public:
+        Mapping *owner;
+        int index;
+
+    protected:
+        void recycle() override
+        {
+            el_ring_release(&owner->ring, index);
+            owner->unref();
+        }
+    };
+
+    el_ring ring;
+    std::atomic<int> users;     // the source and every held slot
+    Slot slots[EL_RING_MAX_SLOTS];
+
+    Mapping() : users(1)
+    {
+        for (int i = 0; i < EL_RING_MAX_SLOTS; i++)
+        {
+            slots[i].owner = this;
+            slots[i].index = i;
+        }
+    }
+
+    void unref()
+    {
+        if (--users == 0)
+        {
+            el_ring_close(&ring);
+            delete this;
+        }
+    }
+};
+
+ShmSource::ShmSource(const std::string &ringName)
+    : ringName(ringName), mapping(nullptr), seen(0), aliveCheckedUs(0)
+{
+}
+
+ShmSource::~ShmSource()
+{
+    close();
+}
+
+bool ShmSource::open()
+{
+    close();
+    Mapping *m = new Mapping;
+    if (el_ring_open(&m->ring, ringName.c_str()) != EL_RING_OK)
+    {
+        delete m;
+        return false;
+    }
+    if (!el_ring_alive(&m->ring))
+    {
+        // left behind by a producer that is gone
+        m->unref();
+        return false;
+    }
+    const el_ring_header *h = m->ring.header;
+    for (uint32_t i = 0; i < h->slots; i++)
+    {
+        m->slots[i].data = m->ring.data + i * h->slot_bytes;
+        m->slots[i].capacity = h->slot_bytes;
+    }
+    mapping = m;
+    seen = 0;
+    aliveCheckedUs = monotonicUs();
+    return true;
+}
+
+void ShmSource::close()
+{
+    if (mapping == nullptr)
+        return;
+    grabbed.reset();
+    mapping->unref();
+    mapping = nullptr;
+}
+
+void ShmSource::getSize(int &Width, int &Height)
+{
+    Width = mapping != nullptr ? mapping->ring.header->width : 0;
+    Height = mapping != nullptr ? mapping->ring.header->height : 0;
+}
+
+const uint8_t *ShmSource::grab(int x, int y, int Width, int Height, int &BitsPerPixel, int &Stride)
+{
+    if (mapping == nullptr)
+        return nullptr;
+    const el_ring_header *h = mapping->ring.header;
+    if (x < 0 || y < 0 || x + Width > (int)h->width || y + Height > (int)h->height)
+        return nullptr;
+    // a newer frame is never in a slot we hold, the producer writes around
+    // those, so its slot has no refs left
+    el_ring_frame frame;
+    int result = el_ring_acquire(&mapping->ring, grabbed ? seen : 0, 0, &frame);
+    if (result == EL_RING_OK)
+    {
+        mapping->users++;
+        grabbed = FrameRef(&mapping->slots[frame.slot]);
+        seen = frame.seq;
+    }
+    else if (!grabbed)
+    {
+        return nullptr;
+    }
+    BitsPerPixel = 32;
+    Stride = h->stride;
+    return grabbed.data() + (size_t)y * h->stride + x * 4;
+}
+
+bool ShmSource::takeDamage(int x, int y, int Width, int Height)
+{
+    (void)x, (void)y, (void)Width, (void)Height;
+    if (mapping == nullptr)
+        return false;
+    int64_t now = monotonicUs();
+    if (now - aliveCheckedUs >= ALIVE_CHECK_US)
+    {
+        aliveCheckedUs = now;
+        if (!el_ring_alive(&mapping->ring))
+        {
+            fprintf(stderr, "Shared memory: the producer of %s is gone\n", ringName.c_str());
+            close();
+            return false;
+        }
+    }
+    return el_ring_latest(&mapping->ring) > seen;
+}
+
+void ShmSource::waitForChange(int timeoutMs)
+{
+    if (mapping == nullptr)
+    {
+        FrameSource::waitForChange(timeoutMs);
+        return;
+    }
+    el_ring_wait(&mapping->ring, seen, timeoutMs);
+}
+
+bool ShmSource::keep(FrameRef &frame)
+{
+    if (mapping == nullptr || !grabbed || mapping->ring.header->slots < MIN_KEEP_SLOTS)
+        return false;
+    frame = grabbed;
+    return true;
+}
+
+// TODO idk if this actually works as I don't use windows
+#ifdef WIN_ENABLED
+// the whole desktop through GDI on every grab
+class GdiCapture : public FrameSource
+{
+public:
+    GdiCapture() : opened(false) {}
+
+    bool open() override
+    {
+        opened = true;
+        return true;
+    }
+    void close() override { opened = false; }
+    bool isOpen() const override { return opened; }
+
+    void getSize(int &Width, int &Height) override
+    {
+        Width = GetSystemMetrics(SM_CXSCREEN);
+        Height = GetSystemMetrics(SM_CYSCREEN);
+    }
+
+    const uint8_t *grab(int x, int y, int Width, int Height, int &BitsPerPixel, int &Stride) override
+    {
+        int screenWidth = 0;
+        int screenHeight = 0;
+        getSize(screenWidth, screenHeight);
+        pixels.resize((size_t)screenWidth * screenHeight * 4);
+        HWND hDesktop = GetDesktopWindow();
+        HDC hDC = GetDC(hDesktop);
+        HDC hMemDC = CreateCompatibleDC(hDC);
+        HBITMAP hBitmap = CreateCompatibleBitmap(hDC, screenWidth, screenHeight);
+        SelectObject(hMemDC, hBitmap);
+        BitBlt(hMemDC, 0, 0, screenWidth, screenHeight, hDC, 0, 0, SRCCOPY);
+        BITMAPINFOHEADER bi;
+        bi.biSize = sizeof(BITMAPINFOHEADER);
+        bi.biWidth = screenWidth;
+        bi.biHeight = -screenHeight;
+        bi.biPlanes = 1;
+        bi.biBitCount = 32;
+        bi.biCompression = BI_RGB;
+        bi.biSizeImage = 0;
+        bi.biXPelsPerMeter = 0;
+        bi.biYPelsPerMeter = 0;
+        bi.biClrUsed = 0;
+        bi.biClrImportant = 0;
+        GetDIBits(hMemDC, hBitmap, 0, screenHeight, &pixels[0], (BITMAPINFO *)&bi, DIB_RGB_COLORS);
+        DeleteObject(hBitmap);
+        DeleteDC(hMemDC);
+        ReleaseDC(hDesktop, hDC);
+        (void)Width, (void)Height;
+        BitsPerPixel = 32;
+        Stride = screenWidth * 4;
+        return &pixels[((size_t)y * screenWidth + x) * 4];
+    }
+
+    const char *name() const override { return "GDI"; }
+
+private:
+    bool opened;
+    std::vector<uint8_t> pixels;
+};
+#endif
+
+std::unique_ptr<FrameSource> createFrameSource(const SourceOptions &options)
+{
+    switch (options.kind)
+    {
+    case SOURCE_PATTERN:
+        return std::unique_ptr<FrameSource>(new PatternSource(options.width, options.height));
+    case SOURCE_RAW:
+        return std::unique_ptr<FrameSource>(
+            new RawVideoSource(options.path, options.width, options.height, options.rawFormat));
+    case SOURCE_SHM:
+        return std::unique_ptr<FrameSource>(new ShmSource(options.shmName));
+    default:
+#ifdef WIN_ENABLED
+        return std::unique_ptr<FrameSource>(new GdiCapture);
+#else
+        return std::unique_ptr<FrameSource>(new X11Capture);
+#endif
+    }
+}
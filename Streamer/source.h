@@ -0,0 +1,192 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "el_ring.h"
+#include "framebuffer.h"
+
+// where ScreenshotThread gets its frames from, the screen (X11Capture, see
+// capture.h) or one of the sources below that need no X server
+//
+// a source hands out BGRA frames (32 bits per pixel) it owns, a grabbed
+// frame stays valid until the next grab() or close(), all calls come from
+// the one thread that opened it, only a FrameRef from keep() can be dropped
+// anywhere
+class FrameSource
+{
+public:
+    virtual ~FrameSource() {}
+
+    virtual bool open() = 0;
+    virtual void close() = 0;
+    virtual bool isOpen() const = 0;
+
+    // size of the whole frame
+    virtual void getSize(int &Width, int &Height) = 0;
+
+    // a Width by Height rectangle of the frame at (x, y), Stride is the
+    // length of one row in bytes, nullptr if the source failed
+    virtual const uint8_t *grab(int x, int y, int Width, int Height, int &BitsPerPixel, int &Stride) = 0;
+
+    // change tracking, a source without it reports every rectangle as
+    // changed, see X11Capture::takeDamage
+    virtual bool trackDamage() { return false; }
+    virtual bool takeDamage(int x, int y, int Width, int Height)
+    {
+        (void)x, (void)y, (void)Width, (void)Height;
+        return true;
+    }
+    // sleep until takeDamage() may have something new, at most timeoutMs
+    virtual void waitForChange(int timeoutMs);
+
+    // a source whose frames stay where they are can lend them to compute
+    // instead of having them copied: keep() refers frame to the memory the
+    // last grab() returned, the source leaves it alone until frame is
+    // dropped, false if the source can't, then the frame has to be copied
+    virtual bool keep(FrameRef &frame)
+    {
+        (void)frame;
+        return false;
+    }
+
+    // "X11" and so on, for messages
+    virtual const char *name() const = 0;
+};
+
+enum SourceKind
+{
+    SOURCE_SCREEN = 0,          // the desktop
+    SOURCE_PATTERN = 1,         // generated test pattern, see PatternSource
+    SOURCE_RAW = 2,             // raw frames from a file, FIFO or stdin, see RawVideoSource
+    SOURCE_SHM = 3,             // frames other processes write into shared memory, see ShmSource
+};
+
+enum RawFormat
+{
+    RAW_BGRA = 0,               // 4 bytes per pixel, as X11 hands them out
+    RAW_GRAY = 1,               // 1 byte per pixel
+};
+
+struct SourceOptions
+{
+    int kind;                   // SourceKind
+    std::string path;           // raw input, "-" for stdin
+    std::string shmName;        // the el_ring of SOURCE_SHM
+    int width;                  // frame size of the pattern and raw sources
+    int height;
+    int rawFormat;              // RawFormat
+
+    SourceOptions()
+        : kind(SOURCE_SCREEN), path("-"), shmName("/el_streamer"), width(1280), height(720), rawFormat(RAW_BGRA)
+    {
+    }
+};
+
+// a moving test pattern: gray ramps at the three panel levels and in
+// between, a one pixel checkerboard for the sampling modes and a box that
+// moves a little every grab, so every frame differs from the last
+// every grab draws into a pooled buffer, so a kept frame stays as it was
+class PatternSource : public FrameSource
+{
+public:
+    PatternSource(int Width, int Height);
+
+    bool open() override;
+    void close() override;
+    bool isOpen() const override { return opened; }
+    void getSize(int &Width, int &Height) override;
+    const uint8_t *grab(int x, int y, int Width, int Height, int &BitsPerPixel, int &Stride) override;
+    bool keep(FrameRef &frame) override;
+    const char *name() const override { return "pattern"; }
+
+private:
+    int width;
+    int height;
+    bool opened;
+    unsigned frameNumber;
+    FramePool pool;
+    FrameRef pixels;            // the whole frame, only the grabbed rectangle is drawn
+};
+
+// frames of a fixed size and format back to back, from an encoder piping
+// into stdin or a FIFO, or from a file (which loops at its end)
+// the input is read without blocking, a frame is read straight into a
+// pooled buffer that becomes the grabbed frame once it is complete, so the
+// grabbed frame is always whole, can be kept, and nothing is allocated once
+// the pool has what compute holds
+// takeDamage() is true once a new frame is complete, a FIFO is kept open
+// for writing as well so producers can come and go
+class RawVideoSource : public FrameSource
+{
+public:
+    RawVideoSource(const std::string &path, int Width, int Height, int format);
+    ~RawVideoSource();
+
+    bool open() override;
+    void close() override;
+    bool isOpen() const override { return fd >= 0; }
+    void getSize(int &Width, int &Height) override;
+    const uint8_t *grab(int x, int y, int Width, int Height, int &BitsPerPixel, int &Stride) override;
+    bool takeDamage(int x, int y, int Width, int Height) override;
+    void waitForChange(int timeoutMs) override;
+    bool keep(FrameRef &frame) override;
+    const char *name() const override { return "raw video"; }
+
+private:
+    // reads what the input has without waiting, true once a frame is complete
+    bool readAvailable();
+
+    std::string path;
+    int width;
+    int height;
+    int format;
+    int fd;
+    bool seekable;              // a file, loops at its end
+    bool ended;                 // stdin or a pipe that was closed, can't be opened again
+    bool fresh;                 // a frame completed since the last takeDamage()
+    size_t frameBytes;          // bytes of one input frame
+    size_t filled;              // bytes of the next frame read so far
+    FramePool pool;
+    FrameRef frame;             // the last complete frame, BGRA
+    FrameRef next;              // the frame being read, BGRA or gray
+};
+
+// frames from an el_ring (see el_ring.h) a producer process writes into,
+// read in place: keep() lends the ring's slot to compute, so a frame is
+// never copied between the producer drawing it and compute converting it
+// waits for a new frame sleep on the ring's futex, a producer that goes away
+// closes the source and open() attaches to the next ring under the name
+class ShmSource : public FrameSource
+{
+public:
+    // the streamer pins up to 3 frames (one per CaptureFrame), the producer
+    // needs one to write and keeps the newest, with fewer slots every frame
+    // is copied instead
+    static const uint32_t MIN_KEEP_SLOTS = 5;
+
+    explicit ShmSource(const std::string &ringName);
+    ~ShmSource();
+
+    bool open() override;
+    void close() override;
+    bool isOpen() const override { return mapping != nullptr; }
+    void getSize(int &Width, int &Height) override;
+    const uint8_t *grab(int x, int y, int Width, int Height, int &BitsPerPixel, int &Stride) override;
+    bool takeDamage(int x, int y, int Width, int Height) override;
+    void waitForChange(int timeoutMs) override;
+    bool keep(FrameRef &frame) override;
+    const char *name() const override { return "shared memory"; }
+
+private:
+    struct Mapping;
+
+    std::string ringName;
+    Mapping *mapping;
+    FrameRef grabbed;           // the slot of the last grab()
+    uint64_t seen;              // seq of the last grab()
+    int64_t aliveCheckedUs;
+};
+
+// the source picked by options, not opened yet
+std::unique_ptr<FrameSource> createFrameSource(const SourceOptions &options);
@@ -0,0 +1,294 @@
+#include "stats.h"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+PipelineStats pipelineStats;
+
+LatencyHistogram::LatencyHistogram() : samples(0), totalUs(0), maxUs(0)
+{
+    for (int i = 0; i < BUCKETS; i++)
+        buckets[i] = 0;
+}
+
+int LatencyHistogram::bucketOf(int64_t us)
+{
+    if (us < 4)
+        return us < 0 ? 0 : (int)us;
+    int log2 = 63 - __builtin_clzll((uint64_t)us);
+    int bucket = log2 * 4 + (int)((us >> (log2 - 2)) & 3) - 4;
+    return bucket < BUCKETS ? bucket : BUCKETS - 1;
+}
+
+int64_t LatencyHistogram::bucketLimit(int bucket)
+{
+    if (bucket < 4)
+        return bucket + 1;
+    int log2 = bucket / 4 + 1;
+    return (int64_t)(5 + bucket % 4) << (log2 - 2);
+}
+
+void LatencyHistogram::record(int64_t us)
+{
+    if (us < 0)
+        us = 0;
+    buckets[bucketOf(us)].fetch_add(1, std::memory_order_relaxed);
+    totalUs.fetch_add(us, std::memory_order_relaxed);
+    samples.fetch_add(1, std::memory_order_relaxed);
+    // every panel's serial thread writes the same histograms
+    int64_t seen = maxUs.load(std::memory_order_relaxed);
+    while (us > seen && !maxUs.compare_exchange_weak(seen, us, std::memory_order_relaxed))
+    {
+    }
+}
+
+double LatencyHistogram::mean() const
+{
+    uint64_t n = count();
+    return n == 0 ? 0 : (double)totalUs.load(std::memory_order_relaxed) / n;
+}
+
+int64_t LatencyHistogram::percentile(double p) const
+{
+    uint64_t counts[BUCKETS];
+    uint64_t total = 0;
+    for (int i = 0; i < BUCKETS; i++)
+    {
+        counts[i] = buckets[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+    if (total == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(p / 100.0 * total + 0.5);
+    if (rank < 1)
+        rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++)
+    {
+        seen += counts[i];
+        if (seen >= rank)
+            return bucketLimit(i) < max() ? bucketLimit(i) : max();
+    }
+    return max();
+}
+
+PipelineStats::PipelineStats()
+    : captured(0), captureFailed(0), captureSkipped(0), converted(0), unchanged(0), sent(0), unrequested(0), prefetched(0),
+      justInTime(0), bytesSent(0),
+      serialOpens(0), captureDropped(0), computeDropped(0), frameBuffers(0)
+{
+}
+
+PortStats::PortStats() : bytesSent(0), framesSent(0), writeUs(0), connects(0), errors(0) {}
+
+std::string PortStats::port() const
+{
+    std::lock_guard<std::mutex> lock(portMutex);
+    return path;
+}
+
+void PortStats::setPort(const char *port)
+{
+    std::lock_guard<std::mutex> lock(portMutex);
+    path = port;
+}
+
+PortStats *PipelineStats::addPort(const char *port)
+{
+    ports.push_back(std::unique_ptr<PortStats>(new PortStats));
+    ports.back()->setPort(port);
+    return ports.back().get();
+}
+
+static void appendHistogram(std::string &out, const char *name, const LatencyHistogram &h)
+{
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer),
+             "\"%s\": {\"count\": %llu, \"mean_us\": %.1f, \"p50_us\": %lld, \"p95_us\": %lld, "
+             "\"p99_us\": %lld, \"max_us\": %lld}",
+             name, (unsigned long long)h.count(), h.mean(), (long long)h.percentile(50),
+             (long long)h.percentile(95), (long long)h.percentile(99), (long long)h.max());
+    out += buffer;
+}
+
+static void appendCounter(std::string &out, const char *name, const std::atomic<uint64_t> &value)
+{
+    char buffer[96];
+    snprintf(buffer, sizeof(buffer), "\"%s\": %llu", name, (unsigned long long)value.load());
+    out += buffer;
+}
+
+std::string PipelineStats::json() const
+{
+    std::string out = "{";
+    appendCounter(out, "captured", captured);
+    out += ", ";
+    appendCounter(out, "capture_failed", captureFailed);
+    out += ", ";
+    appendCounter(out, "capture_skipped", captureSkipped);
+    out += ", ";
+    appendCounter(out, "capture_dropped", captureDropped);
+    out += ", ";
+    appendCounter(out, "converted", converted);
+    out += ", ";
+    appendCounter(out, "unchanged", unchanged);
+    out += ", ";
+    appendCounter(out, "compute_dropped", computeDropped);
+    out += ", ";
+    appendCounter(out, "frame_buffers", frameBuffers);
+    out += ", ";
+    appendCounter(out, "sent", sent);
+    out += ", ";
+    appendCounter(out, "unrequested", unrequested);
+    out += ", ";
+    appendCounter(out, "prefetched", prefetched);
+    out += ", ";
+    appendCounter(out, "just_in_time", justInTime);
+    out += ", ";
+    appendCounter(out, "bytes_sent", bytesSent);
+    out += ", ";
+    appendCounter(out, "serial_opens", serialOpens);
+    out += ",\n \"latency\": {";
+    appendHistogram(out, "capture", capture);
+    out += ",\n  ";
+    appendHistogram(out, "compute", compute);
+    out += ",\n  ";
+    appendHistogram(out, "serial", serial);
+    out += ",\n  ";
+    appendHistogram(out, "end_to_end", endToEnd);
+    out += "},\n \"ports\": [";
+    for (size_t i = 0; i < ports.size(); i++)
+    {
+        const PortStats &p = *ports[i];
+        // port names are paths, only quotes and backslashes (COM ports) need escaping
+        std::string port = p.port();
+        std::string name;
+        for (size_t c = 0; c < port.size(); c++)
+        {
+            if (port[c] == '"' || port[c] == '\\')
+                name += '\\';
+            name += port[c];
+        }
+        uint64_t bytes = p.bytesSent.load();
+        uint64_t us = p.writeUs.load();
+        char buffer[512];
+        snprintf(buffer, sizeof(buffer),
+                 "%s\n  {\"port\": \"%s\", \"frames_sent\": %llu, \"bytes_sent\": %llu, "
+                 "\"write_kbytes_per_s\": %.1f, \"connects\": %llu, \"errors\": %llu}",
+                 i > 0 ? "," : "", name.c_str(), (unsigned long long)p.framesSent.load(),
+                 (unsigned long long)bytes, us > 0 ? bytes * 1000.0 / us : 0.0,
+                 (unsigned long long)p.connects.load(), (unsigned long long)p.errors.load());
+        out += buffer;
+    }
+    out += "]}\n";
+    return out;
+}
+
+StatsExporter::StatsExporter() : intervalMs(1000), listenFd(-1), stopping(false) {}
+
+StatsExporter::~StatsExporter()
+{
+    stop();
+}
+
+bool StatsExporter::start(const std::string &file, const std::string &socket, int interval)
+{
+    stop();
+    filePath = file;
+    socketPath = socket;
+    intervalMs = interval;
+    if (filePath.empty() && socketPath.empty())
+        return true;
+    if (!socketPath.empty())
+    {
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (socketPath.size() >= sizeof(addr.sun_path))
+        {
+            fprintf(stderr, "Stats socket path too long: %s\n", socketPath.c_str());
+            return false;
+        }
+        strcpy(addr.sun_path, socketPath.c_str());
+        // a socket left behind by a previous run would make bind() fail
+        unlink(socketPath.c_str());
+        listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listenFd < 0 || bind(listenFd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(listenFd, 4) != 0)
+        {
+            perror("Stats socket");
+            if (listenFd >= 0)
+                ::close(listenFd);
+            listenFd = -1;
+            return false;
+        }
+    }
+    stopping = false;
+    thread = std::thread(&StatsExporter::loop, this);
+    return true;
+}
+
+void StatsExporter::stop()
+{
+    stopping = true;
+    if (thread.joinable())
+        thread.join();
+    if (listenFd >= 0)
+    {
+        ::close(listenFd);
+        unlink(socketPath.c_str());
+        listenFd = -1;
+    }
+}
+
+void StatsExporter::writeFile(const std::string &snapshot)
+{
+    std::string temp = filePath + ".tmp";
+    FILE *file = fopen(temp.c_str(), "w");
+    if (file == nullptr)
+        return;
+    fwrite(snapshot.data(), 1, snapshot.size(), file);
+    fclose(file);
+    rename(temp.c_str(), filePath.c_str());
+}
+
+void StatsExporter::loop()
+{
+    int64_t nextWrite = 0;
+    while (!stopping)
+    {
+        int64_t now = statsNowUs();
+        if (!filePath.empty() && now >= nextWrite)
+        {
+            writeFile(pipelineStats.json());
+            nextWrite = now + (int64_t)intervalMs * 1000;
+        }
+        if (listenFd < 0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+        // wake up at least every 100 ms so stop() doesn't wait long
+        pollfd fd = {listenFd, POLLIN, 0};
+        if (poll(&fd, 1, 100) <= 0)
+            continue;
+        int client = accept(listenFd, nullptr, nullptr);
+        if (client < 0)
+            continue;
+        std::string snapshot = pipelineStats.json();
+        const char *data = snapshot.data();
+        size_t left = snapshot.size();
+        while (left > 0)
+        {
+            ssize_t written = send(client, data, left, MSG_NOSIGNAL);
+            if (written <= 0)
+                break;
+            data += written;
+            left -= written;
+        }
+        ::close(client);
+    }
+}
@@ -0,0 +1,137 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// pipeline statistics, written by the capture, compute and serial threads
+// and read by the GUI and the stats exporter without any locking
+
+// microseconds on the steady clock, frames carry these through the pipeline
+inline int64_t statsNowUs()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// latency histogram with logarithmic buckets, four per power of two, so
+// every bucket is at most 25% wide from 1 us up to about an hour
+// any number of writers and readers, all counters are relaxed atomics so a
+// reader may see a sample in count before it shows up in its bucket, which
+// is fine for monitoring
+class LatencyHistogram
+{
+public:
+    static const int BUCKETS = 128;
+
+    LatencyHistogram();
+
+    void record(int64_t us);
+
+    uint64_t count() const { return samples.load(std::memory_order_relaxed); }
+    double mean() const;
+    int64_t max() const { return maxUs.load(std::memory_order_relaxed); }
+    // the upper bound of the bucket holding the p-th percentile (but never
+    // more than max()), p in [0, 100]
+    int64_t percentile(double p) const;
+
+    static int bucketOf(int64_t us);
+    static int64_t bucketLimit(int bucket);
+
+private:
+    std::atomic<uint64_t> buckets[BUCKETS];
+    std::atomic<uint64_t> samples;
+    std::atomic<uint64_t> totalUs;
+    std::atomic<int64_t> maxUs;
+};
+
+// one panel's serial link
+struct PortStats
+{
+    std::atomic<uint64_t> bytesSent;
+    std::atomic<uint64_t> framesSent;
+    std::atomic<uint64_t> writeUs;      // time spent writing, bytesSent / writeUs is the link's throughput
+    std::atomic<uint64_t> connects;
+    std::atomic<uint64_t> errors;       // writes that timed out or lost the port
+
+    PortStats();
+
+    // the port picked in the GUI can change while the exporter reads it
+    std::string port() const;
+    void setPort(const char *path);
+
+private:
+    mutable std::mutex portMutex;
+    std::string path;
+};
+
+struct PipelineStats
+{
+    LatencyHistogram capture;           // one grab of the sampled rectangle
+    LatencyHistogram compute;           // sampling, thresholding and packing of a frame
+    LatencyHistogram serial;            // encoding and writing one frame to a port, all panels
+    LatencyHistogram endToEnd;          // start of the grab until the frame is on the wire
+
+    std::atomic<uint64_t> captured;     // frames handed to compute
+    std::atomic<uint64_t> captureFailed;
+    std::atomic<uint64_t> captureSkipped; // no damage on the sampled rectangle, nothing grabbed
+    std::atomic<uint64_t> converted;    // frames handed to serial
+    std::atomic<uint64_t> unchanged;    // panel frames identical to the last one, not handed on
+    std::atomic<uint64_t> sent;         // frames written to the panel
+    std::atomic<uint64_t> unrequested;  // frames the panel did not ask for in time
+    std::atomic<uint64_t> prefetched;   // demand mode, answered with the frame taken after the last send
+    std::atomic<uint64_t> justInTime;   // demand mode, had to wait for a capture after the request
+    std::atomic<uint64_t> bytesSent;
+    std::atomic<uint64_t> serialOpens;  // successful (re)connections to the panel
+
+    // frames a stage published before the next one picked them up, these
+    // mirror TripleBuffer::overwritten() of the handoffs
+    std::atomic<uint64_t> captureDropped;
+    std::atomic<uint64_t> computeDropped;
+
+    // pooled frame buffers allocated so far, stays put once the pipeline is
+    // warm, mirrors FramePool::allocations()
+    std::atomic<uint64_t> frameBuffers;
+
+    // one per panel, added before the pipeline starts
+    std::vector<std::unique_ptr<PortStats>> ports;
+
+    PipelineStats();
+
+    PortStats *addPort(const char *port);
+
+    // every counter and histogram as a single JSON object
+    std::string json() const;
+};
+
+extern PipelineStats pipelineStats;
+
+// periodically writes pipelineStats to a file (replaced atomically, so
+// readers never see half a snapshot) and/or serves it on a Unix socket,
+// every client that connects gets one snapshot and is disconnected
+class StatsExporter
+{
+public:
+    StatsExporter();
+    ~StatsExporter();
+
+    // empty paths disable that output, returns false if the socket could
+    // not be created
+    bool start(const std::string &filePath, const std::string &socketPath, int intervalMs = 1000);
+    void stop();
+
+private:
+    void loop();
+    void writeFile(const std::string &snapshot);
+
+    std::string filePath;
+    std::string socketPath;
+    int intervalMs;
+    int listenFd;
+    std::atomic<bool> stopping;
+    std::thread thread;
+};
@@ -0,0 +1,135 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <sys/types.h>
+#include "handoff.h"
+#include "pack.h"
+#include "stats.h"
+
+// settings and state shared between the pipeline threads in main.cpp, the
+// GUI in gui.cpp and the command line / config file parser in options.cpp
+
+extern uint monitor_width;
+extern uint monitor_height;
+
+// everything that belongs to one panel, each panel samples its own part of
+// the shared capture
+struct PanelSettings
+{
+    char port[256];
+    uint x_disp_size;
+    uint y_disp_size;
+    int x_offset;
+    int y_offset;
+    int x_step;
+    int y_step;
+    bool entireDisp;
+    int sampleMode;                 // see SampleMode in convert.h
+    int ditherMode;                 // see DitherMode in convert.h
+    int threshHigh;
+    int threshMid;
+    int autoThreshold;              // see AutoThresholdMode in threshold.h
+    unsigned baud;                  // see SerialLink::baudSupported
+    PanelFormat format;             // how the panel wants its frame buffer packed
+
+    PanelSettings();
+};
+
+extern char magic_symbol;
+extern bool deltaFrames;
+extern int compression;
+
+// what makes the capture thread take the next frame
+enum ScheduleMode
+{
+    SCHEDULE_TIMED = 0,         // every 1 / frameRate, the panels take what they need
+    SCHEDULE_DEMAND = 1,        // a panel's request, frames are at most 1 / frameRate old
+};
+
+extern int scheduleMode;
+extern float frameRate;             // the target capture rate
+extern std::atomic<double> deltaScTime;
+extern std::atomic<double> deltaSerialTime;
+
+// cleared to make every pipeline thread return
+extern std::atomic<bool> running;
+
+// one converted frame, ready to be sent to the display
+struct PanelFrame
+{
+    std::vector<uint8_t> data;      // the frame buffer compute packed, see PanelFormat
+    const uint8_t *mapped;          // or a replayed one, left in the recording's mapping
+    size_t mappedBytes;
+    PanelFormat format;             // what the bytes are packed in
+    uint size_x;
+    uint size_y;
+    int64_t capturedUs;             // carried over from the CaptureFrame
+
+    PanelFrame() : mapped(nullptr), mappedBytes(0), size_x(0), size_y(0), capturedUs(0)
+    {
+        format.bits = 2;
+        format.bitOrder = MSB_FIRST;
+        format.scanOrder = SCAN_ROWS;
+    }
+
+    // the bytes that go to the panel, wherever they are
+    const uint8_t *bytes() const { return mapped != nullptr ? mapped : data.data(); }
+    size_t size() const { return mapped != nullptr ? mappedBytes : data.size(); }
+};
+
+// the thresholded frame as the panel will show it, one byte per pixel
+struct PreviewFrame
+{
+    std::vector<uint8_t> pixels;
+    uint size_x;
+    uint size_y;
+};
+
+// a panel and its end of the pipeline, compute converts every panel from the
+// same capture and each panel has its own serial thread
+struct Panel
+{
+    TripleBuffer<PanelFrame> frames;        // compute -> serial
+    TripleBuffer<PreviewFrame> previews;    // compute -> gui
+    PortStats *linkStats;                   // owned by pipelineStats
+    // the newest frame published to frames still shows the screen as of
+    // this time, moved on without publishing while the screen is static
+    std::atomic<int64_t> currentUs;
+    // thresholds --auto-threshold picked for the next frame, written by
+    // compute only, AUTO_UNSET while it is off or hasn't picked any yet
+    // settings.threshHigh/threshMid stay what the user set, auto starts from them
+    std::atomic<int> autoHigh;
+    std::atomic<int> autoMid;
+
+    static const int AUTO_UNSET = -2;
+
+    Panel() : linkStats(nullptr), currentUs(0), autoHigh(AUTO_UNSET), autoMid(AUTO_UNSET) {}
+
+    // the GUI edits the settings while every thread reads them, so nobody
+    // holds on to the panel's copy, they take their own and hand back a whole one
+    PanelSettings current() const
+    {
+        std::lock_guard<std::mutex> lock(settingsMutex);
+        return settings;
+    }
+    void publish(const PanelSettings &changed)
+    {
+        std::lock_guard<std::mutex> lock(settingsMutex);
+        settings = changed;
+    }
+
+private:
+    mutable std::mutex settingsMutex;
+    PanelSettings settings;
+};
+
+// set up before the pipeline starts and never resized while it runs
+extern std::vector<std::unique_ptr<Panel>> panels;
+
+#ifndef HEADLESS
+// runs the window until it is closed
+void guiThread();
+#endif
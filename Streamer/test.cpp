@@ -0,0 +1,284 @@
+// correctness checks, built and run with `make test`, exits with 1 if any
+// of them fails
+// the SIMD conversion kernels and the specialised packers have to match
+// their scalar references bit for bit, and the luma histogram has to count
+// every pixel once however the frame is split between threads, as does the
+// gray frame 4 bit panels are packed from
+// el_bench is for timings, these need no display and run in a second
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <vector>
+#include "convert.h"
+#include "pack.h"
+#include "pool.h"
+
+struct TestSize
+{
+    const char *name;
+    uint size_x;
+    uint size_y;
+};
+
+static uint32_t seed = 12345;
+
+static uint32_t nextRandom(uint32_t range)
+{
+    seed = seed * 1664525 + 1013904223;
+    return (seed >> 8) % range;
+}
+
+// every SIMD kernel the CPU runs against convertRowScalar on random rows,
+// lengths with and without a tail that doesn't fill a byte, thresholds well
+// outside of -1..255 and in either order, with and without the histogram
+static bool testConvertKernels()
+{
+    std::vector<std::pair<const char *, ConvertRowFn>> kernels;
+#if defined(__SSE2__)
+    kernels.push_back(std::make_pair("SSE2", convertRowSSE2));
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        kernels.push_back(std::make_pair("AVX2", convertRowAVX2));
+#endif
+    const int rows = 4000;
+    const int maxPixels = 300;
+    // one pixel of slack so rows also start off a 16 byte boundary
+    std::vector<uint8_t> bgra((maxPixels + 1) * 4);
+    std::vector<uint8_t> preview[2], packed[2];
+    std::vector<uint32_t> histogram[2];
+    for (size_t k = 0; k < kernels.size(); k++)
+    {
+        for (int r = 0; r < rows; r++)
+        {
+            int n = nextRandom(maxPixels + 1);
+            const uint8_t *row = &bgra[nextRandom(2) * 4];
+            for (size_t i = 0; i < bgra.size(); i++)
+            {
+                // mostly around the thresholds, some anywhere
+                bgra[i] = nextRandom(4) == 0 ? nextRandom(256) : 90 + nextRandom(40);
+            }
+            int threshHigh = (int)nextRandom(800) - 300;
+            int threshMid = (int)nextRandom(800) - 300;
+            bool counted = nextRandom(2) == 0;
+            for (int v = 0; v < 2; v++)
+            {
+                // what is past the end of the outputs must be left alone
+                preview[v].assign(maxPixels + 8, 0xCD);
+                packed[v].assign(maxPixels / 4 + 8, 0xCD);
+                histogram[v].assign(256, 7);
+                ConvertRowFn fn = v == 0 ? convertRowScalar : kernels[k].second;
+                fn(row, n, threshHigh, threshMid, &preview[v][0], &packed[v][0],
+                   counted ? &histogram[v][0] : nullptr);
+            }
+            if (preview[0] != preview[1] || packed[0] != packed[1] || histogram[0] != histogram[1])
+            {
+                fprintf(stderr, "%s kernel differs from scalar: %d pixels, high %d, mid %d, %s histogram\n",
+                        kernels[k].first, n, threshHigh, threshMid, counted ? "with" : "without");
+                return false;
+            }
+        }
+        printf("%-12s matches scalar on %d random rows\n", kernels[k].first, rows);
+    }
+    if (kernels.empty())
+        printf("%-12s no SIMD kernel on this CPU\n", "convert");
+    return true;
+}
+
+// every packer, straight and in row tiles, against packFrameReference on
+// sizes whose rows don't fill whole bytes and whose height isn't a multiple
+// of the transpose block, into buffers holding garbage
+static bool testPackers()
+{
+    static const TestSize sizes[] = {
+        {"1x1", 1, 1},
+        {"3x5", 3, 5},
+        {"7x33", 7, 33},
+        {"13x31", 13, 31},
+        {"37x65", 37, 65},
+        {"101x47", 101, 47},
+        {"318x239", 318, 239},
+        {"640x481", 640, 481},
+    };
+    WorkerPool pool(3);
+    std::vector<std::vector<uint8_t>> scratch(pool.size());
+    int checked = 0;
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        const TestSize &size = sizes[s];
+        std::vector<uint8_t> preview(size.size_x * size.size_y);
+        for (size_t i = 0; i < preview.size(); i++)
+            preview[i] = nextRandom(3) * 127;
+        for (int bits = 1; bits <= 4; bits *= 2)
+        {
+            for (int scan = SCAN_ROWS; scan <= SCAN_COLUMNS; scan++)
+            {
+                for (int order = MSB_FIRST; order <= LSB_FIRST; order++)
+                {
+                    PanelFormat format = {bits, order, scan};
+                    size_t bytes = packedSize(format, size.size_x, size.size_y);
+                    std::vector<uint8_t> reference(bytes);
+                    packFrameReference(format, &preview[0], size.size_x, size.size_y, &reference[0]);
+                    for (int tiled = 0; tiled < 2; tiled++)
+                    {
+                        std::vector<uint8_t> packed(bytes, 0xCD);
+                        PackFn pack = selectPacker(format);
+                        if (tiled)
+                            packTiles(format, pack, &preview[0], size.size_x, size.size_y, &packed[0], pool,
+                                      scratch);
+                        else
+                            pack(&preview[0], size.size_x, size.size_y, &packed[0], scratch[0]);
+                        if (packed != reference)
+                        {
+                            fprintf(stderr, "%s %s: packed frame does not match the reference%s\n", size.name,
+                                    formatName(format), tiled ? " in row tiles" : "");
+                            return false;
+                        }
+                        checked++;
+                    }
+                }
+            }
+        }
+    }
+    printf("%-12s %d frames match the reference\n", "packers", checked);
+    return true;
+}
+
+// the histogram convertFrame counts for --auto-threshold against the lumas
+// of the samples counted one by one, for every dither mode and sampling
+// mode, on one thread and split into tiles between several
+static bool testHistograms()
+{
+    static const TestSize panels[] = {
+        {"96x61", 96, 61},
+        {"98x62", 98, 62},      // rows that don't fill whole bytes
+    };
+    const int width = 333;
+    const int height = 201;
+    std::vector<uint8_t> screen(width * height * 4);
+    for (size_t i = 0; i < screen.size(); i++)
+        screen[i] = nextRandom(256);
+    WorkerPool single(1);
+    WorkerPool several(3);
+    int checked = 0;
+    for (size_t p = 0; p < sizeof(panels) / sizeof(panels[0]); p++)
+    {
+        const TestSize &panel = panels[p];
+        std::vector<uint8_t> preview(panel.size_x * panel.size_y);
+        std::vector<uint8_t> packed(panel.size_x * panel.size_y / 4);
+        for (int mode = SAMPLE_POINT; mode <= SAMPLE_AREA; mode++)
+        {
+            SampleRegion region = computeSampleRegion(width, height, panel.size_x, panel.size_y, 0, 0, 1, 1,
+                                                      true, mode);
+            const uint8_t *image = &screen[(region.y * width + region.x) * 4];
+            uint32_t expected[256] = {0};
+            SampleScratch sample;
+            for (uint y = 0; y < panel.size_y; y++)
+            {
+                const uint8_t *row = sampleRow(image, width * 4, region, y, sample);
+                for (uint x = 0; x < panel.size_x; x++)
+                    expected[luma(row + x * 4)]++;
+            }
+            for (int dither = DITHER_NONE; dither <= DITHER_ATKINSON; dither++)
+            {
+                for (int threads = 0; threads < 2; threads++)
+                {
+                    ConvertScratch scratch;
+                    uint32_t histogram[256];
+                    memset(histogram, 0xCD, sizeof(histogram));
+                    convertFrame(image, width * 4, region, 100, 50, dither, threads ? several : single, scratch,
+                                 &preview[0], &packed[0], histogram);
+                    if (memcmp(histogram, expected, sizeof(expected)) != 0)
+                    {
+                        fprintf(stderr, "%s %s: the %s histogram on %d threads does not count every sample once\n",
+                                panel.name, mode == SAMPLE_POINT ? "point" : "area", ditherName(dither),
+                                threads ? several.size() : 1);
+                        return false;
+                    }
+                    checked++;
+                }
+            }
+        }
+    }
+    printf("%-12s %d frames count every sample once\n", "histograms", checked);
+    return true;
+}
+
+// grayFrame against the luma of every sample rounded to 16 grays, and the
+// 4 bit packer has to get all 16 of them out of it
+static bool testGrayFrame()
+{
+    const uint size_x = 98;
+    const uint size_y = 62;
+    const int width = 300;
+    const int height = 200;
+    std::vector<uint8_t> screen(width * height * 4);
+    for (size_t i = 0; i < screen.size(); i++)
+        screen[i] = nextRandom(256);
+    WorkerPool single(1);
+    WorkerPool several(3);
+    int checked = 0;
+    for (int mode = SAMPLE_POINT; mode <= SAMPLE_AREA; mode++)
+    {
+        SampleRegion region = computeSampleRegion(width, height, size_x, size_y, 0, 0, 1, 1, true, mode);
+        const uint8_t *image = &screen[(region.y * width + region.x) * 4];
+        std::vector<uint8_t> expected(size_x * size_y);
+        uint32_t expectedHistogram[256] = {0};
+        SampleScratch sample;
+        for (uint y = 0; y < size_y; y++)
+        {
+            const uint8_t *row = sampleRow(image, width * 4, region, y, sample);
+            for (uint x = 0; x < size_x; x++)
+            {
+                int l = luma(row + x * 4);
+                expectedHistogram[l]++;
+                expected[y * size_x + x] = (uint8_t)((l * 15 + 127) / 255 * 17);
+            }
+        }
+        for (int threads = 0; threads < 2; threads++)
+        {
+            ConvertScratch scratch;
+            std::vector<uint8_t> preview(size_x * size_y, 0xCD);
+            uint32_t histogram[256];
+            memset(histogram, 0xCD, sizeof(histogram));
+            grayFrame(image, width * 4, region, threads ? several : single, scratch, &preview[0], histogram);
+            if (preview != expected || memcmp(histogram, expectedHistogram, sizeof(expectedHistogram)) != 0)
+            {
+                fprintf(stderr, "%s gray frame on %d threads does not match the lumas\n",
+                        mode == SAMPLE_POINT ? "point" : "area", threads ? several.size() : 1);
+                return false;
+            }
+            checked++;
+        }
+    }
+    // every gray once, the 4 bit panel gets nibbles 0..15
+    uint8_t grays[16];
+    for (int g = 0; g < 16; g++)
+        grays[g] = (uint8_t)(g * 17);
+    PanelFormat format = {4, MSB_FIRST, SCAN_ROWS};
+    uint8_t packed[8];
+    packFrameReference(format, grays, 16, 1, packed);
+    for (int g = 0; g < 16; g++)
+    {
+        if (((packed[g / 2] >> (g % 2 ? 0 : 4)) & 15) != g)
+        {
+            fprintf(stderr, "gray %d does not pack to %d on a 4 bit panel\n", g * 17, g);
+            return false;
+        }
+    }
+    printf("%-12s %d frames round to 16 grays\n", "gray", checked);
+    return true;
+}
+
+int main()
+{
+    bool ok = testConvertKernels();
+    ok = testPackers() && ok;
+    ok = testHistograms() && ok;
+    ok = testGrayFrame() && ok;
+    printf("%s\n", ok ? "all tests passed" : "FAILED");
+    return ok ? 0 : 1;
+}
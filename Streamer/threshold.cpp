@@ -0,0 +1,95 @@
+#include "threshold.h"
+
+const char *autoThresholdName(int mode)
+{
+    switch (mode)
+    {
+    case AUTO_THRESHOLD_OTSU:
+        return "Otsu";
+    case AUTO_THRESHOLD_PERCENTILE:
+        return "percentile";
+    default:
+        return "off";
+    }
+}
+
+// the split [0, mid] [mid + 1, high] [high + 1, 255] with the largest
+// variance between the three classes, cumulative sums make every class
+// O(1) so the whole search is 256 * 256 / 2 steps
+static void otsu(const uint64_t count[257], const uint64_t sum[257], int &high, int &mid)
+{
+    double total = (double)count[256];
+    double best = -1;
+    for (int t1 = 0; t1 < 254; t1++)
+    {
+        double w0 = (double)count[t1 + 1];
+        if (w0 == 0)
+            continue;
+        double m0 = (double)sum[t1 + 1] * sum[t1 + 1] / w0;
+        for (int t2 = t1 + 1; t2 < 255; t2++)
+        {
+            double w1 = (double)(count[t2 + 1] - count[t1 + 1]);
+            double w2 = total - w0 - w1;
+            if (w1 == 0 || w2 == 0)
+                continue;
+            double s1 = (double)(sum[t2 + 1] - sum[t1 + 1]);
+            double s2 = (double)(sum[256] - sum[t2 + 1]);
+            // sum of w * mean^2, the rest of the variance doesn't depend on the split
+            double between = m0 + s1 * s1 / w1 + s2 * s2 / w2;
+            if (between > best)
+            {
+                best = between;
+                mid = t1;
+                high = t2;
+            }
+        }
+    }
+}
+
+// the lumas a third and two thirds of the way through the pixels
+static void percentile(const uint64_t count[257], int &high, int &mid)
+{
+    uint64_t total = count[256];
+    mid = 0;
+    while (mid < 255 && count[mid + 1] * 3 < total)
+        mid++;
+    high = mid;
+    while (high < 255 && count[high + 1] * 3 < total * 2)
+        high++;
+    // level 1 needs at least one luma of its own
+    if (high <= mid)
+        high = mid < 255 ? mid + 1 : 255;
+}
+
+bool autoThreshold(int mode, const uint32_t histogram[256], int &threshHigh, int &threshMid)
+{
+    if (mode != AUTO_THRESHOLD_OTSU && mode != AUTO_THRESHOLD_PERCENTILE)
+        return false;
+    // count[v] and sum[v] are over the lumas below v
+    uint64_t count[257];
+    uint64_t sum[257];
+    count[0] = sum[0] = 0;
+    int used = 0;
+    for (int v = 0; v < 256; v++)
+    {
+        count[v + 1] = count[v] + histogram[v];
+        sum[v + 1] = sum[v] + (uint64_t)histogram[v] * v;
+        used += histogram[v] != 0;
+    }
+    if (used < 2)
+        return false;
+    int high = threshHigh;
+    int mid = threshMid;
+    if (mode == AUTO_THRESHOLD_OTSU)
+        otsu(count, sum, high, mid);
+    else
+        percentile(count, high, mid);
+    int dHigh = high - threshHigh;
+    int dMid = mid - threshMid;
+    if (dHigh <= AUTO_THRESHOLD_HYSTERESIS && dHigh >= -AUTO_THRESHOLD_HYSTERESIS &&
+        dMid <= AUTO_THRESHOLD_HYSTERESIS && dMid >= -AUTO_THRESHOLD_HYSTERESIS)
+        return false;
+    threshHigh = high;
+    threshMid = mid;
+    return true;
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <cstdint>
+
+// picks threshMid and threshHigh from the luma histogram convertFrame()
+// counts while it converts, so the thresholds follow the content instead of
+// being tuned by hand
+
+enum AutoThresholdMode
+{
+    AUTO_THRESHOLD_OFF = 0,         // the thresholds are left alone
+    AUTO_THRESHOLD_OTSU = 1,        // 3 class Otsu, maximises the variance between the levels
+    AUTO_THRESHOLD_PERCENTILE = 2,  // a third of the pixels at each level
+};
+
+// thresholds move only once the picked ones are further than this from the
+// current ones, small changes of the content (a blinking cursor, a clock)
+// leave them alone instead of making the picture flicker
+static const int AUTO_THRESHOLD_HYSTERESIS = 8;
+
+// updates threshHigh and threshMid from histogram (256 bins of luma),
+// returns whether they changed
+// a histogram with less than two different lumas says nothing about where
+// the levels should split and keeps the current thresholds
+bool autoThreshold(int mode, const uint32_t histogram[256], int &threshHigh, int &threshMid);
+
+// "Otsu" and so on
+const char *autoThresholdName(int mode);